@@ -1,9 +1,34 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#define HAVE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+#ifdef __FMA__
+#include <immintrin.h>
+#endif
 
 #include "cglm/cglm.h"
 #include "glad/glad.h"
@@ -15,6 +40,31 @@
 enum { SCREEN_WIDTH = 800, SCREEN_HEIGHT = 600 };
 enum { MAX_VERT = 1024, MAX_IDX = 4096 };
 enum { ONE_MB = 1024 * 1024 };
+enum { STRESS_RESIZE_COUNT = 1000 };
+enum { BLOOM_LEVEL_COUNT = 5 };
+enum { MAX_GPU_ZONES = 16, GPU_QUERY_LATENCY = 4 };
+enum { MAX_PROFILER_COUNTERS = 16 };
+enum { GLYPH_FULL_BLOCK = 219 };
+enum { MAX_VIEWS = 4 };
+enum { MAX_GL_DEBUG_MESSAGES = 256 };
+enum { WINDOW_EVENT_QUEUE_SIZE = 1024 };
+enum { LATENCY_FRAMES_IN_FLIGHT = 8, LATENCY_MAX_EVENTS = 64, LATENCY_MAX_SAMPLES = 4096 };
+enum { FLUID_WIDTH = 128, FLUID_HEIGHT = 96 };
+enum { PCG_MAX_ITERATIONS = 100, MG_MAX_LEVELS = 8 };
+enum { TEMPORAL_DEFAULT_DEPTH = 4, TEMPORAL_MAX_DEPTH = 16, TEMPORAL_BLOCK_ROWS = 8 };
+enum { MAX_BODIES = 2048, MAX_BODY_VERTICES = 8, DEFAULT_BODY_COUNT = 200 };
+enum { SMOKE_DEFAULT_SIZE = 64, SMOKE_MAX_SIZE = 256, SMOKE_BLOCK_ROWS = 16 };
+enum { EULER_DEFAULT_SIZE = 256, EULER_MAX_SIZE = 2048, EULER_LINE_SIZE = EULER_MAX_SIZE + 4, EULER_STEPS_PER_FRAME = 2 };
+enum { AMR_BLOCK = 16, AMR_HALO = 2, AMR_BLOCK_STRIDE = AMR_BLOCK + 2 * AMR_HALO, AMR_BLOCK_AREA = AMR_BLOCK_STRIDE * AMR_BLOCK_STRIDE };
+enum { AMR_ROOTS = 4, AMR_MAX_LEVEL = 6, AMR_DEFAULT_MAX_LEVEL = 3, AMR_REGRID_INTERVAL = 4, AMR_STEPS_PER_FRAME = 4 };
+enum { REACTION_DEFAULT_SIZE = 256, REACTION_MAX_SIZE = 2048, REACTION_STEPS_PER_FRAME = 16, REACTION_SEED_COUNT = 12 };
+enum { TUNNEL_WIDTH = 160, TUNNEL_HEIGHT = 64, TUNNEL_LOG_BUFFER_SIZE = 64 * 1024 };
+enum { MAX_PERF_ZONES = 32, MAX_PERF_ZONE_DEPTH = 8 };
+enum { MAX_THREADS = 64, MAX_TUNING_ENTRIES = 64 };
+enum { MAX_SWEEP_VALUES = 16, MAX_SWEEP_CASES = 4096, SNAPSHOT_MAX_COLS = 96 };
+enum { MAX_HOT_KERNELS = 16, BENCH_STEP_COUNT = 200, BENCH_WARMUP_STEPS = 20 };
+enum { TRIAD_ELEMENT_COUNT = 4 * 1024 * 1024, TRIAD_REPEATS = 5 };
+enum { MAX_MEM_OWNERS = 64, MAX_GL_ALLOCATIONS = 256, ALLOC_HEADER_SIZE = 16 };
 
 typedef struct Texture {
     uint32_t id;
@@ -36,6 +86,7 @@ typedef struct Gl_State {
     uint32_t ebo;
     uint32_t vao;
     uint32_t shader;
+    uint32_t cell_shader;
     Texture empty_texture;
 } Gl_State;
 
@@ -46,37 +97,1272 @@ typedef struct {
     uint32_t v_count;
 } Ascii_Atlas;
 
+// Color is an index into the palette (see Palette)
+typedef struct Cell {
+    uint8_t glyph;
+    uint8_t color;
+} Cell;
+
+// GPU copy of a visible cell; index is the cell's position in the grid (x + y * cols)
+typedef struct Cell_Instance {
+    uint32_t index;
+    uint8_t glyph;
+    uint8_t color;
+    uint16_t padding;
+} Cell_Instance;
+
+// Only visible cells are uploaded, compacted into instances each frame (per-row counts, a scan
+// over rows, then a parallel scatter), so draw cost follows the visible glyphs, not the grid.
+// The CPU arrays and the GPU buffer only grow (by doubling), so reflowing on every resize event
+// doesn't churn allocations. Per-frame uploads orphan the buffer instead of stalling.
+// With several views, each view is a full cols x rows grid and the views are stacked by rows in
+// the same arrays, so compaction, upload and the instanced draw cover all of them at once.
+typedef struct Cell_Grid {
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t view_count;
+    uint32_t tile_dim;
+    uint32_t capacity;
+    Cell *cells;
+    Cell_Instance *instances;
+    uint32_t *row_offsets;
+    uint32_t instance_count;
+
+    uint32_t vao;
+    uint32_t instance_vbo;
+    uint32_t gpu_capacity;
+
+    uint32_t reflow_count;
+    uint32_t cpu_alloc_count;
+    uint32_t gpu_alloc_count;
+} Cell_Grid;
+
+typedef enum View_Field {
+    VIEW_DENSITY,
+    VIEW_VELOCITY,
+    VIEW_PRESSURE,
+    VIEW_VORTICITY,
+    VIEW_FIELD_COUNT
+} View_Field;
+
+// Side-by-side diagnostics: one view per field in a 2x2 split of the window, each drawn at half
+// tile scale so it keeps the full grid resolution. Fields are normalized into field before filling.
+typedef struct Split_Views {
+    bool enabled;
+    float *field;
+    size_t field_bytes;
+} Split_Views;
+
+typedef struct Render_Target {
+    uint32_t fbo;
+    Texture tex;
+    uint32_t depth; // Optional depth texture
+} Render_Target;
+
+// Which cells an instanced cell draw covers. Opaque cells (full-block glyph, alpha 1, no
+// additive glow) can be drawn first with depth writes so early-Z rejects what's under them.
+typedef enum Cell_Pass {
+    CELL_PASS_ALL,
+    CELL_PASS_OPAQUE,
+    CELL_PASS_TRANSLUCENT
+} Cell_Pass;
+
+// Debug view: the frame's geometry is drawn again into an R32F target with additive blending
+// while the shaders output 1, so each texel ends up holding the fragments shaded there
+typedef struct Heatmap_State {
+    bool enabled;
+    Render_Target target;
+    uint32_t shader;
+    uint32_t queries[GPU_QUERY_LATENCY];
+    bool pending[GPU_QUERY_LATENCY];
+} Heatmap_State;
+
+typedef enum Draw_Layer {
+    LAYER_OPAQUE_CELLS,
+    LAYER_BACKGROUND,
+    LAYER_GLYPHS,
+    LAYER_COUNT
+} Draw_Layer;
+
+// GL_SAMPLES_PASSED per layer, read back GPU_QUERY_LATENCY frames later like the GPU zones.
+// Samples over window pixels is the overdraw factor; toggling depth layering shows what
+// early-Z saves at the current window size.
+typedef struct Overdraw_Meter {
+    bool depth_layering;
+    uint32_t queries[LAYER_COUNT][GPU_QUERY_LATENCY];
+    bool pending[LAYER_COUNT][GPU_QUERY_LATENCY];
+    uint64_t samples[LAYER_COUNT];
+    double pixels;
+} Overdraw_Meter;
+
+// Bright-pass into levels[0] (half res), dual-filter (Kawase) downsample through the chain,
+// then upsample back with additive blending and composite over the scene. Pass count only
+// depends on BLOOM_LEVEL_COUNT, never on the window size.
+typedef struct Bloom_State {
+    bool enabled;
+    float threshold;
+    float intensity;
+    uint32_t empty_vao;
+    uint32_t bright_shader;
+    uint32_t down_shader;
+    uint32_t up_shader;
+    uint32_t composite_shader;
+    Render_Target scene;
+    Render_Target levels[BLOOM_LEVEL_COUNT];
+} Bloom_State;
+
+// Grid rendered at its native resolution (cells * tile_dim) and presented with a single
+// scaled quad, so the per-tile cost doesn't depend on the window size.
+typedef struct Canvas_State {
+    bool enabled;
+    bool integer_scale;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t tile_dim;
+    Render_Target target;
+    int32_t prev_fbo;
+    float prev_clear_color[4];
+} Canvas_State;
+
+typedef struct Gpu_Zone {
+    const char *name;
+    uint32_t queries[GPU_QUERY_LATENCY];
+    bool pending[GPU_QUERY_LATENCY];
+    double total_ms;
+    uint32_t samples;
+} Gpu_Zone;
+
+typedef struct Profiler_Counter {
+    const char *name;
+    uint64_t total;
+} Profiler_Counter;
+
+// GPU zones use GL_TIME_ELAPSED queries and are read back GPU_QUERY_LATENCY frames later,
+// so timing never stalls the pipeline. Zones can't nest (one TIME_ELAPSED query at a time).
+typedef struct Profiler {
+    bool report_enabled;
+    uint32_t frame_index;
+    uint32_t frames_since_report;
+    double last_report_time;
+    Gpu_Zone gpu_zones[MAX_GPU_ZONES];
+    uint32_t gpu_zone_count;
+    Gpu_Zone *active_gpu_zone;
+    Profiler_Counter counters[MAX_PROFILER_COUNTERS];
+    uint32_t counter_count;
+} Profiler;
+
+typedef struct Gl_Debug_Message {
+    GLuint id;
+    GLenum source;
+    GLenum type;
+    GLenum severity;
+    uint32_t count;
+} Gl_Debug_Message;
+
+// Messages are deduplicated by (source, type, id): the first occurrence is logged, repeats are
+// only counted and summarized at exit. Performance warnings are also fed to the profiler.
+typedef struct Gl_Debug_State {
+    Gl_Debug_Message messages[MAX_GL_DEBUG_MESSAGES];
+    uint32_t message_count;
+    uint32_t dropped_count;
+    uint32_t frame_perf_warnings;
+} Gl_Debug_State;
+
+// Input events waiting for the frame that will apply them, then that frame's fence and
+// GPU timestamp after swap. Frames are retired without stalling once their fence signals.
+typedef struct Latency_Frame {
+    bool pending;
+    GLsync fence;
+    uint32_t query;
+    uint64_t input_ns[LATENCY_MAX_EVENTS];
+    uint32_t input_count;
+    uint64_t sim_ns;
+    uint64_t swap_ns;
+} Latency_Frame;
+
+// Input-to-photon latency, measured to GPU completion of the frame whose simulation consumed
+// the input. Scan-out after that is up to one refresh more and isn't visible from here.
+// Events are stamped by the callbacks on the event thread, which sleeps in glfwWaitEvents, so
+// the stamp is taken as soon as GLFW delivers the event.
+typedef struct Latency_Tracker {
+    bool enabled;
+    uint64_t pending_ns[LATENCY_MAX_EVENTS];
+    uint32_t pending_count;
+    uint32_t dropped_events;
+    // Frames whose fence did not signal within a blocking wait; their samples are discarded
+    uint32_t dropped_frames;
+    Latency_Frame frames[LATENCY_FRAMES_IN_FLIGHT];
+    uint32_t frame_index;
+    // GPU clock to CPU clock offset, refreshed at every report
+    int64_t gpu_to_cpu_ns;
+    float total_ms[LATENCY_MAX_SAMPLES];
+    float queue_ms[LATENCY_MAX_SAMPLES];
+    float cpu_ms[LATENCY_MAX_SAMPLES];
+    float gpu_ms[LATENCY_MAX_SAMPLES];
+    uint32_t sample_count;
+    double last_report_time;
+} Latency_Tracker;
+
+// Left-drag stirs the 2D fluid; position in window pixels
+typedef struct Mouse_State {
+    bool down;
+    double x, y;
+    double dx, dy;
+} Mouse_State;
+
+typedef enum Fluid_Solver {
+    SOLVER_GAUSS_SEIDEL,
+    SOLVER_JACOBI,
+    SOLVER_COUNT
+} Fluid_Solver;
+
+typedef enum Fluid_Scenario {
+    SCENARIO_JET,
+    SCENARIO_WIND_TUNNEL,
+    SCENARIO_MULTIPHASE,
+    SCENARIO_BODIES,
+    SCENARIO_COUNT
+} Fluid_Scenario;
+
+typedef enum Window_Event_Type {
+    WINDOW_EVENT_KEY,
+    WINDOW_EVENT_RESIZE,
+    WINDOW_EVENT_CURSOR,
+    WINDOW_EVENT_MOUSE_BUTTON
+} Window_Event_Type;
+
+typedef struct Window_Event {
+    Window_Event_Type type;
+    int key, action;
+    int w, h;
+    double x, y;
+    uint64_t time_ns;
+} Window_Event;
+
+typedef struct Reaction_Params {
+    int n;
+    float feed, kill;
+    float diffusion_u, diffusion_v;
+    // Splits each species' diffusion between x (1 + anisotropy) and y (1 - anisotropy)
+    float anisotropy;
+    float dt;
+    int steps_per_frame;
+} Reaction_Params;
+
+// Gray-Scott reaction-diffusion on a periodic n x n grid, padded like the 2D fluid. u is the
+// substrate and v the autocatalyst; a step is one fused Laplacian + reaction pass into the
+// *_next fields followed by a pointer swap.
+typedef struct Reaction_Diffusion {
+    Reaction_Params params;
+    int stride;
+    int preset;
+    bool scalar_kernel;
+    uint64_t step_count;
+    float *u, *v;
+    float *u_next, *v_next;
+} Reaction_Diffusion;
+
+typedef struct Reaction_Preset {
+    const char *name;
+    float feed, kill;
+} Reaction_Preset;
+
+typedef enum Euler_Scenario {
+    EULER_SHOCK_TUBE,
+    EULER_BLAST,
+    EULER_SCENARIO_COUNT
+} Euler_Scenario;
+
+typedef enum Slope_Limiter {
+    LIMITER_MINMOD,
+    LIMITER_VAN_LEER,
+    LIMITER_MC,
+    LIMITER_COUNT
+} Slope_Limiter;
+
+typedef struct Euler_Params {
+    int n;
+    Euler_Scenario scenario;
+    Slope_Limiter limiter;
+    float gamma;
+    float cfl;
+    int steps_per_frame;
+} Euler_Params;
+
+// Compressible 2D Euler gas on the unit square, conserved variables stored SoA and padded like
+// the 2D fluid so fill_cells_rows can sample density. The padding is not used as a halo: each
+// sweep copies a row or column into an Euler_Line and builds the two ghost cells there.
+typedef struct Euler_Gas {
+    Euler_Params params;
+    int stride;
+    uint64_t step_count;
+    double time;
+    float dt;
+    float *rho, *mx, *my, *energy;
+    // Per-row reductions for the CFL step and the display scale
+    float *row_max_speed, *row_max_density;
+    float max_density;
+} Euler_Gas;
+
+// One row or column of an Euler sweep, SoA so every stage is a straight loop over cells.
+// Index 0 and 1 and the last two entries are ghosts. Variables are (rho, normal, tangential,
+// energy or pressure); left and right hold each cell's evolved face states.
+typedef struct Euler_Line {
+    float q[4][EULER_LINE_SIZE];
+    float w[4][EULER_LINE_SIZE];
+    float left[4][EULER_LINE_SIZE];
+    float right[4][EULER_LINE_SIZE];
+    float flux[4][EULER_LINE_SIZE];
+} Euler_Line;
+
+typedef struct Amr_Params {
+    int max_level;
+    // Thresholds on the undivided density jump and on |vorticity| * cell size within a block
+    float refine_density, coarsen_density;
+    float refine_vorticity, coarsen_vorticity;
+    float cfl;
+    // The swirl reverses every period, returning the dye to where it started
+    float period;
+    int steps_per_frame;
+} Amr_Params;
+
+// Level 0 is AMR_ROOTS x AMR_ROOTS blocks over the unit square; a node at level l covers
+// 1 / (AMR_ROOTS * 2^l) and its children split it into quadrants, (0,0) (1,0) (0,1) (1,1).
+typedef struct Amr_Node {
+    int level;
+    int x, y;
+    int parent;
+    int children[4];
+    // Data block of a leaf, -1 for interior nodes; level is -1 while the node is on the free list
+    int block;
+    // Refinement indicators from the last regrid
+    float density_jump, vorticity;
+} Amr_Node;
+
+// Block-structured quadtree carrying a passive density through a prescribed swirl. Every leaf
+// owns an AMR_BLOCK^2 block with an AMR_HALO ring, filled from whichever leaves cover it, so a
+// step is a halo pass and an update pass, each parallel over leaves. Nodes and blocks come from
+// pools with free lists and are referenced by index, so the pools can grow.
+typedef struct Amr_Grid {
+    Amr_Params params;
+    double time;
+    float dt;
+    uint64_t step_count;
+    Amr_Node *nodes;
+    int node_count, node_capacity;
+    int *free_nodes;
+    int free_node_count;
+    float *data, *next;
+    int block_count, block_capacity;
+    int *free_blocks;
+    int free_block_count;
+    int *leaves;
+    int leaf_count;
+    int finest_level;
+    bool show_levels;
+    // Resampled image at the cell grid's resolution, padded for fill_cells_rows
+    float *image;
+    size_t image_bytes;
+} Amr_Grid;
+
+// The main thread only runs GLFW: callbacks push events here and glfwWaitEvents sleeps until
+// the next one. The render thread owns the GL context and drains the queue once per frame, so
+// a slow frame never holds up event handling and a resize never blocks in the middle of one.
+typedef struct Render_Thread {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    Window_Event events[WINDOW_EVENT_QUEUE_SIZE];
+    uint32_t event_count;
+    uint32_t dropped_events;
+    bool close_requested;
+    bool finished;
+    // Set by exit_with_error on the render thread; the main thread terminates GLFW and exits
+    bool failed;
+    // Startup options, read once by the render thread
+    bool stress_resize;
+    Fluid_Scenario scenario;
+    const char *tunnel_log;
+    int smoke_size;
+    bool reaction_enabled;
+    Reaction_Params reaction;
+    bool euler_enabled;
+    Euler_Params euler;
+    bool amr_enabled;
+    Amr_Params amr;
+} Render_Thread;
+
+// exit_with_error may only call glfwTerminate on the main thread
+typedef enum Thread_Role {
+    THREAD_WORKER,
+    THREAD_MAIN,
+    THREAD_RENDER
+} Thread_Role;
+
+typedef enum Fluid_Phase {
+    PHASE_WATER,
+    PHASE_OIL,
+    PHASE_AIR,
+    PHASE_COUNT
+} Fluid_Phase;
+
+enum { PALETTE_SIZE = 256, PALETTE_RAMP_SIZE = 128, PALETTE_PHASE_LEVELS = 32 };
+
+// Palette layout: the density ramp, then each phase at increasing share, then fixed UI colors
+enum {
+    PALETTE_RAMP = 0,
+    PALETTE_PHASES = PALETTE_RAMP + PALETTE_RAMP_SIZE,
+    PALETTE_SOLID = PALETTE_PHASES + PHASE_COUNT * PALETTE_PHASE_LEVELS,
+    PALETTE_TEXT,
+    PALETTE_OUTLINE,
+    PALETTE_USED
+};
+
+typedef enum Palette_Mode {
+    PALETTE_STATIC,
+    PALETTE_CYCLE,
+    PALETTE_HEAT,
+    PALETTE_MODE_COUNT
+} Palette_Mode;
+
+// 256 premultiplied RGBA8 entries (1 KB) in a uniform buffer. Additive glow is folded into
+// each entry's alpha, so alpha 0 with nonzero color is pure glow under the premultiplied blend.
+// Recoloring every cell on screen (cycling, remapping) rewrites only this buffer.
+typedef struct Palette {
+    Palette_Mode mode;
+    uint32_t colors[PALETTE_SIZE];
+    uint32_t ubo;
+} Palette;
+
+typedef struct Fluid_Params {
+    Fluid_Scenario scenario;
+    Fluid_Solver solver;
+    int w, h;
+    float dt;
+    float viscosity;
+    float diffusion;
+    float inflow_speed;
+    float inflow_density;
+    float gravity;
+    int iterations;
+    // Relaxation sweeps fused per pass over the field (temporal blocking); 0 or 1 streams the
+    // whole field once per sweep
+    int temporal_depth;
+} Fluid_Params;
+
+typedef enum Body_Shape {
+    BODY_CIRCLE,
+    BODY_BOX,
+    BODY_POLYGON,
+    BODY_SHAPE_COUNT
+} Body_Shape;
+
+// Positions in fluid cells, velocities in cells per step, spin in radians per step. Boxes and
+// polygons are convex, with vertices counter-clockwise in body space.
+typedef struct Rigid_Body {
+    Body_Shape shape;
+    int vertex_count;
+    vec2 local[MAX_BODY_VERTICES];
+    vec2 world[MAX_BODY_VERTICES];
+    float radius;
+    vec2 pos, vel;
+    float angle, spin;
+    float inv_mass, inv_inertia;
+    vec2 impulse;
+    float angular_impulse;
+    float min_x, min_y, max_x, max_y;
+} Rigid_Body;
+
+typedef struct Body_Contact {
+    vec2 normal; // From a to b
+    vec2 point;
+    float depth;
+} Body_Contact;
+
+// Bodies plus the sweep-and-prune order: indices kept sorted by AABB min x. Bodies move a
+// fraction of a cell per step, so the insertion sort that maintains it is close to linear.
+typedef struct Body_World {
+    Rigid_Body *bodies;
+    int count;
+    int *order;
+    uint64_t pair_tests;
+    uint64_t contacts;
+    uint32_t rng;
+} Body_World;
+
+// One multigrid level of the variable-coefficient pressure operator
+typedef struct Mg_Level {
+    int w, h, stride;
+    float *beta_x, *beta_y;
+    float *x, *b;
+} Mg_Level;
+
+// Stam-style stable fluids on a (w + 2) x (h + 2) grid with a one-cell boundary ring.
+// Inflow is a jet entering from the left edge.
+typedef struct Fluid {
+    Fluid_Params params;
+    int stride;
+    uint64_t step_count;
+    float *u, *v;
+    float *u_prev, *v_prev;
+    float *density, *density_prev;
+    float *scratch;
+    float *pressure;
+
+    // Optional obstacles: solid mask plus the list of solid cells, so boundary handling costs
+    // O(obstacle area) rather than a full-grid scan
+    uint8_t *solid;
+    int *solid_cells;
+    int solid_cell_count;
+    // Velocity imposed in each solid cell (moving bodies); NULL means the obstacles are static
+    float *solid_cell_u, *solid_cell_v;
+
+    // Multiphase: 8-bit volume fraction per phase, summing to 255 in every cell. The
+    // variable-density projection keeps per-face 1/rho coefficients and a PCG workspace.
+    uint8_t *phase[PHASE_COUNT];
+    uint8_t *phase_prev[PHASE_COUNT];
+    float *rho;
+    float *beta_x, *beta_y;
+    float *pcg_r, *pcg_d, *pcg_q, *pcg_z;
+    double *row_sums;
+    Mg_Level mg_levels[MG_MAX_LEVELS];
+    int mg_level_count;
+    int pcg_iterations;
+    float pcg_residual;
+    double phase_volume[PHASE_COUNT];
+} Fluid;
+
+// 3D smoke on a padded (n + 2)^3 grid, x fastest. Pressure and divergence reuse the *_prev
+// fields during projection and advection ping-pongs by pointer swap, so a step allocates
+// nothing and the footprint stays at eight fields.
+typedef struct Smoke_3D {
+    int n;
+    int stride_y, stride_z;
+    int iterations;
+    float dt;
+    float buoyancy;
+    uint64_t step_count;
+
+    float *u, *v, *w;
+    float *u_prev, *v_prev, *w_prev;
+    float *density, *density_prev;
+} Smoke_3D;
+
+typedef enum Smoke_View_Mode {
+    SMOKE_VIEW_SLICE,
+    SMOKE_VIEW_MAX,
+    SMOKE_VIEW_AVERAGE,
+    SMOKE_VIEW_COUNT
+} Smoke_View_Mode;
+
+// 2D image of the smoke density, padded like a 2D fluid field so fill_cells_rows can sample it
+typedef struct Smoke_View {
+    Smoke_View_Mode mode;
+    int axis;
+    int slice;
+    float *image;
+} Smoke_View;
+
+// Wind tunnel analysis. Forces come from a boundary integral over the fluid faces touching the
+// obstacle, kept as flat arrays so the per-step loop is a straight gather + multiply-add.
+typedef struct Wind_Tunnel {
+    bool enabled;
+    float diameter;
+    int face_count;
+    int *face_cells;
+    float *face_nx, *face_ny;
+
+    double time;
+    float drag_coefficient;
+    float lift_coefficient;
+    float lift_mean;
+    float strouhal;
+    double last_crossing_time;
+    double period_sum;
+    int period_count;
+    bool lift_above_mean;
+
+    FILE *log_file;
+    char *log_buffer;
+    size_t log_used;
+} Wind_Tunnel;
+
+typedef enum Perf_Counter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_STALLED_CYCLES,
+    PERF_COUNTER_COUNT
+} Perf_Counter;
+
+typedef struct Perf_Zone {
+    const char *name;
+    uint64_t calls;
+    uint64_t cells;
+    uint64_t wall_ns;
+    uint64_t counts[PERF_COUNTER_COUNT];
+} Perf_Zone;
+
+// Each thread lazily opens its own counter group (perf_event_open with pid = 0 counts only the
+// calling thread); zone totals are shared and accumulated atomically. Zones open on the thread
+// that calls parallel_for are handed to the pool, so workers add their own deltas to them.
+typedef struct Perf_Thread_State {
+    bool opened;
+    bool available;
+    int leader_fd;
+    int group_slots[PERF_COUNTER_COUNT];
+    int group_size;
+    uint32_t open_zones[MAX_PERF_ZONE_DEPTH];
+    int open_zone_count;
+} Perf_Thread_State;
+
+typedef struct Perf_Scope {
+    uint32_t zone;
+    int depth;
+    uint64_t start_ns;
+    uint64_t start[PERF_COUNTER_COUNT];
+} Perf_Scope;
+
+typedef void Parallel_Fn(void *ctx, int begin, int end);
+
+// Persistent workers; parallel_for hands out [begin, end) in grain-sized chunks through an atomic
+// cursor and the calling thread works alongside them.
+typedef struct Thread_Pool {
+    int worker_count;
+    pthread_t workers[MAX_THREADS];
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    uint64_t generation;
+    bool shutdown;
+
+    Parallel_Fn *fn;
+    void *ctx;
+    int next;
+    int end;
+    int grain;
+    int participants;
+    int remaining;
+    // Perf zones open on the calling thread, innermost last
+    uint32_t perf_zones[MAX_PERF_ZONE_DEPTH];
+    int perf_zone_count;
+} Thread_Pool;
+
+typedef enum Tuned_Kernel {
+    TUNE_STENCIL,
+    TUNE_ADVECT,
+    TUNE_RENDER_PREP,
+    TUNED_KERNEL_COUNT
+} Tuned_Kernel;
+
+typedef struct Kernel_Tuning {
+    int threads;
+    int grain;
+    int tile_cols;
+} Kernel_Tuning;
+
+typedef struct Tuning_Entry {
+    char kernel[32];
+    int fluid_w, fluid_h;
+    Kernel_Tuning tuning;
+} Tuning_Entry;
+
+// One axis per line ("viscosity 1e-5 1e-4", "grid 64x48 128x96", "solver gauss-seidel jacobi",
+// "inflow 1 2 4", "steps 500"). Cases are the cartesian product, numbered in a fixed order so a
+// rerun with the same spec can skip the cases that already have metrics.
+typedef struct Sweep_Spec {
+    float viscosities[MAX_SWEEP_VALUES];
+    int viscosity_count;
+    int grid_ws[MAX_SWEEP_VALUES], grid_hs[MAX_SWEEP_VALUES];
+    int grid_count;
+    Fluid_Solver solvers[MAX_SWEEP_VALUES];
+    int solver_count;
+    float inflow_speeds[MAX_SWEEP_VALUES];
+    int inflow_count;
+    int steps;
+} Sweep_Spec;
+
+typedef struct Roofline {
+    double bandwidth_gbs;
+    double peak_gflops;
+} Roofline;
+
+// Per-cell cost model of a kernel, matched to the perf zone with the same name. Traffic is
+// what the loop streams assuming neighbours come from cache.
+typedef struct Hot_Kernel {
+    const char *zone;
+    double bytes_per_cell;
+    double flops_per_cell;
+} Hot_Kernel;
+
+typedef enum Mem_Category {
+    MEM_CPU,
+    MEM_TEXTURE,
+    MEM_BUFFER,
+    MEM_FRAMEBUFFER,
+    MEM_CATEGORY_COUNT
+} Mem_Category;
+
+typedef struct Mem_Owner {
+    const char *name;
+    Mem_Category category;
+    size_t bytes;
+    size_t peak_bytes;
+    uint32_t live_count;
+} Mem_Owner;
+
+typedef struct Gl_Allocation {
+    Mem_Category category;
+    uint32_t id;
+    uint32_t owner_index;
+    size_t bytes;
+} Gl_Allocation;
+
+// Bytes per (owner, category). CPU blocks carry a small header with their size and owner so
+// xfree can credit them back; GL objects are looked up by (category, name).
+typedef struct Mem_Tracker {
+    bool report_enabled;
+    double last_report_time;
+    Mem_Owner owners[MAX_MEM_OWNERS];
+    uint32_t owner_count;
+    Gl_Allocation gl_allocations[MAX_GL_ALLOCATIONS];
+    uint32_t gl_allocation_count;
+} Mem_Tracker;
+
+typedef struct Alloc_Header {
+    size_t bytes;
+    uint32_t owner_index;
+    uint32_t magic;
+} Alloc_Header;
+
 static Gl_State g_gl_state;
 static char gl_error_buffer[ONE_MB];
 static Window_State g_window_state;
+static Bloom_State g_bloom;
+static Canvas_State g_canvas;
+static Cell_Grid g_cell_grid;
+static Profiler g_profiler;
+static Overdraw_Meter g_overdraw;
+static Heatmap_State g_heatmap;
+static Palette g_palette;
+static Split_Views g_views;
+static const char *g_view_names[VIEW_FIELD_COUNT] = {"density", "velocity", "pressure", "vorticity"};
+static Gl_Debug_State g_gl_debug;
+static Latency_Tracker g_latency;
+static Render_Thread g_render;
+static Mouse_State g_mouse;
+static Mem_Tracker g_mem;
+static Fluid g_fluid;
+static Wind_Tunnel g_tunnel;
+static Body_World g_bodies;
+static int g_body_count = DEFAULT_BODY_COUNT;
+static int g_temporal_depth = 0;
+static Smoke_3D g_smoke;
+static Smoke_View g_smoke_view;
+static Reaction_Diffusion g_reaction;
+static Euler_Gas g_euler;
+static Amr_Grid g_amr;
+static const char *g_euler_scenario_names[EULER_SCENARIO_COUNT] = {"shock-tube", "blast"};
+static const char *g_limiter_names[LIMITER_COUNT] = {"minmod", "van-leer", "mc"};
+// Simulated time after which a scenario restarts, once its waves have left or filled the box
+static const float g_euler_end_times[EULER_SCENARIO_COUNT] = {0.25f, 1.0f};
+static const Reaction_Preset g_reaction_presets[] = {
+    {"mitosis", 0.0367f, 0.0649f},
+    {"coral", 0.0545f, 0.062f},
+    {"worms", 0.078f, 0.061f},
+    {"maze", 0.029f, 0.057f},
+    {"solitons", 0.03f, 0.062f},
+};
+enum { REACTION_PRESET_COUNT = sizeof(g_reaction_presets) / sizeof(g_reaction_presets[0]) };
+static const char *g_scenario_names[SCENARIO_COUNT] = {"jet", "wind tunnel", "multiphase", "bodies"};
+static const char *g_phase_names[PHASE_COUNT] = {"water", "oil", "air"};
+// Air is kept heavier than physical so the density ratio (20:1) stays friendly to the solver
+static const float g_phase_density[PHASE_COUNT] = {1.0f, 0.8f, 0.05f};
+static const char *g_smoke_view_names[SMOKE_VIEW_COUNT] = {"slice", "max", "average"};
+static Perf_Zone g_perf_zones[MAX_PERF_ZONES];
+static uint32_t g_perf_zone_count;
+static __thread Perf_Thread_State t_perf;
+static __thread Thread_Role t_role;
+static Thread_Pool g_thread_pool;
+static Kernel_Tuning g_tuning[TUNED_KERNEL_COUNT];
+static const char *g_tuned_kernel_names[TUNED_KERNEL_COUNT] = {"stencil", "advect", "render_prep"};
+static const char *g_solver_names[SOLVER_COUNT] = {"gauss-seidel", "jacobi"};
+static Hot_Kernel g_hot_kernels[MAX_HOT_KERNELS];
+static uint32_t g_hot_kernel_count;
 
 void exit_with_error(const char *msg, ...);
 void trace_log(const char *msg, ...);
-void *xmalloc(size_t bytes);
-void *xcalloc(size_t bytes);
+void *xmalloc(size_t bytes, const char *owner);
+void *xcalloc(size_t bytes, const char *owner);
+void *xrealloc(void *ptr, size_t bytes, const char *owner);
+void xfree(void *ptr);
+
+uint32_t mem_owner_index(const char *owner, Mem_Category category);
+void mem_add(uint32_t owner_index, size_t bytes);
+void mem_sub(uint32_t owner_index, size_t bytes);
+uint32_t gen_tracked_texture(const char *owner);
+uint32_t gen_tracked_buffer(const char *owner);
+uint32_t gen_tracked_framebuffer(const char *owner);
+void set_tracked_gl_size(Mem_Category category, uint32_t id, size_t bytes);
+void delete_tracked_texture(uint32_t *id);
+void delete_tracked_buffer(uint32_t *id);
+void delete_tracked_framebuffer(uint32_t *id);
+void report_memory_usage(const char *title);
+void update_memory_report();
+void report_memory_leaks();
+Gl_Allocation *find_gl_allocation(Mem_Category category, uint32_t id);
+void track_gl_object(Mem_Category category, uint32_t id, const char *owner);
+void untrack_gl_object(Mem_Category category, uint32_t id);
 
 void keyboard_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+void cursor_position_callback(GLFWwindow *window, double x, double y);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void push_window_event(Window_Event event);
+void process_window_events();
+void handle_key_event(int key, int action);
+void handle_resize_event(int width, int height);
+void start_render_thread();
+void *render_thread_main(void *arg);
+void shutdown_render_thread(Texture *painting, Ascii_Atlas *atlas);
+void finish_render_thread();
 void window_size_callback(GLFWwindow *window, int width, int height);
 
 void print_opengl_debug_info();
+void initialize_gl_debug_output();
+void APIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                GLsizei length, const GLchar *message, const void *user);
+const char *gl_debug_source_name(GLenum source);
+const char *gl_debug_type_name(GLenum type);
+const char *gl_debug_severity_name(GLenum severity);
+void report_gl_debug_messages();
 
 uint32_t build_shader_from_src(const char *src, GLenum shader_type);
 uint32_t link_vert_frag_shaders(uint32_t vert, uint32_t frag);
+uint32_t build_program_from_src(const char *vert_src, const char *frag_src);
 uint32_t build_default_shaders();
+uint32_t build_cell_shaders();
 
 Gl_State initialize_gl_state();
+void destroy_gl_state(Gl_State *gl_state);
 void set_ortho_projection(int width, int height);
 
 Texture load_texture(const char *file);
 Texture load_empty_texture();
 
 void draw_texture(Rect dest, Texture texture, Rect src, vec4 color);
+void draw_texture_blended(Rect dest, Texture texture, Rect src, vec4 color, float additive);
 void draw_texture_scaled(vec2 pos, Texture texture, float scale);
 void draw_texture_scaled_tinted(vec2 pos, Texture texture, float scale, vec4 color);
+void draw_background(Texture painting, Texture atlas);
 void draw_quad(Rect quad, vec4 color);
-void draw_ascii_tile(vec2 pos, char glyph, vec4 col, Ascii_Atlas atlas);
 
-int main() {
+Render_Target create_render_target(int width, int height, GLenum internal_format, const char *owner);
+void destroy_render_target(Render_Target *target);
+void attach_depth_texture(Render_Target *target, const char *owner);
+
+void initialize_bloom();
+void resize_bloom_targets(int width, int height);
+void destroy_bloom();
+void begin_bloom_scene();
+void bloom_pass(uint32_t shader, Render_Target *dst, Texture src);
+void apply_bloom();
+
+void initialize_cell_grid(Cell_Grid *grid, uint32_t tile_dim);
+void destroy_cell_grid(Cell_Grid *grid);
+void reflow_cell_grid(Cell_Grid *grid, int width, int height);
+void upload_cell_grid(Cell_Grid *grid);
+void compact_cell_grid(Cell_Grid *grid);
+void initialize_palette();
+void destroy_palette();
+uint32_t pack_palette_color(vec4 color, float additive);
+void update_palette(double time);
+void count_visible_cells_rows(void *ctx, int begin, int end);
+void scatter_visible_cells_rows(void *ctx, int begin, int end);
+void fill_cells_from_fluid(Cell_Grid *grid, Fluid *fluid);
+void fill_cells_from_field(Cell_Grid *grid, Fluid *fluid, float *field, uint32_t view);
+void compute_view_field(Fluid *fluid, View_Field view, float *out);
+void fill_split_views(Cell_Grid *grid, Fluid *fluid);
+void set_cell_grid_views(Cell_Grid *grid, uint32_t view_count);
+void ensure_cell_storage(Cell_Grid *grid);
+void draw_cell_grid(Cell_Grid *grid, Ascii_Atlas atlas);
+void draw_cell_grid_pass(Cell_Grid *grid, Ascii_Atlas atlas, Cell_Pass pass);
+void draw_scene(Texture painting, Ascii_Atlas atlas, bool measure_layers);
+void initialize_heatmap();
+void destroy_heatmap();
+void set_fragment_counting(bool enabled);
+void draw_heatmap(Texture painting, Ascii_Atlas atlas);
+void initialize_overdraw_meter();
+void destroy_overdraw_meter();
+void overdraw_begin(Draw_Layer layer);
+void overdraw_end();
+void report_overdraw();
+void run_resize_stress_test(Cell_Grid *grid);
+
+void ensure_canvas(uint32_t cols, uint32_t rows, uint32_t tile_dim);
+void destroy_canvas();
+void begin_canvas();
+void end_canvas();
+void present_canvas();
+
+void profiler_gpu_begin(const char *name);
+void profiler_gpu_end();
+Fluid_Params default_fluid_params();
+void initialize_fluid(Fluid *fluid, Fluid_Params params);
+void destroy_fluid(Fluid *fluid);
+void fluid_set_boundary(Fluid *fluid, int b, float *x);
+void fluid_set_row_boundary(Fluid *fluid, int b, float *x, int j);
+void fluid_lin_solve(Fluid *fluid, int b, float *x, float *x0, float a, float c);
+void fluid_lin_solve_rows(void *ctx, int begin, int end);
+void fluid_jacobi_rows(void *ctx, int begin, int end);
+void fluid_lin_solve_wavefront(Fluid *fluid, int b, float *x, float *x0, float a, float c);
+void fluid_wavefront_tiles(void *ctx, int begin, int end);
+void run_temporal_bench();
+float fluid_divergence_norm(Fluid *fluid);
+void fluid_advect_rows(void *ctx, int begin, int end);
+void fluid_divergence_rows(void *ctx, int begin, int end);
+void fluid_subtract_gradient_rows(void *ctx, int begin, int end);
+void fill_cells_rows(void *ctx, int begin, int end);
+void fluid_add_inflow(Fluid *fluid);
+void fluid_diffuse(Fluid *fluid, int b, float *x, float *x0, float rate);
+void fluid_advect(Fluid *fluid, int b, float *d, float *d0, float *u, float *v);
+void fluid_project(Fluid *fluid, float *u, float *v, float *p, float *div);
+void step_fluid(Fluid *fluid);
+void fluid_apply_obstacles(Fluid *fluid, int b, float *x);
+void fluid_add_circle_obstacle(Fluid *fluid, float cx, float cy, float radius);
+
+Fluid_Params wind_tunnel_params();
+void initialize_wind_tunnel(Wind_Tunnel *tunnel, Fluid *fluid, const char *log_path);
+void destroy_wind_tunnel(Wind_Tunnel *tunnel);
+void update_wind_tunnel(Wind_Tunnel *tunnel, Fluid *fluid);
+void flush_wind_tunnel_log(Wind_Tunnel *tunnel);
+void write_wind_tunnel_overlay(Wind_Tunnel *tunnel, Fluid *fluid, Cell_Grid *grid);
+void write_cells_text(Cell_Grid *grid, uint32_t x, uint32_t y, const char *text, uint8_t color);
+void start_scenario(Fluid_Scenario scenario);
+
+Fluid_Params multiphase_fluid_params();
+void initialize_multiphase(Fluid *fluid);
+void step_multiphase(Fluid *fluid);
+void multiphase_coefficients_rows(void *ctx, int begin, int end);
+void multiphase_project(Fluid *fluid);
+void multiphase_divergence_rows(void *ctx, int begin, int end);
+void pcg_init_rows(void *ctx, int begin, int end);
+void pcg_apply_rows(void *ctx, int begin, int end);
+void pcg_update_rows(void *ctx, int begin, int end);
+void pcg_dot_rows(void *ctx, int begin, int end);
+void pcg_direction_rows(void *ctx, int begin, int end);
+void mg_build_levels(Fluid *fluid);
+void mg_smooth_rows(void *ctx, int begin, int end);
+void mg_restrict_rows(void *ctx, int begin, int end);
+void mg_prolong_rows(void *ctx, int begin, int end);
+void mg_smooth(Mg_Level *level, int first_color, int sweeps);
+void mg_v_cycle(Mg_Level *levels, int level_count);
+void multiphase_subtract_gradient_rows(void *ctx, int begin, int end);
+void multiphase_advect_phases(Fluid *fluid);
+void multiphase_forward_rows(void *ctx, int begin, int end);
+void multiphase_correct_rows(void *ctx, int begin, int end);
+void multiphase_normalize_rows(void *ctx, int begin, int end);
+void multiphase_conserve_rows(void *ctx, int begin, int end);
+void run_multiphase_bench();
+
+float random_float(uint32_t *state);
+void initialize_body_world(Body_World *world, Fluid *fluid, int count);
+void destroy_body_world(Body_World *world);
+void update_body_geometry(Rigid_Body *body);
+bool body_contains(Rigid_Body *body, float x, float y);
+void body_fluid_forces_rows(void *ctx, int begin, int end);
+bool collide_bodies(Rigid_Body *a, Rigid_Body *b, Body_Contact *contact);
+void resolve_contact(Rigid_Body *a, Rigid_Body *b, Body_Contact *contact);
+void collide_walls(Rigid_Body *body, Fluid *fluid);
+void sweep_and_prune(Body_World *world);
+void rasterize_bodies(Body_World *world, Fluid *fluid);
+void step_bodies(Body_World *world, Fluid *fluid);
+void draw_body_outlines(Body_World *world, Fluid *fluid, Cell_Grid *grid);
+void run_bodies_bench();
+
+void initialize_smoke(Smoke_3D *smoke, int n);
+void destroy_smoke(Smoke_3D *smoke);
+size_t smoke_memory_bytes(int n);
+void smoke_set_boundary(Smoke_3D *smoke, int b, float *x);
+void smoke_lin_solve(Smoke_3D *smoke, int b, float *x, float *x0, float a, float c);
+void smoke_lin_solve_slabs(void *ctx, int begin, int end);
+void smoke_advect(Smoke_3D *smoke, int b, float *d, float *d0, float *u, float *v, float *w);
+void smoke_advect_slabs(void *ctx, int begin, int end);
+void smoke_project(Smoke_3D *smoke);
+void smoke_divergence_slabs(void *ctx, int begin, int end);
+void smoke_subtract_gradient_slabs(void *ctx, int begin, int end);
+void smoke_add_source(Smoke_3D *smoke);
+void step_smoke(Smoke_3D *smoke);
+void update_smoke_view(Smoke_View *view, Smoke_3D *smoke);
+void smoke_view_rows(void *ctx, int begin, int end);
+void fill_cells_from_smoke(Cell_Grid *grid, Smoke_View *view, Smoke_3D *smoke);
+void toggle_smoke(int n);
+void run_smoke_bench();
+
+Reaction_Params default_reaction_params();
+void initialize_reaction(Reaction_Diffusion *rd, Reaction_Params params);
+void destroy_reaction(Reaction_Diffusion *rd);
+void reaction_seed(Reaction_Diffusion *rd, int ci, int cj, int radius, uint32_t *rng);
+void reaction_wrap(Reaction_Diffusion *rd);
+void reaction_rows(void *ctx, int begin, int end);
+void step_reaction(Reaction_Diffusion *rd, int steps);
+void reaction_stir(Reaction_Diffusion *rd, Mouse_State *mouse);
+void fill_cells_from_reaction(Cell_Grid *grid, Reaction_Diffusion *rd);
+void toggle_reaction(Reaction_Params params);
+void disable_split_views();
+void stop_field_engines();
+void run_reaction_bench();
+
+Euler_Params default_euler_params();
+void initialize_euler(Euler_Gas *gas, Euler_Params params);
+void destroy_euler(Euler_Gas *gas);
+void euler_set_initial_state(Euler_Gas *gas);
+void euler_speed_rows(void *ctx, int begin, int end);
+void euler_sweep_lines(void *ctx, int begin, int end);
+void euler_solve_line(Euler_Line *line, int count, float dt_dx, float gamma, Slope_Limiter limiter);
+void step_euler(Euler_Gas *gas);
+double euler_total_mass(Euler_Gas *gas);
+void fill_cells_from_euler(Cell_Grid *grid, Euler_Gas *gas);
+void toggle_euler(Euler_Params params);
+void run_euler_bench();
+
+Amr_Params default_amr_params();
+void initialize_amr(Amr_Grid *amr, Amr_Params params);
+void destroy_amr(Amr_Grid *amr);
+int amr_alloc_node(Amr_Grid *amr, int level, int x, int y, int parent);
+int amr_alloc_block(Amr_Grid *amr);
+float amr_initial_density(float x, float y);
+void amr_swirl(Amr_Grid *amr, float x, float y, float *u, float *v, float *vorticity);
+int amr_find_leaf(Amr_Grid *amr, float x, float y);
+float amr_sample(Amr_Grid *amr, float x, float y);
+void amr_fill_halo_blocks(void *ctx, int begin, int end);
+void amr_step_blocks(void *ctx, int begin, int end);
+void amr_indicator_blocks(void *ctx, int begin, int end);
+void amr_set_initial_blocks(void *ctx, int begin, int end);
+void amr_refine(Amr_Grid *amr, int node);
+void amr_coarsen(Amr_Grid *amr, int node);
+bool amr_can_coarsen(Amr_Grid *amr, int node);
+void amr_balance(Amr_Grid *amr);
+void amr_collect_leaves(Amr_Grid *amr);
+void amr_regrid(Amr_Grid *amr);
+void step_amr(Amr_Grid *amr);
+double amr_total_mass(Amr_Grid *amr);
+void amr_resample_rows(void *ctx, int begin, int end);
+void fill_cells_from_amr(Cell_Grid *grid, Amr_Grid *amr);
+void toggle_amr(Amr_Params params);
+void run_amr_bench();
+
+uint64_t now_ns();
+void perf_open_thread_counters();
+void perf_read_counters(uint64_t counts[PERF_COUNTER_COUNT]);
+Perf_Scope perf_zone_begin(const char *name);
+void perf_zone_end(Perf_Scope *scope, uint64_t cells);
+void perf_add_worker_counts(const uint32_t *zones, int zone_count, const uint64_t start[PERF_COUNTER_COUNT]);
+void report_perf_zones();
+void reset_perf_zones();
+uint64_t perf_zone_wall_ns(const char *name);
+
+int cpu_count();
+void enable_flush_to_zero();
+void initialize_thread_pool(int worker_count);
+void destroy_thread_pool();
+void *thread_pool_worker(void *arg);
+void thread_pool_run_chunks();
+void parallel_for(int begin, int end, Kernel_Tuning tuning, Parallel_Fn *fn, void *ctx);
+
+void default_tuning();
+void tuning_cache_path(char *out, size_t size);
+int load_tuning_entries(Tuning_Entry *entries, int max_entries);
+void load_tuning(Fluid_Params params);
+void save_tuning(Fluid_Params params);
+double time_tuned_kernel(Tuned_Kernel kernel, Fluid *fluid, Cell_Grid *grid);
+void run_autotune();
+
+bool parse_sweep_spec(const char *path, Sweep_Spec *spec);
+int sweep_case_count(Sweep_Spec *spec);
+Fluid_Params sweep_case_params(Sweep_Spec *spec, int case_index);
+void run_batch_case(Sweep_Spec *spec, int case_index, const char *out_dir);
+void write_fluid_snapshot(FILE *file, Fluid *fluid);
+void run_batch(const char *spec_path, const char *out_dir);
+
+Roofline measure_roofline();
+double measure_triad_bandwidth();
+double measure_peak_gflops();
+void register_hot_kernel(const char *zone, double bytes_per_cell, double flops_per_cell);
+void register_fluid_kernels(Fluid_Params params);
+void report_kernel_efficiency(Roofline roofline);
+void run_bench();
+
+void profiler_count(const char *name, uint64_t value);
+void profiler_end_frame();
+
+void initialize_latency_tracker();
+void destroy_latency_tracker();
+void latency_record_input(uint64_t time_ns);
+void latency_begin_frame();
+void latency_end_frame();
+void latency_retire_frame(Latency_Frame *frame, bool wait);
+void latency_calibrate_clock();
+float percentile(float *values, uint32_t count, float p);
+void report_latency();
+void fluid_stir(Fluid *fluid, Mouse_State *mouse);
+
+int main(int argc, char **argv) {
+    t_role = THREAD_MAIN;
+    bool stress_resize = false;
+    bool bench = false;
+    bool tune = false;
+    const char *batch_spec = NULL;
+    const char *batch_out = NULL;
+    Fluid_Scenario scenario = SCENARIO_JET;
+    const char *tunnel_log = NULL;
+    int smoke_size = 0;
+    bool smoke_bench = false;
+    bool multiphase_bench = false;
+    bool bodies_bench = false;
+    bool temporal_bench = false;
+    bool reaction_bench = false;
+    bool reaction_enabled = false;
+    Reaction_Params reaction = default_reaction_params();
+    bool euler_bench = false;
+    bool euler_enabled = false;
+    Euler_Params euler = default_euler_params();
+    bool amr_bench = false;
+    bool amr_enabled = false;
+    Amr_Params amr = default_amr_params();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stress-resize") == 0) stress_resize = true;
+        else if (strcmp(argv[i], "--bench") == 0) bench = true;
+        else if (strcmp(argv[i], "--tune") == 0) tune = true;
+        else if (strcmp(argv[i], "--wind-tunnel") == 0) scenario = SCENARIO_WIND_TUNNEL;
+        else if (strcmp(argv[i], "--multiphase") == 0) scenario = SCENARIO_MULTIPHASE;
+        else if (strcmp(argv[i], "--bodies") == 0 && i + 1 < argc) {
+            scenario = SCENARIO_BODIES;
+            g_body_count = glm_clamp(atoi(argv[++i]), 1, MAX_BODIES);
+        }
+        else if (strcmp(argv[i], "--bench-bodies") == 0) bodies_bench = true;
+        else if (strcmp(argv[i], "--temporal-block") == 0 && i + 1 < argc) {
+            g_temporal_depth = glm_clamp(atoi(argv[++i]), 0, TEMPORAL_MAX_DEPTH);
+        }
+        else if (strcmp(argv[i], "--bench-temporal") == 0) temporal_bench = true;
+        else if (strcmp(argv[i], "--bench-multiphase") == 0) multiphase_bench = true;
+        else if (strcmp(argv[i], "--tunnel-log") == 0 && i + 1 < argc) tunnel_log = argv[++i];
+        else if (strcmp(argv[i], "--smoke-3d") == 0) smoke_size = SMOKE_DEFAULT_SIZE;
+        else if (strcmp(argv[i], "--smoke-size") == 0 && i + 1 < argc) smoke_size = glm_clamp(atoi(argv[++i]), 8, SMOKE_MAX_SIZE);
+        else if (strcmp(argv[i], "--bench-3d") == 0) smoke_bench = true;
+        else if (strcmp(argv[i], "--reaction") == 0) reaction_enabled = true;
+        else if (strcmp(argv[i], "--reaction-size") == 0 && i + 1 < argc) {
+            reaction_enabled = true;
+            reaction.n = glm_clamp(atoi(argv[++i]), 8, REACTION_MAX_SIZE);
+        }
+        else if (strcmp(argv[i], "--feed") == 0 && i + 1 < argc) reaction.feed = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--kill") == 0 && i + 1 < argc) reaction.kill = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "--anisotropy") == 0 && i + 1 < argc) {
+            reaction.anisotropy = glm_clamp((float)atof(argv[++i]), -0.9f, 0.9f);
+        }
+        else if (strcmp(argv[i], "--reaction-steps") == 0 && i + 1 < argc) {
+            reaction.steps_per_frame = glm_max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp(argv[i], "--bench-reaction") == 0) reaction_bench = true;
+        else if (strcmp(argv[i], "--euler") == 0 && i + 1 < argc) {
+            const char *value = argv[++i];
+            int scenario_index = 0;
+            while (scenario_index < EULER_SCENARIO_COUNT && strcmp(value, g_euler_scenario_names[scenario_index]) != 0) scenario_index++;
+            if (scenario_index == EULER_SCENARIO_COUNT) exit_with_error("Unknown Euler scenario '%s'", value);
+            euler.scenario = (Euler_Scenario)scenario_index;
+            euler_enabled = true;
+        }
+        else if (strcmp(argv[i], "--euler-size") == 0 && i + 1 < argc) {
+            euler.n = glm_clamp(atoi(argv[++i]), 8, EULER_MAX_SIZE);
+            euler_enabled = true;
+        }
+        else if (strcmp(argv[i], "--limiter") == 0 && i + 1 < argc) {
+            const char *value = argv[++i];
+            int limiter = 0;
+            while (limiter < LIMITER_COUNT && strcmp(value, g_limiter_names[limiter]) != 0) limiter++;
+            if (limiter == LIMITER_COUNT) exit_with_error("Unknown slope limiter '%s'", value);
+            euler.limiter = (Slope_Limiter)limiter;
+        }
+        else if (strcmp(argv[i], "--bench-euler") == 0) euler_bench = true;
+        else if (strcmp(argv[i], "--amr") == 0) amr_enabled = true;
+        else if (strcmp(argv[i], "--amr-levels") == 0 && i + 1 < argc) {
+            amr.max_level = glm_clamp(atoi(argv[++i]), 1, AMR_MAX_LEVEL + 1) - 1;
+            amr_enabled = true;
+        }
+        else if (strcmp(argv[i], "--bench-amr") == 0) amr_bench = true;
+        else if (strcmp(argv[i], "--latency") == 0) g_latency.enabled = true;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 2 < argc) {
+            batch_spec = argv[++i];
+            batch_out = argv[++i];
+        }
+        else exit_with_error("Unknown argument: %s", argv[i]);
+    }
+
+    enable_flush_to_zero();
+
+    // Before the thread pool exists: worker processes are forked and must not inherit a pool
+    // whose threads didn't survive the fork
+    if (batch_spec) {
+        run_batch(batch_spec, batch_out);
+        return 0;
+    }
+
+    initialize_thread_pool(cpu_count() - 1);
+    load_tuning(default_fluid_params());
+
+    if (tune) {
+        run_autotune();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (bench) {
+        run_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (smoke_bench) {
+        run_smoke_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (multiphase_bench) {
+        run_multiphase_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (bodies_bench) {
+        run_bodies_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (temporal_bench) {
+        run_temporal_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (reaction_bench) {
+        run_reaction_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (euler_bench) {
+        run_euler_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
+    if (amr_bench) {
+        run_amr_bench();
+        destroy_thread_pool();
+        return 0;
+    }
+
     if (!glfwInit()) {
         exit_with_error("Failed to initialize GLFW");
     }
@@ -87,6 +1373,9 @@ int main() {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifndef NDEBUG
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
 
     g_window_state.w = SCREEN_WIDTH;
     g_window_state.h = SCREEN_HEIGHT;
@@ -97,6 +1386,45 @@ int main() {
 
     trace_log("GLFW window created");
 
+    g_render.stress_resize = stress_resize;
+    g_render.scenario = scenario;
+    g_render.tunnel_log = tunnel_log;
+    g_render.smoke_size = smoke_size;
+    g_render.reaction_enabled = reaction_enabled;
+    g_render.reaction = reaction;
+    g_render.euler_enabled = euler_enabled;
+    g_render.euler = euler;
+    g_render.amr_enabled = amr_enabled;
+    g_render.amr = amr;
+    start_render_thread();
+
+    // The main thread only pumps events; it wakes for input and when the render thread is done
+    while (!__atomic_load_n(&g_render.finished, __ATOMIC_ACQUIRE)) {
+        glfwWaitEvents();
+        if (glfwWindowShouldClose(g_window_state.glfw_window)) {
+            __atomic_store_n(&g_render.close_requested, true, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_join(g_render.thread, NULL);
+    pthread_mutex_destroy(&g_render.mutex);
+
+    if (__atomic_load_n(&g_render.failed, __ATOMIC_ACQUIRE)) {
+        glfwTerminate();
+        exit(1);
+    }
+
+    trace_log("GLFW terminating gracefully");
+    glfwTerminate();
+    return 0;
+}
+
+// Owns the GL context for its whole life: setup, the simulate/render loop and teardown.
+// Window events arrive through the queue filled by the callbacks on the main thread.
+void *render_thread_main(void *arg) {
+    (void)arg;
+
+    t_role = THREAD_RENDER;
+    enable_flush_to_zero();
     glfwMakeContextCurrent(g_window_state.glfw_window);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -104,19 +1432,25 @@ int main() {
     }
 
     print_opengl_debug_info();
-
-    glfwSetKeyCallback(g_window_state.glfw_window, keyboard_callback);
-    glfwSetWindowSizeCallback(g_window_state.glfw_window, window_size_callback);
+#ifndef NDEBUG
+    initialize_gl_debug_output();
+#endif
 
     g_gl_state = initialize_gl_state();
 
     glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     glViewport(0, 0, g_window_state.w, g_window_state.h);
     glClearColor(0.09f, 0.07f, 0.07f, 1.0f);
 
     set_ortho_projection(g_window_state.w, g_window_state.h);
 
+    initialize_bloom();
+    initialize_latency_tracker();
+    initialize_overdraw_meter();
+    initialize_heatmap();
+    initialize_palette();
+
     Texture claesz = load_texture("res/claesz.png");
     Ascii_Atlas curses_atlas = {0};
     curses_atlas.tex = load_texture("res/curses.png");
@@ -124,34 +1458,156 @@ int main() {
     curses_atlas.h_count = curses_atlas.tex.w / curses_atlas.tile_dim;
     curses_atlas.v_count = curses_atlas.tex.h / curses_atlas.tile_dim;
 
+    initialize_cell_grid(&g_cell_grid, curses_atlas.tile_dim);
+    reflow_cell_grid(&g_cell_grid, g_window_state.w, g_window_state.h);
+
+    if (g_render.stress_resize) {
+        run_resize_stress_test(&g_cell_grid);
+        shutdown_render_thread(&claesz, &curses_atlas);
+        return NULL;
+    }
+
+    const char *tunnel_log = g_render.tunnel_log;
+    g_tunnel.log_file = tunnel_log ? fopen(tunnel_log, "w") : NULL;
+    if (tunnel_log && g_tunnel.log_file == NULL) exit_with_error("Failed to open tunnel log %s", tunnel_log);
+    start_scenario(g_render.scenario);
+    if (g_render.smoke_size > 0) toggle_smoke(g_render.smoke_size);
+    else if (g_render.reaction_enabled) toggle_reaction(g_render.reaction);
+    else if (g_render.euler_enabled) toggle_euler(g_render.euler);
+    else if (g_render.amr_enabled) toggle_amr(g_render.amr);
+
+    g_canvas.integer_scale = true;
+
     trace_log("Entering main loop");
-    while (!glfwWindowShouldClose(g_window_state.glfw_window)) {
-        glClear(GL_COLOR_BUFFER_BIT);
+    while (!__atomic_load_n(&g_render.close_requested, __ATOMIC_ACQUIRE)) {
+        process_window_events();
+
+        // Everything polled at the end of the previous frame takes effect from here on
+        latency_begin_frame();
+
+        if (g_smoke.u) {
+            step_smoke(&g_smoke);
+            update_smoke_view(&g_smoke_view, &g_smoke);
+        } else if (g_reaction.u) {
+            if (g_mouse.down) reaction_stir(&g_reaction, &g_mouse);
+            step_reaction(&g_reaction, g_reaction.params.steps_per_frame);
+        } else if (g_euler.rho) {
+            if (g_euler.time >= g_euler_end_times[g_euler.params.scenario]) euler_set_initial_state(&g_euler);
+            for (int k = 0; k < g_euler.params.steps_per_frame; k++) step_euler(&g_euler);
+        } else if (g_amr.nodes) {
+            for (int k = 0; k < g_amr.params.steps_per_frame; k++) step_amr(&g_amr);
+        } else {
+            if (g_mouse.down) fluid_stir(&g_fluid, &g_mouse);
+            if (g_bodies.count) step_bodies(&g_bodies, &g_fluid);
+            step_fluid(&g_fluid);
+            if (g_tunnel.enabled) update_wind_tunnel(&g_tunnel, &g_fluid);
+        }
+
+        update_palette(glfwGetTime());
+
+        Perf_Scope prep_scope = perf_zone_begin("render prep");
+        if (g_smoke.u) {
+            char text[64];
+            fill_cells_from_smoke(&g_cell_grid, &g_smoke_view, &g_smoke);
+            if (g_smoke_view.mode == SMOKE_VIEW_SLICE) {
+                snprintf(text, sizeof(text), " %d^3 slice %c=%d ", g_smoke.n, "xyz"[g_smoke_view.axis], g_smoke_view.slice);
+            } else {
+                snprintf(text, sizeof(text), " %d^3 %s along %c ", g_smoke.n, g_smoke_view_names[g_smoke_view.mode], "xyz"[g_smoke_view.axis]);
+            }
+            write_cells_text(&g_cell_grid, 0, 0, text, PALETTE_TEXT);
+        } else if (g_reaction.u) {
+            char text[64];
+            fill_cells_from_reaction(&g_cell_grid, &g_reaction);
+            snprintf(text, sizeof(text), " gray-scott %d^2 f=%.4f k=%.4f ", g_reaction.params.n,
+                     g_reaction.params.feed, g_reaction.params.kill);
+            write_cells_text(&g_cell_grid, 0, 0, text, PALETTE_TEXT);
+        } else if (g_euler.rho) {
+            char text[64];
+            fill_cells_from_euler(&g_cell_grid, &g_euler);
+            snprintf(text, sizeof(text), " euler %s %d^2 %s t=%.3f ", g_euler_scenario_names[g_euler.params.scenario],
+                     g_euler.params.n, g_limiter_names[g_euler.params.limiter], g_euler.time);
+            write_cells_text(&g_cell_grid, 0, 0, text, PALETTE_TEXT);
+        } else if (g_amr.nodes) {
+            char text[80];
+            fill_cells_from_amr(&g_cell_grid, &g_amr);
+            int uniform = AMR_ROOTS * AMR_BLOCK << g_amr.params.max_level;
+            snprintf(text, sizeof(text), " amr %d leaves, %.1f%% of %d^2 %s t=%.2f ", g_amr.leaf_count,
+                     100.0 * g_amr.leaf_count * AMR_BLOCK * AMR_BLOCK / ((double)uniform * uniform), uniform,
+                     g_amr.show_levels ? "levels" : "density", g_amr.time);
+            write_cells_text(&g_cell_grid, 0, 0, text, PALETTE_TEXT);
+        } else if (g_views.enabled) {
+            fill_split_views(&g_cell_grid, &g_fluid);
+        } else {
+            fill_cells_from_fluid(&g_cell_grid, &g_fluid);
+            if (g_tunnel.enabled) write_wind_tunnel_overlay(&g_tunnel, &g_fluid, &g_cell_grid);
+            if (g_bodies.count) draw_body_outlines(&g_bodies, &g_fluid, &g_cell_grid);
+        }
+        perf_zone_end(&prep_scope, g_cell_grid.cols * g_cell_grid.rows);
+
+        begin_bloom_scene();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float bg_scale = 0.7f;
-        vec2 bg_pos = {
-            g_window_state.w * 0.5f - claesz.w * bg_scale * 0.5f,
-            g_window_state.h * 0.5f - claesz.h * bg_scale * 0.5f
-        };
-        draw_texture_scaled_tinted(bg_pos, claesz, bg_scale, (vec4){0.22f, 0.2f, 0.2f, 0.5f});
+        profiler_gpu_begin("scene");
+        if (g_canvas.enabled) {
+            ensure_canvas(g_cell_grid.cols, g_cell_grid.rows, g_cell_grid.tile_dim);
+            begin_canvas();
+            draw_cell_grid(&g_cell_grid, curses_atlas);
+            end_canvas();
 
-        draw_texture_scaled((vec2){100.0f, 100.0f}, curses_atlas.tex, 1.0f);
+            overdraw_begin(LAYER_BACKGROUND);
+            draw_background(claesz, curses_atlas.tex);
+            overdraw_end();
+            overdraw_begin(LAYER_GLYPHS);
+            present_canvas();
+            overdraw_end();
+        } else {
+            upload_cell_grid(&g_cell_grid);
+            draw_scene(claesz, curses_atlas, true);
+        }
+        profiler_gpu_end();
 
-        for (int y = 0; y < 50; y++)
-            for (int x = 0; x < 50; x++)
-                draw_ascii_tile((vec2){(float)x * curses_atlas.tile_dim, (float)y * curses_atlas.tile_dim},
-                                (char)((x + y * curses_atlas.h_count) % 128),
-                                (vec4){1.0f, 0.0f, 1.0f, 1.0f},
-                                curses_atlas);
+        apply_bloom();
+        if (g_heatmap.enabled) draw_heatmap(claesz, curses_atlas);
 
         glfwSwapBuffers(g_window_state.glfw_window);
-        glfwPollEvents();
+        latency_end_frame();
+        profiler_end_frame();
+        update_memory_report();
     }
 
-    trace_log("GLFW terminating gracefully");
+    trace_log("Render thread shutting down");
+    shutdown_render_thread(&claesz, &curses_atlas);
+    return NULL;
+}
 
-    glfwTerminate();
-    return 0;
+// Teardown shared by every way out of the render thread, so each one ends in the leak report
+void shutdown_render_thread(Texture *painting, Ascii_Atlas *atlas) {
+    report_memory_usage("Memory usage at exit:");
+    destroy_latency_tracker();
+    destroy_overdraw_meter();
+    destroy_heatmap();
+    destroy_palette();
+    if (g_smoke.u) toggle_smoke(0);
+    destroy_reaction(&g_reaction);
+    destroy_euler(&g_euler);
+    destroy_amr(&g_amr);
+    destroy_wind_tunnel(&g_tunnel);
+    destroy_body_world(&g_bodies);
+    if (g_tunnel.log_file) fclose(g_tunnel.log_file);
+    destroy_fluid(&g_fluid);
+    destroy_cell_grid(&g_cell_grid);
+    xfree(g_views.field);
+    destroy_canvas();
+    destroy_bloom();
+    delete_tracked_texture(&painting->id);
+    delete_tracked_texture(&atlas->tex.id);
+    destroy_gl_state(&g_gl_state);
+    report_memory_leaks();
+
+    report_gl_debug_messages();
+    destroy_thread_pool();
+
+    finish_render_thread();
 }
 
 void exit_with_error(const char *msg, ...) {
@@ -162,7 +1618,14 @@ void exit_with_error(const char *msg, ...) {
     va_end(ap);
     fprintf(stderr, "\n");
 
-    glfwTerminate();
+    // GLFW must be terminated on the main thread: the render thread hands over and stops, and
+    // pool workers exit without touching GLFW
+    if (t_role == THREAD_RENDER) {
+        __atomic_store_n(&g_render.failed, true, __ATOMIC_RELEASE);
+        finish_render_thread();
+        pthread_exit(NULL);
+    }
+    if (t_role == THREAD_MAIN) glfwTerminate();
     exit(1);
 }
 
@@ -175,127 +1638,692 @@ void trace_log(const char *msg, ...) {
     printf("\n");
 }
 
-void *xmalloc(size_t bytes) {
-    void *d = malloc(bytes);
-    if (d == NULL) exit_with_error("Failed to malloc");
-    return d;
+enum { ALLOC_MAGIC = 0xA110C8ED };
+
+void *xmalloc(size_t bytes, const char *owner) {
+    Alloc_Header *h = malloc(ALLOC_HEADER_SIZE + bytes);
+    if (h == NULL) exit_with_error("Failed to malloc");
+    h->bytes = bytes;
+    h->owner_index = mem_owner_index(owner, MEM_CPU);
+    h->magic = ALLOC_MAGIC;
+    mem_add(h->owner_index, bytes);
+    return (uint8_t *)h + ALLOC_HEADER_SIZE;
 }
-void *xcalloc(size_t bytes) {
-    void *d = calloc(1, bytes);
-    if (d == NULL) exit_with_error("Failed to calloc");
-    return d;
+void *xcalloc(size_t bytes, const char *owner) {
+    Alloc_Header *h = calloc(1, ALLOC_HEADER_SIZE + bytes);
+    if (h == NULL) exit_with_error("Failed to calloc");
+    h->bytes = bytes;
+    h->owner_index = mem_owner_index(owner, MEM_CPU);
+    h->magic = ALLOC_MAGIC;
+    mem_add(h->owner_index, bytes);
+    return (uint8_t *)h + ALLOC_HEADER_SIZE;
 }
+void *xrealloc(void *ptr, size_t bytes, const char *owner) {
+    if (ptr == NULL) return xmalloc(bytes, owner);
 
-void keyboard_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
-    (void)window; (void)key; (void)scancode; (void)action; (void)mods;
+    Alloc_Header *h = (Alloc_Header *)((uint8_t *)ptr - ALLOC_HEADER_SIZE);
+    assert(h->magic == ALLOC_MAGIC);
+    mem_sub(h->owner_index, h->bytes);
 
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-        trace_log("Received ESC. Terminating...");
-        glfwSetWindowShouldClose(window, true);
-    }
+    h = realloc(h, ALLOC_HEADER_SIZE + bytes);
+    if (h == NULL) exit_with_error("Failed to realloc");
+    h->bytes = bytes;
+    h->owner_index = mem_owner_index(owner, MEM_CPU);
+    mem_add(h->owner_index, bytes);
+    return (uint8_t *)h + ALLOC_HEADER_SIZE;
 }
+void xfree(void *ptr) {
+    if (ptr == NULL) return;
 
-void window_size_callback(GLFWwindow *window, int width, int height) {
-    (void)window;
-
-    g_window_state.w = width;
-    g_window_state.h = height;
-    glViewport(0, 0, width, height);
-    set_ortho_projection(width, height);
+    Alloc_Header *h = (Alloc_Header *)((uint8_t *)ptr - ALLOC_HEADER_SIZE);
+    assert(h->magic == ALLOC_MAGIC);
+    h->magic = 0;
+    mem_sub(h->owner_index, h->bytes);
+    free(h);
 }
 
-void print_opengl_debug_info() {
-    trace_log("Loaded OpenGL function pointers. Debug info:");
-    trace_log("  Version:  %s", glGetString(GL_VERSION));
-    trace_log("  GLSL:     %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
-    trace_log("  Vendor:   %s", glGetString(GL_VENDOR));
-    trace_log("  Renderer: %s", glGetString(GL_RENDERER));
+uint32_t mem_owner_index(const char *owner, Mem_Category category) {
+    for (uint32_t i = 0; i < g_mem.owner_count; i++) {
+        if (g_mem.owners[i].category == category && strcmp(g_mem.owners[i].name, owner) == 0) return i;
+    }
+
+    if (g_mem.owner_count == MAX_MEM_OWNERS) exit_with_error("Too many memory owners");
+    g_mem.owners[g_mem.owner_count] = (Mem_Owner){.name = owner, .category = category};
+    return g_mem.owner_count++;
 }
 
-uint32_t build_shader_from_src(const char *src, GLenum shader_type) {
-    uint32_t id = glCreateShader(shader_type);
-    glShaderSource(id, 1, &src, NULL);
-    glCompileShader(id);
+void mem_add(uint32_t owner_index, size_t bytes) {
+    Mem_Owner *owner = &g_mem.owners[owner_index];
+    owner->bytes += bytes;
+    owner->live_count++;
+    if (owner->bytes > owner->peak_bytes) owner->peak_bytes = owner->bytes;
+}
 
-    int success;
-    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+void mem_sub(uint32_t owner_index, size_t bytes) {
+    Mem_Owner *owner = &g_mem.owners[owner_index];
+    assert(owner->bytes >= bytes && owner->live_count > 0);
+    owner->bytes -= bytes;
+    owner->live_count--;
+}
 
-    if (!success) {
-        glGetShaderInfoLog(id, ONE_MB, NULL, gl_error_buffer);
-        exit_with_error("Failed to compile shader (type 0x%04X). Error:\n  %s\nSource:\n%s\n", shader_type, gl_error_buffer, src);
+Gl_Allocation *find_gl_allocation(Mem_Category category, uint32_t id) {
+    for (uint32_t i = 0; i < g_mem.gl_allocation_count; i++) {
+        Gl_Allocation *a = &g_mem.gl_allocations[i];
+        if (a->category == category && a->id == id) return a;
     }
+    return NULL;
+}
 
-    return id;
+void track_gl_object(Mem_Category category, uint32_t id, const char *owner) {
+    if (g_mem.gl_allocation_count == MAX_GL_ALLOCATIONS) exit_with_error("Too many tracked GL objects");
+    uint32_t owner_index = mem_owner_index(owner, category);
+    g_mem.gl_allocations[g_mem.gl_allocation_count++] = (Gl_Allocation){category, id, owner_index, 0};
+    mem_add(owner_index, 0);
 }
 
-uint32_t link_vert_frag_shaders(uint32_t vert, uint32_t frag) {
-    uint32_t id = glCreateProgram();
-    glAttachShader(id, vert);
-    glAttachShader(id, frag);
-    glLinkProgram(id);
+void untrack_gl_object(Mem_Category category, uint32_t id) {
+    Gl_Allocation *a = find_gl_allocation(category, id);
+    assert(a != NULL);
+    mem_sub(a->owner_index, a->bytes);
+    *a = g_mem.gl_allocations[--g_mem.gl_allocation_count];
+}
 
-    int success;
-    glGetProgramiv(id, GL_LINK_STATUS, &success);
+uint32_t gen_tracked_texture(const char *owner) {
+    uint32_t id;
+    glGenTextures(1, &id);
+    track_gl_object(MEM_TEXTURE, id, owner);
+    return id;
+}
 
-    if (!success) {
-        glGetProgramInfoLog(id, ONE_MB, NULL, gl_error_buffer);
-        exit_with_error("Failed to compile program. Error:\n  %s", gl_error_buffer);
-    }
+uint32_t gen_tracked_buffer(const char *owner) {
+    uint32_t id;
+    glGenBuffers(1, &id);
+    track_gl_object(MEM_BUFFER, id, owner);
+    return id;
+}
 
+uint32_t gen_tracked_framebuffer(const char *owner) {
+    uint32_t id;
+    glGenFramebuffers(1, &id);
+    track_gl_object(MEM_FRAMEBUFFER, id, owner);
     return id;
 }
 
-uint32_t build_default_shaders() {
-    static const char *vert_shader_source =
-        "#version 430 core\n"
-        "layout (location = 0) in vec2 aPos;\n"
-        "layout (location = 1) in vec2 aTexCoord;\n"
-        "layout (location = 2) in vec4 aColor;\n"
-        "uniform mat4 projection;\n"
-        "out vec2 TexCoord;\n"
-        "out vec4 Color;\n"
-        "void main() {\n"
-        "    gl_Position = projection * vec4(aPos, 0.0, 1.0);\n"
-        "    TexCoord = aTexCoord;\n"
-        "    Color = aColor;\n"
-        "}";
-    uint32_t vert_shader = build_shader_from_src(vert_shader_source, GL_VERTEX_SHADER);
+// Called after each (re)specification of the object's storage
+void set_tracked_gl_size(Mem_Category category, uint32_t id, size_t bytes) {
+    Gl_Allocation *a = find_gl_allocation(category, id);
+    assert(a != NULL);
 
-    static const char *frag_shader_source =
-        "#version 430 core\n"
-        "out vec4 FragColor;\n"
-        "in vec2 TexCoord;\n"
-        "in vec4 Color;\n"
-        "uniform sampler2D texture1;\n"
-        "void main() {\n"
-        "    FragColor = Color * texture(texture1, TexCoord);\n"
-        "}";
-    uint32_t frag_shader = build_shader_from_src(frag_shader_source, GL_FRAGMENT_SHADER);
+    Mem_Owner *owner = &g_mem.owners[a->owner_index];
+    owner->bytes = owner->bytes - a->bytes + bytes;
+    if (owner->bytes > owner->peak_bytes) owner->peak_bytes = owner->bytes;
+    a->bytes = bytes;
+}
 
-    uint32_t shader_program = link_vert_frag_shaders(vert_shader, frag_shader);
+void delete_tracked_texture(uint32_t *id) {
+    untrack_gl_object(MEM_TEXTURE, *id);
+    glDeleteTextures(1, id);
+    *id = 0;
+}
 
-    glDeleteShader(vert_shader);
-    glDeleteShader(frag_shader);
+void delete_tracked_buffer(uint32_t *id) {
+    untrack_gl_object(MEM_BUFFER, *id);
+    glDeleteBuffers(1, id);
+    *id = 0;
+}
 
-    return shader_program;
+void delete_tracked_framebuffer(uint32_t *id) {
+    untrack_gl_object(MEM_FRAMEBUFFER, *id);
+    glDeleteFramebuffers(1, id);
+    *id = 0;
 }
 
-Gl_State initialize_gl_state() {
-    Gl_State gl_state = {0};
+void report_memory_usage(const char *title) {
+    static const char *category_names[MEM_CATEGORY_COUNT] = {"cpu", "texture", "buffer", "framebuffer"};
 
-    glGenVertexArrays(1, &gl_state.vao);
-    glGenBuffers(1, &gl_state.vbo);
-    glGenBuffers(1, &gl_state.ebo);
+    size_t category_totals[MEM_CATEGORY_COUNT] = {0};
+    for (uint32_t i = 0; i < g_mem.owner_count; i++) {
+        category_totals[g_mem.owners[i].category] += g_mem.owners[i].bytes;
+    }
 
-    glBindVertexArray(gl_state.vao);
+    trace_log("%s", title);
+    for (int c = 0; c < MEM_CATEGORY_COUNT; c++) {
+        trace_log("  %-12s %10.1f KB", category_names[c], category_totals[c] / 1024.0);
+        for (uint32_t i = 0; i < g_mem.owner_count; i++) {
+            Mem_Owner *owner = &g_mem.owners[i];
+            if (owner->category != (Mem_Category)c || (owner->live_count == 0 && owner->peak_bytes == 0)) continue;
+            trace_log("    %-22s %10.1f KB  peak %10.1f KB  (%u live)",
+                      owner->name, owner->bytes / 1024.0, owner->peak_bytes / 1024.0, owner->live_count);
+        }
+    }
+}
+
+void update_memory_report() {
+    if (!g_mem.report_enabled) return;
+
+    double now = glfwGetTime();
+    if (now - g_mem.last_report_time < 1.0) return;
+    g_mem.last_report_time = now;
+
+    report_memory_usage("Memory usage:");
+}
+
+void report_memory_leaks() {
+    uint32_t leak_count = 0;
+    for (uint32_t i = 0; i < g_mem.owner_count; i++) {
+        Mem_Owner *owner = &g_mem.owners[i];
+        if (owner->live_count == 0) continue;
+        if (leak_count++ == 0) trace_log("Leak report: allocations still live at exit");
+        trace_log("  %-22s %10.1f KB  (%u live)", owner->name, owner->bytes / 1024.0, owner->live_count);
+    }
+    if (leak_count == 0) trace_log("Leak report: no live allocations at exit");
+}
+
+void keyboard_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    (void)window; (void)scancode; (void)mods;
+    push_window_event((Window_Event){.type = WINDOW_EVENT_KEY, .key = key, .action = action});
+}
+
+void window_size_callback(GLFWwindow *window, int width, int height) {
+    (void)window;
+    push_window_event((Window_Event){.type = WINDOW_EVENT_RESIZE, .w = width, .h = height});
+}
+
+void cursor_position_callback(GLFWwindow *window, double x, double y) {
+    (void)window;
+    push_window_event((Window_Event){.type = WINDOW_EVENT_CURSOR, .x = x, .y = y});
+}
+
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
+    (void)window; (void)mods;
+    push_window_event((Window_Event){.type = WINDOW_EVENT_MOUSE_BUTTON, .key = button, .action = action});
+}
+
+void push_window_event(Window_Event event) {
+    event.time_ns = now_ns();
+
+    pthread_mutex_lock(&g_render.mutex);
+    if (g_render.event_count < WINDOW_EVENT_QUEUE_SIZE) g_render.events[g_render.event_count++] = event;
+    else g_render.dropped_events++;
+    pthread_mutex_unlock(&g_render.mutex);
+}
+
+// Runs on the render thread at the start of each frame. Only the last resize of a frame is
+// applied, since each one reallocates the grid and bloom targets.
+void process_window_events() {
+    static Window_Event events[WINDOW_EVENT_QUEUE_SIZE];
+
+    pthread_mutex_lock(&g_render.mutex);
+    uint32_t count = g_render.event_count;
+    memcpy(events, g_render.events, count * sizeof(Window_Event));
+    g_render.event_count = 0;
+    pthread_mutex_unlock(&g_render.mutex);
+
+    int resize_w = -1, resize_h = -1;
+    for (uint32_t i = 0; i < count; i++) {
+        Window_Event *event = &events[i];
+        switch (event->type) {
+        case WINDOW_EVENT_KEY:
+            latency_record_input(event->time_ns);
+            handle_key_event(event->key, event->action);
+            break;
+        case WINDOW_EVENT_RESIZE:
+            resize_w = event->w;
+            resize_h = event->h;
+            break;
+        case WINDOW_EVENT_CURSOR:
+            // Motion only changes the picture while dragging
+            if (g_mouse.down) {
+                latency_record_input(event->time_ns);
+                g_mouse.dx += event->x - g_mouse.x;
+                g_mouse.dy += event->y - g_mouse.y;
+            }
+            g_mouse.x = event->x;
+            g_mouse.y = event->y;
+            break;
+        case WINDOW_EVENT_MOUSE_BUTTON:
+            if (event->key != GLFW_MOUSE_BUTTON_LEFT) break;
+            latency_record_input(event->time_ns);
+            g_mouse.down = event->action == GLFW_PRESS;
+            g_mouse.dx = g_mouse.dy = 0.0;
+            break;
+        }
+    }
+    if (resize_w >= 0) handle_resize_event(resize_w, resize_h);
+}
+
+void handle_key_event(int key, int action) {
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+        trace_log("Received ESC. Terminating...");
+        glfwSetWindowShouldClose(g_window_state.glfw_window, true);
+        __atomic_store_n(&g_render.close_requested, true, __ATOMIC_RELEASE);
+    }
+
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        g_bloom.enabled = !g_bloom.enabled;
+        trace_log("Bloom %s", g_bloom.enabled ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_W && action == GLFW_PRESS) {
+        g_temporal_depth = g_temporal_depth > 1 ? 0 : TEMPORAL_DEFAULT_DEPTH;
+        g_fluid.params.temporal_depth = g_temporal_depth;
+        register_fluid_kernels(g_fluid.params);
+        if (g_temporal_depth) trace_log("Temporal blocking: %d sweeps per pass", g_temporal_depth);
+        else trace_log("Temporal blocking disabled");
+    }
+
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        g_canvas.enabled = !g_canvas.enabled;
+        trace_log("Fixed-resolution canvas %s", g_canvas.enabled ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        g_canvas.integer_scale = !g_canvas.integer_scale;
+        trace_log("Canvas integer scaling %s", g_canvas.integer_scale ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        start_scenario((g_fluid.params.scenario + 1) % SCENARIO_COUNT);
+    }
+
+    if (key == GLFW_KEY_3 && action == GLFW_PRESS) {
+        bool was_enabled = g_smoke.u != NULL;
+        stop_field_engines();
+        if (!was_enabled) toggle_smoke(SMOKE_DEFAULT_SIZE);
+    }
+
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        bool was_enabled = g_reaction.u != NULL;
+        stop_field_engines();
+        if (!was_enabled) toggle_reaction(g_render.reaction);
+    }
+
+    // Off, then each Euler scenario in turn
+    if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+        Euler_Params params = g_euler.rho ? g_euler.params : g_render.euler;
+        int next = g_euler.rho ? (int)params.scenario + 1 : 0;
+        stop_field_engines();
+        if (next < EULER_SCENARIO_COUNT) {
+            params.scenario = (Euler_Scenario)next;
+            toggle_euler(params);
+        }
+    }
+
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+        bool was_enabled = g_amr.nodes != NULL;
+        stop_field_engines();
+        if (!was_enabled) toggle_amr(g_render.amr);
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS && g_amr.nodes) {
+        g_amr.show_levels = !g_amr.show_levels;
+        trace_log("AMR view: %s", g_amr.show_levels ? "refinement levels" : "density");
+    }
+
+    if (key == GLFW_KEY_U && action == GLFW_PRESS && g_euler.rho) {
+        g_euler.params.limiter = (g_euler.params.limiter + 1) % LIMITER_COUNT;
+        trace_log("Slope limiter %s", g_limiter_names[g_euler.params.limiter]);
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS && g_reaction.u) {
+        g_reaction.preset = (g_reaction.preset + 1) % REACTION_PRESET_COUNT;
+        const Reaction_Preset *preset = &g_reaction_presets[g_reaction.preset];
+        g_reaction.params.feed = preset->feed;
+        g_reaction.params.kill = preset->kill;
+        trace_log("Reaction preset %s (feed %.4f, kill %.4f)", preset->name, preset->feed, preset->kill);
+    }
+
+    if (key == GLFW_KEY_A && action == GLFW_PRESS && g_reaction.u) {
+        float anisotropy = g_reaction.params.anisotropy;
+        g_reaction.params.anisotropy = anisotropy == 0.0f ? 0.5f : anisotropy > 0.0f ? -0.5f : 0.0f;
+        trace_log("Reaction anisotropy %.2f", g_reaction.params.anisotropy);
+    }
+
+    if (key == GLFW_KEY_V && action == GLFW_PRESS && g_smoke.density) {
+        g_smoke_view.mode = (g_smoke_view.mode + 1) % SMOKE_VIEW_COUNT;
+    }
+
+    if (key == GLFW_KEY_X && action == GLFW_PRESS && g_smoke.density) {
+        g_smoke_view.axis = (g_smoke_view.axis + 1) % 3;
+    }
+
+    if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action != GLFW_RELEASE && g_smoke.density) {
+        g_smoke_view.slice += key == GLFW_KEY_RIGHT_BRACKET ? 1 : -1;
+        g_smoke_view.slice = glm_clamp(g_smoke_view.slice, 1, g_smoke.n);
+    }
+
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        g_mem.report_enabled = !g_mem.report_enabled;
+        g_mem.last_report_time = 0.0;
+        trace_log("Live memory report %s", g_mem.report_enabled ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        g_profiler.report_enabled = !g_profiler.report_enabled;
+        trace_log("Profiler report %s", g_profiler.report_enabled ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        g_heatmap.enabled = !g_heatmap.enabled;
+        trace_log("Overdraw heatmap %s (black 0, blue 1, green 4, red 8, white more)", g_heatmap.enabled ? "enabled" : "disabled");
+    }
+
+    // Split views read the 2D fluid fields, so they stay off for the other engines
+    if (key == GLFW_KEY_G && action == GLFW_PRESS && !g_smoke.u && !g_reaction.u && !g_euler.rho && !g_amr.nodes) {
+        g_views.enabled = !g_views.enabled;
+        set_cell_grid_views(&g_cell_grid, g_views.enabled ? VIEW_FIELD_COUNT : 1);
+        trace_log("Split views %s", g_views.enabled ? "enabled (density, velocity, pressure, vorticity)" : "disabled");
+    }
+
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        static const char *mode_names[PALETTE_MODE_COUNT] = {"static", "cycling", "heat"};
+        g_palette.mode = (g_palette.mode + 1) % PALETTE_MODE_COUNT;
+        trace_log("Palette: %s", mode_names[g_palette.mode]);
+    }
+
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+        g_overdraw.depth_layering = !g_overdraw.depth_layering;
+        trace_log("Depth layering %s", g_overdraw.depth_layering ? "enabled" : "disabled");
+    }
+
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        g_latency.enabled = !g_latency.enabled;
+        g_latency.last_report_time = glfwGetTime();
+        trace_log("Input latency measurement %s", g_latency.enabled ? "enabled" : "disabled");
+    }
+}
+
+void handle_resize_event(int width, int height) {
+    g_window_state.w = width;
+    g_window_state.h = height;
+    glViewport(0, 0, width, height);
+    set_ortho_projection(width, height);
+    resize_bloom_targets(width, height);
+    reflow_cell_grid(&g_cell_grid, width, height);
+}
+
+void start_render_thread() {
+    pthread_mutex_init(&g_render.mutex, NULL);
+
+    glfwSetKeyCallback(g_window_state.glfw_window, keyboard_callback);
+    glfwSetWindowSizeCallback(g_window_state.glfw_window, window_size_callback);
+    glfwSetCursorPosCallback(g_window_state.glfw_window, cursor_position_callback);
+    glfwSetMouseButtonCallback(g_window_state.glfw_window, mouse_button_callback);
+
+    if (pthread_create(&g_render.thread, NULL, render_thread_main, NULL) != 0) {
+        exit_with_error("Failed to create render thread");
+    }
+}
+
+// Releases the context before signalling, so the main thread can tear the window down
+void finish_render_thread() {
+    glfwMakeContextCurrent(NULL);
+    if (g_render.dropped_events) trace_log("Window event queue overflowed: %u events dropped", g_render.dropped_events);
+    __atomic_store_n(&g_render.finished, true, __ATOMIC_RELEASE);
+    glfwPostEmptyEvent();
+}
+
+void print_opengl_debug_info() {
+    trace_log("Loaded OpenGL function pointers. Debug info:");
+    trace_log("  Version:  %s", glGetString(GL_VERSION));
+    trace_log("  GLSL:     %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
+    trace_log("  Vendor:   %s", glGetString(GL_VENDOR));
+    trace_log("  Renderer: %s", glGetString(GL_RENDERER));
+}
+
+void initialize_gl_debug_output() {
+    int flags = 0;
+    glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+    if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT)) {
+        trace_log("GL debug context not available; debug output disabled");
+        return;
+    }
+
+    // Synchronous so the callback runs on the offending call's thread and stack
+    glEnable(GL_DEBUG_OUTPUT);
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(gl_debug_callback, NULL);
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+
+    trace_log("GL debug output enabled");
+}
+
+void APIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                GLsizei length, const GLchar *message, const void *user) {
+    (void)length; (void)user;
+
+    if (type == GL_DEBUG_TYPE_PERFORMANCE) g_gl_debug.frame_perf_warnings++;
+
+    for (uint32_t i = 0; i < g_gl_debug.message_count; i++) {
+        Gl_Debug_Message *seen = &g_gl_debug.messages[i];
+        if (seen->id == id && seen->source == source && seen->type == type) {
+            seen->count++;
+            return;
+        }
+    }
+
+    if (g_gl_debug.message_count == MAX_GL_DEBUG_MESSAGES) {
+        g_gl_debug.dropped_count++;
+        return;
+    }
+
+    Gl_Debug_Message *entry = &g_gl_debug.messages[g_gl_debug.message_count++];
+    entry->id = id;
+    entry->source = source;
+    entry->type = type;
+    entry->severity = severity;
+    entry->count = 1;
+
+    // Notifications are mostly driver chatter (buffer placement etc.); keep them for the summary
+    if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) return;
+
+    trace_log("GL debug [%s/%s/%s] id %u: %s",
+              gl_debug_source_name(source), gl_debug_type_name(type), gl_debug_severity_name(severity), id, message);
+}
+
+const char *gl_debug_source_name(GLenum source) {
+    switch (source) {
+        case GL_DEBUG_SOURCE_API:             return "api";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader";
+        case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+        case GL_DEBUG_SOURCE_APPLICATION:     return "app";
+        default:                              return "other";
+    }
+}
+
+const char *gl_debug_type_name(GLenum type) {
+    switch (type) {
+        case GL_DEBUG_TYPE_ERROR:               return "error";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined";
+        case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+        case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+        case GL_DEBUG_TYPE_MARKER:              return "marker";
+        default:                                return "other";
+    }
+}
+
+const char *gl_debug_severity_name(GLenum severity) {
+    switch (severity) {
+        case GL_DEBUG_SEVERITY_HIGH:   return "high";
+        case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+        case GL_DEBUG_SEVERITY_LOW:    return "low";
+        default:                       return "note";
+    }
+}
+
+void report_gl_debug_messages() {
+    if (g_gl_debug.message_count == 0) return;
+
+    trace_log("GL debug summary: %u unique messages (%u dropped)", g_gl_debug.message_count, g_gl_debug.dropped_count);
+    for (uint32_t i = 0; i < g_gl_debug.message_count; i++) {
+        Gl_Debug_Message *m = &g_gl_debug.messages[i];
+        trace_log("  [%s/%s/%s] id %u x%u",
+                  gl_debug_source_name(m->source), gl_debug_type_name(m->type), gl_debug_severity_name(m->severity),
+                  m->id, m->count);
+    }
+}
+
+uint32_t build_shader_from_src(const char *src, GLenum shader_type) {
+    uint32_t id = glCreateShader(shader_type);
+    glShaderSource(id, 1, &src, NULL);
+    glCompileShader(id);
+
+    int success;
+    glGetShaderiv(id, GL_COMPILE_STATUS, &success);
+
+    if (!success) {
+        glGetShaderInfoLog(id, ONE_MB, NULL, gl_error_buffer);
+        exit_with_error("Failed to compile shader (type 0x%04X). Error:\n  %s\nSource:\n%s\n", shader_type, gl_error_buffer, src);
+    }
+
+    return id;
+}
+
+uint32_t link_vert_frag_shaders(uint32_t vert, uint32_t frag) {
+    uint32_t id = glCreateProgram();
+    glAttachShader(id, vert);
+    glAttachShader(id, frag);
+    glLinkProgram(id);
+
+    int success;
+    glGetProgramiv(id, GL_LINK_STATUS, &success);
+
+    if (!success) {
+        glGetProgramInfoLog(id, ONE_MB, NULL, gl_error_buffer);
+        exit_with_error("Failed to compile program. Error:\n  %s", gl_error_buffer);
+    }
+
+    return id;
+}
+
+uint32_t build_program_from_src(const char *vert_src, const char *frag_src) {
+    uint32_t vert_shader = build_shader_from_src(vert_src, GL_VERTEX_SHADER);
+    uint32_t frag_shader = build_shader_from_src(frag_src, GL_FRAGMENT_SHADER);
+
+    uint32_t shader_program = link_vert_frag_shaders(vert_shader, frag_shader);
+
+    glDeleteShader(vert_shader);
+    glDeleteShader(frag_shader);
+
+    return shader_program;
+}
+
+// Textures are premultiplied at load and the vertex stage premultiplies the tint, so the
+// product is premultiplied and everything draws under glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA)
+uint32_t build_default_shaders() {
+    static const char *vert_shader_source =
+        "#version 430 core\n"
+        "layout (location = 0) in vec2 aPos;\n"
+        "layout (location = 1) in vec2 aTexCoord;\n"
+        "layout (location = 2) in vec4 aColor;\n"
+        "layout (location = 3) in float aAdditive;\n"
+        "uniform mat4 projection;\n"
+        "out vec2 TexCoord;\n"
+        "out vec4 Color;\n"
+        "void main() {\n"
+        "    gl_Position = projection * vec4(aPos, 0.0, 1.0);\n"
+        "    TexCoord = aTexCoord;\n"
+        "    Color = vec4(aColor.rgb * aColor.a, aColor.a * (1.0 - aAdditive));\n"
+        "}";
+
+    static const char *frag_shader_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "in vec4 Color;\n"
+        "uniform sampler2D texture1;\n"
+        "uniform bool count_fragments;\n"
+        "void main() {\n"
+        "    if (count_fragments) {\n"
+        "        FragColor = vec4(1.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    FragColor = Color * texture(texture1, TexCoord);\n"
+        "}";
+
+    return build_program_from_src(vert_shader_source, frag_shader_source);
+}
+
+uint32_t build_cell_shaders() {
+    // Triangle strip quad from gl_VertexID; cell and glyph coords from instance data, color
+    // from the palette (four packed entries per uvec4 to keep std140 at 1 KB)
+    static const char *vert_shader_source =
+        "#version 430 core\n"
+        "layout (location = 0) in uint aGlyph;\n"
+        "layout (location = 1) in uint aColor;\n"
+        "layout (location = 2) in uint aIndex;\n"
+        "layout (std140, binding = 0) uniform Palette {\n"
+        "    uvec4 palette[64];\n"
+        "};\n"
+        "uniform mat4 projection;\n"
+        "uniform int cell_pass;\n"
+        "uniform uint opaque_glyph;\n"
+        "uniform float depth;\n"
+        "uniform int cols;\n"
+        "uniform int rows;\n"
+        "uniform vec2 view_origin[4];\n"
+        "uniform float view_scale;\n"
+        "uniform int atlas_h_count;\n"
+        "uniform float tile_dim;\n"
+        "uniform vec2 atlas_size;\n"
+        "out vec2 TexCoord;\n"
+        "out vec4 Color;\n"
+        "void main() {\n"
+        "    vec4 color = unpackUnorm4x8(palette[aColor >> 2][aColor & 3u]);\n"
+        "    bool opaque = aGlyph == opaque_glyph && color.a == 1.0;\n"
+        "    if ((cell_pass == 1 && !opaque) || (cell_pass == 2 && opaque)) {\n"
+        "        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n" // Outside the clip volume: culled
+        "        return;\n"
+        "    }\n"
+        "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+        "    int row = int(aIndex / uint(cols));\n"
+        "    int view = row / rows;\n"
+        "    vec2 cell = vec2(aIndex % uint(cols), row - view * rows);\n"
+        "    vec2 glyph = vec2(int(aGlyph) % atlas_h_count, int(aGlyph) / atlas_h_count);\n"
+        "    vec2 pos = view_origin[view] + (cell + corner) * tile_dim * view_scale;\n"
+        "    gl_Position = projection * vec4(pos, depth, 1.0);\n"
+        "    TexCoord = (glyph + corner) * tile_dim / atlas_size;\n"
+        "    Color = color;\n"
+        "}";
+
+    static const char *frag_shader_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "in vec4 Color;\n"
+        "uniform sampler2D texture1;\n"
+        "uniform bool count_fragments;\n"
+        "void main() {\n"
+        "    if (count_fragments) {\n"
+        "        FragColor = vec4(1.0);\n"
+        "        return;\n"
+        "    }\n"
+        "    FragColor = Color * texture(texture1, TexCoord);\n"
+        "}";
+
+    return build_program_from_src(vert_shader_source, frag_shader_source);
+}
+
+Gl_State initialize_gl_state() {
+    Gl_State gl_state = {0};
+
+    glGenVertexArrays(1, &gl_state.vao);
+    gl_state.vbo = gen_tracked_buffer("immediate quads");
+    gl_state.ebo = gen_tracked_buffer("immediate quads");
+
+    glBindVertexArray(gl_state.vao);
 
     glBindBuffer(GL_ARRAY_BUFFER, gl_state.vbo);
 
-    size_t total_size = MAX_VERT * (2 + 2 + 4) * sizeof(float);
+    size_t total_size = MAX_VERT * (2 + 2 + 4 + 1) * sizeof(float);
     glBufferData(GL_ARRAY_BUFFER, total_size, NULL, GL_DYNAMIC_DRAW);
+    set_tracked_gl_size(MEM_BUFFER, gl_state.vbo, total_size);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl_state.ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, MAX_IDX * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+    set_tracked_gl_size(MEM_BUFFER, gl_state.ebo, MAX_IDX * sizeof(uint32_t));
 
     // Positions -- vec2
     size_t stride = 2 * sizeof(float);
@@ -315,6 +2343,12 @@ Gl_State initialize_gl_state() {
     glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void *)offset);
     glEnableVertexAttribArray(2);
 
+    // Additive -- float
+    offset += stride * MAX_VERT;
+    stride = sizeof(float);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, (void *)offset);
+    glEnableVertexAttribArray(3);
+
     offset += stride * MAX_VERT;
     assert(offset == total_size);
 
@@ -323,25 +2357,38 @@ Gl_State initialize_gl_state() {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     gl_state.shader = build_default_shaders();
+    gl_state.cell_shader = build_cell_shaders();
 
     gl_state.empty_texture = load_empty_texture();
 
     return gl_state;
 }
 
+void destroy_gl_state(Gl_State *gl_state) {
+    delete_tracked_buffer(&gl_state->vbo);
+    delete_tracked_buffer(&gl_state->ebo);
+    delete_tracked_texture(&gl_state->empty_texture.id);
+    glDeleteVertexArrays(1, &gl_state->vao);
+    glDeleteProgram(gl_state->shader);
+    glDeleteProgram(gl_state->cell_shader);
+    *gl_state = (Gl_State){0};
+}
+
 void set_ortho_projection(int width, int height) {
     mat4 projection;
     glm_ortho(0.0f, width, height, 0.0f, -1.0f, 1.0f, projection);
 
     glUseProgram(g_gl_state.shader);
     glUniformMatrix4fv(glGetUniformLocation(g_gl_state.shader, "projection"), 1, GL_FALSE, (float *)projection);
+    glUseProgram(g_gl_state.cell_shader);
+    glUniformMatrix4fv(glGetUniformLocation(g_gl_state.cell_shader, "projection"), 1, GL_FALSE, (float *)projection);
     glUseProgram(0);
 }
 
 Texture load_texture(const char *file) {
     Texture texture = {0};
 
-    glGenTextures(1, &texture.id);
+    texture.id = gen_tracked_texture(file);
     glBindTexture(GL_TEXTURE_2D, texture.id);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -356,8 +2403,16 @@ Texture load_texture(const char *file) {
         exit_with_error("Failed to load image at %s", file);
     }
 
+    // Premultiply before upload so filtering and mipmaps never bleed color out of transparent texels
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        uint8_t *p = image_data + i * 4;
+        for (int c = 0; c < 3; c++) p[c] = (uint8_t)((p[c] * p[3] + 127) / 255);
+    }
+
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    // Full mip chain adds about a third on top of the base level
+    set_tracked_gl_size(MEM_TEXTURE, texture.id, (size_t)width * height * 4 * 4 / 3);
 
     glBindTexture(GL_TEXTURE_2D, 0);
     stbi_image_free(image_data);
@@ -372,7 +2427,7 @@ Texture load_empty_texture() {
     Texture texture = {0};
     texture.w = texture.h = 1;
 
-    glGenTextures(1, &texture.id);
+    texture.id = gen_tracked_texture("empty texture");
     glBindTexture(GL_TEXTURE_2D, texture.id);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -382,6 +2437,7 @@ Texture load_empty_texture() {
 
     uint32_t white = -1;
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, &white);
+    set_tracked_gl_size(MEM_TEXTURE, texture.id, sizeof(white));
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -389,9 +2445,13 @@ Texture load_empty_texture() {
 }
 
 void draw_texture(Rect dest, Texture texture, Rect src, vec4 color) {
+    draw_texture_blended(dest, texture, src, color, 0.0f);
+}
+
+void draw_texture_blended(Rect dest, Texture texture, Rect src, vec4 color, float additive) {
     glBindBuffer(GL_ARRAY_BUFFER, g_gl_state.vbo);
 
-    size_t total_size = MAX_VERT * (2 + 2 + 4) * sizeof(float);
+    size_t total_size = MAX_VERT * (2 + 2 + 4 + 1) * sizeof(float);
     size_t vert_to_sub_count = 4;
     size_t idx_to_sub_count = 6;
     assert(vert_to_sub_count < MAX_VERT);
@@ -431,6 +2491,13 @@ void draw_texture(Rect dest, Texture texture, Rect src, vec4 color) {
     assert(sizeof(colors) == stride * vert_to_sub_count);
     glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(colors), colors);
 
+    // Additive -- float
+    offset += stride * MAX_VERT;
+    stride = sizeof(float);
+    float additives[] = {additive, additive, additive, additive};
+    assert(sizeof(additives) == stride * vert_to_sub_count);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, sizeof(additives), additives);
+
     offset += stride * MAX_VERT;
     assert(offset == total_size);
 
@@ -476,22 +2543,5391 @@ void draw_texture_scaled_tinted(vec2 pos, Texture texture, float scale, vec4 col
                  color);
 }
 
+// Dimmed painting behind the grid plus the glyph atlas itself; both are translucent
+void draw_background(Texture painting, Texture atlas) {
+    float scale = 0.7f;
+    vec2 pos = {
+        g_window_state.w * 0.5f - painting.w * scale * 0.5f,
+        g_window_state.h * 0.5f - painting.h * scale * 0.5f
+    };
+    draw_texture_scaled_tinted(pos, painting, scale, (vec4){0.22f, 0.2f, 0.2f, 0.5f});
+    draw_texture_scaled((vec2){100.0f, 100.0f}, atlas, 1.0f);
+}
+
 void draw_quad(Rect quad, vec4 color) {
     draw_texture(quad, g_gl_state.empty_texture, (Rect){0}, color);
 }
 
-void draw_ascii_tile(vec2 pos, char glyph, vec4 col, Ascii_Atlas atlas) {
-    /* uint32_t h_count = atlas.tex.w / atlas.tile_dim; */
+void initialize_cell_grid(Cell_Grid *grid, uint32_t tile_dim) {
+    *grid = (Cell_Grid){0};
+    grid->tile_dim = tile_dim;
+    grid->view_count = 1;
+
+    glGenVertexArrays(1, &grid->vao);
+    grid->instance_vbo = gen_tracked_buffer("cell grid");
+
+    glBindVertexArray(grid->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, grid->instance_vbo);
+
+    // Glyph -- uint8
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_BYTE, sizeof(Cell_Instance), (void *)offsetof(Cell_Instance, glyph));
+    glVertexAttribDivisor(0, 1);
+    glEnableVertexAttribArray(0);
+
+    // Palette index -- uint8
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_BYTE, sizeof(Cell_Instance), (void *)offsetof(Cell_Instance, color));
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+
+    // Cell index -- uint
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(Cell_Instance), (void *)offsetof(Cell_Instance, index));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(2);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+// Headless grids (bench, tuner) never created GL objects and have no context to delete them in
+void destroy_cell_grid(Cell_Grid *grid) {
+    xfree(grid->cells);
+    xfree(grid->instances);
+    xfree(grid->row_offsets);
+    if (grid->vao) {
+        delete_tracked_buffer(&grid->instance_vbo);
+        glDeleteVertexArrays(1, &grid->vao);
+    }
+    *grid = (Cell_Grid){0};
+}
+
+void reflow_cell_grid(Cell_Grid *grid, int width, int height) {
+    // Whole cells only, and never an empty grid while minimized
+    uint32_t cols = width > 0 ? (uint32_t)width / grid->tile_dim : 0;
+    uint32_t rows = height > 0 ? (uint32_t)height / grid->tile_dim : 0;
+    if (cols == 0) cols = 1;
+    if (rows == 0) rows = 1;
+
+    if (cols == grid->cols && rows == grid->rows) return;
 
-    uint32_t x = (unsigned)glyph % atlas.h_count;
-    uint32_t y = (unsigned)glyph / atlas.h_count;
+    grid->cols = cols;
+    grid->rows = rows;
+    grid->reflow_count++;
+    ensure_cell_storage(grid);
+}
 
-    float x_min = (float)(x * atlas.tile_dim);
-    float y_min = (float)(y * atlas.tile_dim);
-    float t_d = (float)atlas.tile_dim;
+void set_cell_grid_views(Cell_Grid *grid, uint32_t view_count) {
+    grid->view_count = view_count;
+    ensure_cell_storage(grid);
+}
 
-    draw_texture((Rect){pos[0], pos[1], t_d, t_d},
-                 atlas.tex,
-                 (Rect){x_min, y_min, t_d, t_d},
-                 col);
+void ensure_cell_storage(Cell_Grid *grid) {
+    uint32_t needed = grid->cols * grid->rows * grid->view_count;
+    if (needed > grid->capacity) {
+        uint32_t capacity = grid->capacity ? grid->capacity : 64;
+        while (capacity < needed) capacity *= 2;
+
+        grid->cells = xrealloc(grid->cells, capacity * sizeof(Cell), "cell grid");
+        grid->instances = xrealloc(grid->instances, capacity * sizeof(Cell_Instance), "cell grid");
+        grid->row_offsets = xrealloc(grid->row_offsets, (capacity + 1) * sizeof(uint32_t), "cell grid");
+        grid->capacity = capacity;
+        grid->cpu_alloc_count++;
+    }
+
+    memset(grid->cells, 0, needed * sizeof(Cell));
+}
+
+void upload_cell_grid(Cell_Grid *grid) {
+    compact_cell_grid(grid);
+
+    glBindBuffer(GL_ARRAY_BUFFER, grid->instance_vbo);
+
+    // GPU storage follows the CPU capacity. Respecifying the same size every upload orphans the
+    // old storage, so the driver hands out a fresh block instead of waiting on in-flight draws.
+    if (grid->gpu_capacity < grid->capacity) {
+        grid->gpu_capacity = grid->capacity;
+        grid->gpu_alloc_count++;
+        set_tracked_gl_size(MEM_BUFFER, grid->instance_vbo, grid->gpu_capacity * sizeof(Cell_Instance));
+    }
+    glBufferData(GL_ARRAY_BUFFER, grid->gpu_capacity * sizeof(Cell_Instance), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, grid->instance_count * sizeof(Cell_Instance), grid->instances);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Blank glyphs and fully transparent palette entries produce no instance
+static inline bool cell_visible(const Cell *cell) {
+    return cell->glyph != 0 && cell->glyph != ' ' && g_palette.colors[cell->color] != 0;
+}
+
+void count_visible_cells_rows(void *ctx, int begin, int end) {
+    Cell_Grid *grid = ctx;
+    for (int y = begin; y < end; y++) {
+        Cell *row = grid->cells + (size_t)y * grid->cols;
+        uint32_t count = 0;
+        for (uint32_t x = 0; x < grid->cols; x++) count += cell_visible(&row[x]);
+        grid->row_offsets[y] = count;
+    }
+}
+
+void scatter_visible_cells_rows(void *ctx, int begin, int end) {
+    Cell_Grid *grid = ctx;
+    for (int y = begin; y < end; y++) {
+        uint32_t base = (uint32_t)y * grid->cols;
+        Cell_Instance *out = grid->instances + grid->row_offsets[y];
+        for (uint32_t x = 0; x < grid->cols; x++) {
+            Cell *cell = &grid->cells[base + x];
+            if (!cell_visible(cell)) continue;
+            *out++ = (Cell_Instance){base + x, cell->glyph, cell->color, 0};
+        }
+    }
+}
+
+// Two-pass blocked prefix sum with rows as blocks: parallel counts, a serial exclusive scan over
+// the row totals (a few hundred at most), then a parallel scatter to the scanned offsets
+void compact_cell_grid(Cell_Grid *grid) {
+    Perf_Scope scope = perf_zone_begin("cell compaction");
+    uint32_t rows = grid->rows * grid->view_count;
+    parallel_for(0, (int)rows, g_tuning[TUNE_RENDER_PREP], count_visible_cells_rows, grid);
+
+    uint32_t total = 0;
+    for (uint32_t y = 0; y < rows; y++) {
+        uint32_t count = grid->row_offsets[y];
+        grid->row_offsets[y] = total;
+        total += count;
+    }
+    grid->row_offsets[rows] = total;
+    grid->instance_count = total;
+
+    parallel_for(0, (int)rows, g_tuning[TUNE_RENDER_PREP], scatter_visible_cells_rows, grid);
+    perf_zone_end(&scope, grid->cols * rows);
+    profiler_count("visible cells", total);
+}
+
+typedef struct Fill_Cells_Job {
+    Cell_Grid *grid;
+    float *density;
+    uint8_t *solid;
+    int w, h, stride;
+    uint8_t **phase;
+    uint32_t view;
+    float gain;
+} Fill_Cells_Job;
+
+void fill_cells_from_fluid(Cell_Grid *grid, Fluid *fluid) {
+    Fill_Cells_Job job = {grid, fluid->density, fluid->solid, fluid->params.w, fluid->params.h, fluid->stride,
+                          fluid->phase[0] ? fluid->phase : NULL, 0, 1.0f};
+    parallel_for(0, (int)grid->rows, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+// Any normalized [0, 1] field with the fluid's layout, into one view of the grid
+void fill_cells_from_field(Cell_Grid *grid, Fluid *fluid, float *field, uint32_t view) {
+    Fill_Cells_Job job = {grid, field, fluid->solid, fluid->params.w, fluid->params.h, fluid->stride, NULL, view, 1.0f};
+    parallel_for(0, (int)grid->rows, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+void disable_split_views() {
+    if (!g_views.enabled) return;
+    g_views.enabled = false;
+    set_cell_grid_views(&g_cell_grid, 1);
+}
+
+// The smoke, reaction-diffusion, Euler and AMR engines replace the 2D fluid view and each other
+void stop_field_engines() {
+    disable_split_views();
+    if (g_smoke.u) toggle_smoke(0);
+    if (g_reaction.u) toggle_reaction(g_render.reaction);
+    if (g_euler.rho) toggle_euler(g_render.euler);
+    if (g_amr.nodes) toggle_amr(g_render.amr);
+}
+
+void fill_cells_from_smoke(Cell_Grid *grid, Smoke_View *view, Smoke_3D *smoke) {
+    Fill_Cells_Job job = {grid, view->image, NULL, smoke->n, smoke->n, smoke->n + 2, NULL, 0, 1.0f};
+    parallel_for(0, (int)grid->rows, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+// Each field is scaled by its peak magnitude this frame so every view uses the whole ramp; speed
+// maps 0 to 1, while signed pressure and vorticity center on 0.5
+void compute_view_field(Fluid *fluid, View_Field view, float *out) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    size_t cells = (size_t)s * (h + 2);
+
+    if (view == VIEW_DENSITY) {
+        memcpy(out, fluid->density, cells * sizeof(float));
+        return;
+    }
+
+    memset(out, 0, cells * sizeof(float));
+    float peak = 1e-6f;
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float value = 0.0f;
+            if (view == VIEW_VELOCITY) {
+                value = sqrtf(fluid->u[idx] * fluid->u[idx] + fluid->v[idx] * fluid->v[idx]);
+            } else if (view == VIEW_PRESSURE) {
+                value = fluid->pressure[idx];
+            } else {
+                value = 0.5f * (fluid->v[idx + 1] - fluid->v[idx - 1] - fluid->u[idx + s] + fluid->u[idx - s]);
+            }
+            out[idx] = value;
+            peak = glm_max(peak, fabsf(value));
+        }
+    }
+    float scale = view == VIEW_VELOCITY ? 1.0f / peak : 0.5f / peak;
+    float bias = view == VIEW_VELOCITY ? 0.0f : 0.5f;
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) out[i + j * s] = bias + scale * out[i + j * s];
+    }
+}
+
+void fill_split_views(Cell_Grid *grid, Fluid *fluid) {
+    size_t bytes = (size_t)fluid->stride * (fluid->params.h + 2) * sizeof(float);
+    if (g_views.field_bytes < bytes) {
+        g_views.field = xrealloc(g_views.field, bytes, "split views");
+        g_views.field_bytes = bytes;
+    }
+
+    for (uint32_t view = 0; view < VIEW_FIELD_COUNT; view++) {
+        if (view == VIEW_DENSITY) fill_cells_from_fluid(grid, fluid);
+        else {
+            compute_view_field(fluid, (View_Field)view, g_views.field);
+            fill_cells_from_field(grid, fluid, g_views.field, view);
+        }
+        char label[32];
+        snprintf(label, sizeof(label), " %s ", g_view_names[view]);
+        write_cells_text(grid, 0, view * grid->rows, label, PALETTE_TEXT);
+    }
+}
+
+void fill_cells_rows(void *ctx, int begin, int end) {
+    static const char ramp[] = " .:-=+*#%@";
+    enum { RAMP_LAST = sizeof(ramp) - 2 };
+    static const char phase_glyphs[PHASE_COUNT] = {'~', 'o', ' '};
+
+    Fill_Cells_Job *job = ctx;
+    Cell_Grid *grid = job->grid;
+    int fw = job->w;
+    int fh = job->h;
+
+    for (uint32_t y = (uint32_t)begin; y < (uint32_t)end; y++) {
+        int fy = 1 + (int)(y * fh / grid->rows);
+        for (uint32_t x = 0; x < grid->cols; x++) {
+            int fx = 1 + (int)(x * fw / grid->cols);
+            float d = glm_clamp(job->density[fx + fy * job->stride] * job->gain, 0.0f, 1.0f);
+
+            Cell *cell = &grid->cells[x + (y + job->view * grid->rows) * grid->cols];
+            if (job->solid && job->solid[fx + fy * job->stride]) {
+                cell->glyph = GLYPH_FULL_BLOCK;
+                cell->color = PALETTE_SOLID;
+                continue;
+            }
+            if (job->phase) {
+                // Dominant phase picks the glyph, its share of the cell the opacity
+                int dominant = 0;
+                for (int k = 1; k < PHASE_COUNT; k++) {
+                    if (job->phase[k][fx + fy * job->stride] > job->phase[dominant][fx + fy * job->stride]) dominant = k;
+                }
+                float share = job->phase[dominant][fx + fy * job->stride] / 255.0f;
+                cell->glyph = (uint8_t)phase_glyphs[dominant];
+                cell->color = (uint8_t)(PALETTE_PHASES + dominant * PALETTE_PHASE_LEVELS + (int)(share * (PALETTE_PHASE_LEVELS - 1) + 0.5f));
+                continue;
+            }
+            cell->glyph = (uint8_t)ramp[(int)(d * RAMP_LAST + 0.5f)];
+            cell->color = (uint8_t)(PALETTE_RAMP + (int)(d * (PALETTE_RAMP_SIZE - 1) + 0.5f));
+        }
+    }
+}
+
+void draw_cell_grid(Cell_Grid *grid, Ascii_Atlas atlas) {
+    upload_cell_grid(grid);
+    draw_cell_grid_pass(grid, atlas, CELL_PASS_ALL);
+}
+
+// Expects the grid already uploaded. Cells sit in front of everything drawn by the
+// immediate-mode path (z 0.5 vs 0), which only matters when depth testing is on.
+void draw_cell_grid_pass(Cell_Grid *grid, Ascii_Atlas atlas, Cell_Pass pass) {
+    uint32_t shader = g_gl_state.cell_shader;
+    glUseProgram(shader);
+    glUniform1i(glGetUniformLocation(shader, "cell_pass"), (int)pass);
+    glUniform1ui(glGetUniformLocation(shader, "opaque_glyph"), GLYPH_FULL_BLOCK);
+    glUniform1f(glGetUniformLocation(shader, "depth"), 0.5f);
+    glUniform1i(glGetUniformLocation(shader, "cols"), (int)grid->cols);
+    glUniform1i(glGetUniformLocation(shader, "rows"), (int)grid->rows);
+
+    // One view fills the grid; more are tiled 2x2 at half scale over the same area
+    float origins[MAX_VIEWS * 2] = {0};
+    float half_w = grid->cols * grid->tile_dim * 0.5f, half_h = grid->rows * grid->tile_dim * 0.5f;
+    for (uint32_t view = 1; view < grid->view_count; view++) {
+        origins[view * 2 + 0] = (view % 2) * half_w;
+        origins[view * 2 + 1] = (view / 2) * half_h;
+    }
+    glUniform2fv(glGetUniformLocation(shader, "view_origin"), MAX_VIEWS, origins);
+    glUniform1f(glGetUniformLocation(shader, "view_scale"), grid->view_count > 1 ? 0.5f : 1.0f);
+    glUniform1i(glGetUniformLocation(shader, "atlas_h_count"), (int)atlas.h_count);
+    glUniform1f(glGetUniformLocation(shader, "tile_dim"), (float)grid->tile_dim);
+    glUniform2f(glGetUniformLocation(shader, "atlas_size"), atlas.tex.w, atlas.tex.h);
+
+    glBindVertexArray(grid->vao);
+    glBindTexture(GL_TEXTURE_2D, atlas.tex.id);
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, grid->instance_count);
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void run_resize_stress_test(Cell_Grid *grid) {
+    trace_log("Resize stress test: %d resizes", STRESS_RESIZE_COUNT);
+
+    uint32_t start_reflows = grid->reflow_count;
+    uint32_t start_cpu_allocs = grid->cpu_alloc_count;
+    uint32_t start_gpu_allocs = grid->gpu_alloc_count;
+    double start_time = glfwGetTime();
+
+    // Sweep sizes back and forth like an interactive drag, with some jitter
+    for (int i = 0; i < STRESS_RESIZE_COUNT; i++) {
+        int phase = i % 200 < 100 ? i % 100 : 100 - i % 100;
+        int width = 200 + phase * 24 + (i * 7) % 13;
+        int height = 150 + phase * 18 + (i * 11) % 17;
+
+        reflow_cell_grid(grid, width, height);
+        upload_cell_grid(grid);
+    }
+    glFinish();
+
+    double elapsed_ms = (glfwGetTime() - start_time) * 1000.0;
+    trace_log("  Reflows:           %u", grid->reflow_count - start_reflows);
+    trace_log("  CPU allocations:   %u (capacity %u cells, %zu bytes)",
+              grid->cpu_alloc_count - start_cpu_allocs, grid->capacity, grid->capacity * sizeof(Cell));
+    trace_log("  GPU allocations:   %u (orphaned uploads: %d)",
+              grid->gpu_alloc_count - start_gpu_allocs, STRESS_RESIZE_COUNT);
+    trace_log("  Total time:        %.2f ms", elapsed_ms);
+}
+
+Render_Target create_render_target(int width, int height, GLenum internal_format, const char *owner) {
+    Render_Target target = {0};
+    target.tex.w = (float)width;
+    target.tex.h = (float)height;
+
+    target.tex.id = gen_tracked_texture(owner);
+    glBindTexture(GL_TEXTURE_2D, target.tex.id);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+    size_t texel_bytes = internal_format == GL_RGBA16F ? 8 : internal_format == GL_RGBA32F ? 16 : 4;
+    set_tracked_gl_size(MEM_TEXTURE, target.tex.id, (size_t)width * height * texel_bytes);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    target.fbo = gen_tracked_framebuffer(owner);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.tex.id, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        exit_with_error("Incomplete framebuffer (%dx%d, format 0x%04X)", width, height, internal_format);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return target;
+}
+
+void attach_depth_texture(Render_Target *target, const char *owner) {
+    target->depth = gen_tracked_texture(owner);
+    glBindTexture(GL_TEXTURE_2D, target->depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, (int)target->tex.w, (int)target->tex.h);
+    set_tracked_gl_size(MEM_TEXTURE, target->depth, (size_t)target->tex.w * target->tex.h * 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target->depth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        exit_with_error("Incomplete framebuffer with depth (%.0fx%.0f)", target->tex.w, target->tex.h);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void destroy_render_target(Render_Target *target) {
+    if (target->fbo) delete_tracked_framebuffer(&target->fbo);
+    if (target->depth) delete_tracked_texture(&target->depth);
+    if (target->tex.id) delete_tracked_texture(&target->tex.id);
+    *target = (Render_Target){0};
+}
+
+// Fullscreen triangle generated from gl_VertexID, so no vertex buffer is needed.
+static const char *fullscreen_vert_source =
+    "#version 430 core\n"
+    "out vec2 TexCoord;\n"
+    "void main() {\n"
+    "    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "    TexCoord = p;\n"
+    "    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}";
+
+void initialize_bloom() {
+    static const char *bright_frag_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "uniform sampler2D src;\n"
+        "uniform float threshold;\n"
+        "void main() {\n"
+        "    vec3 c = texture(src, TexCoord).rgb;\n"
+        "    float l = max(c.r, max(c.g, c.b));\n"
+        "    float w = max(l - threshold, 0.0) / max(l, 1e-4);\n"
+        "    FragColor = vec4(c * w, 1.0);\n"
+        "}";
+
+    static const char *down_frag_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "uniform sampler2D src;\n"
+        "uniform vec2 half_texel;\n"
+        "void main() {\n"
+        "    vec4 sum = texture(src, TexCoord) * 4.0;\n"
+        "    sum += texture(src, TexCoord - half_texel);\n"
+        "    sum += texture(src, TexCoord + half_texel);\n"
+        "    sum += texture(src, TexCoord + vec2(half_texel.x, -half_texel.y));\n"
+        "    sum += texture(src, TexCoord - vec2(half_texel.x, -half_texel.y));\n"
+        "    FragColor = sum / 8.0;\n"
+        "}";
+
+    static const char *up_frag_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "uniform sampler2D src;\n"
+        "uniform vec2 half_texel;\n"
+        "void main() {\n"
+        "    vec2 h = half_texel;\n"
+        "    vec4 sum = texture(src, TexCoord + vec2(-h.x * 2.0, 0.0));\n"
+        "    sum += texture(src, TexCoord + vec2(h.x * 2.0, 0.0));\n"
+        "    sum += texture(src, TexCoord + vec2(0.0, -h.y * 2.0));\n"
+        "    sum += texture(src, TexCoord + vec2(0.0, h.y * 2.0));\n"
+        "    sum += texture(src, TexCoord + vec2(-h.x, h.y)) * 2.0;\n"
+        "    sum += texture(src, TexCoord + vec2(h.x, h.y)) * 2.0;\n"
+        "    sum += texture(src, TexCoord + vec2(h.x, -h.y)) * 2.0;\n"
+        "    sum += texture(src, TexCoord + vec2(-h.x, -h.y)) * 2.0;\n"
+        "    FragColor = sum / 12.0;\n"
+        "}";
+
+    static const char *composite_frag_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "uniform sampler2D scene;\n"
+        "uniform sampler2D bloom;\n"
+        "uniform float intensity;\n"
+        "void main() {\n"
+        "    vec3 c = texture(scene, TexCoord).rgb + texture(bloom, TexCoord).rgb * intensity;\n"
+        "    FragColor = vec4(c, 1.0);\n"
+        "}";
+
+    g_bloom.enabled = true;
+    g_bloom.threshold = 0.45f;
+    g_bloom.intensity = 1.2f;
+
+    glGenVertexArrays(1, &g_bloom.empty_vao);
+
+    g_bloom.bright_shader = build_program_from_src(fullscreen_vert_source, bright_frag_source);
+    g_bloom.down_shader = build_program_from_src(fullscreen_vert_source, down_frag_source);
+    g_bloom.up_shader = build_program_from_src(fullscreen_vert_source, up_frag_source);
+    g_bloom.composite_shader = build_program_from_src(fullscreen_vert_source, composite_frag_source);
+
+    glUseProgram(g_bloom.composite_shader);
+    glUniform1i(glGetUniformLocation(g_bloom.composite_shader, "scene"), 0);
+    glUniform1i(glGetUniformLocation(g_bloom.composite_shader, "bloom"), 1);
+    glUseProgram(0);
+
+    resize_bloom_targets(g_window_state.w, g_window_state.h);
+}
+
+void resize_bloom_targets(int width, int height) {
+    if (width <= 0 || height <= 0) return; // Minimized; keep the old targets around
+    if (g_bloom.scene.fbo && g_bloom.scene.tex.w == width && g_bloom.scene.tex.h == height) return;
+
+    destroy_render_target(&g_bloom.scene);
+    g_bloom.scene = create_render_target(width, height, GL_RGBA8, "bloom");
+    attach_depth_texture(&g_bloom.scene, "bloom");
+
+    for (int i = 0; i < BLOOM_LEVEL_COUNT; i++) {
+        int level_w = width >> (i + 1);
+        int level_h = height >> (i + 1);
+        destroy_render_target(&g_bloom.levels[i]);
+        g_bloom.levels[i] = create_render_target(level_w > 0 ? level_w : 1, level_h > 0 ? level_h : 1, GL_RGBA16F, "bloom");
+    }
+}
+
+void destroy_bloom() {
+    destroy_render_target(&g_bloom.scene);
+    for (int i = 0; i < BLOOM_LEVEL_COUNT; i++) destroy_render_target(&g_bloom.levels[i]);
+    glDeleteProgram(g_bloom.bright_shader);
+    glDeleteProgram(g_bloom.down_shader);
+    glDeleteProgram(g_bloom.up_shader);
+    glDeleteProgram(g_bloom.composite_shader);
+    glDeleteVertexArrays(1, &g_bloom.empty_vao);
+}
+
+void begin_bloom_scene() {
+    glBindFramebuffer(GL_FRAMEBUFFER, g_bloom.enabled ? g_bloom.scene.fbo : 0);
+}
+
+void bloom_pass(uint32_t shader, Render_Target *dst, Texture src) {
+    glBindFramebuffer(GL_FRAMEBUFFER, dst->fbo);
+    glViewport(0, 0, (int)dst->tex.w, (int)dst->tex.h);
+
+    glUseProgram(shader);
+    glUniform2f(glGetUniformLocation(shader, "half_texel"), 0.5f / src.w, 0.5f / src.h);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, src.id);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void apply_bloom() {
+    if (!g_bloom.enabled) return;
+
+    glBindVertexArray(g_bloom.empty_vao);
+    glDisable(GL_BLEND);
+
+    profiler_gpu_begin("bloom bright");
+    glUseProgram(g_bloom.bright_shader);
+    glUniform1f(glGetUniformLocation(g_bloom.bright_shader, "threshold"), g_bloom.threshold);
+    bloom_pass(g_bloom.bright_shader, &g_bloom.levels[0], g_bloom.scene.tex);
+    profiler_gpu_end();
+
+    profiler_gpu_begin("bloom down");
+    for (int i = 1; i < BLOOM_LEVEL_COUNT; i++) {
+        bloom_pass(g_bloom.down_shader, &g_bloom.levels[i], g_bloom.levels[i - 1].tex);
+    }
+    profiler_gpu_end();
+
+    // Each level accumulates the upsampled blur of the level below it
+    profiler_gpu_begin("bloom up");
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (int i = BLOOM_LEVEL_COUNT - 2; i >= 0; i--) {
+        bloom_pass(g_bloom.up_shader, &g_bloom.levels[i], g_bloom.levels[i + 1].tex);
+    }
+    glDisable(GL_BLEND);
+    profiler_gpu_end();
+
+    profiler_gpu_begin("bloom composite");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, g_window_state.w, g_window_state.h);
+    glUseProgram(g_bloom.composite_shader);
+    glUniform1f(glGetUniformLocation(g_bloom.composite_shader, "intensity"), g_bloom.intensity);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_bloom.scene.tex.id);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, g_bloom.levels[0].tex.id);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    profiler_gpu_end();
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(0);
+    glBindVertexArray(0);
+}
+
+void ensure_canvas(uint32_t cols, uint32_t rows, uint32_t tile_dim) {
+    if (g_canvas.target.fbo && g_canvas.cols == cols && g_canvas.rows == rows && g_canvas.tile_dim == tile_dim) return;
+
+    g_canvas.cols = cols;
+    g_canvas.rows = rows;
+    g_canvas.tile_dim = tile_dim;
+
+    destroy_render_target(&g_canvas.target);
+    g_canvas.target = create_render_target(cols * tile_dim, rows * tile_dim, GL_RGBA8, "canvas");
+
+    trace_log("Canvas recreated: %ux%u cells, %.0fx%.0f px", cols, rows, g_canvas.target.tex.w, g_canvas.target.tex.h);
+}
+
+void destroy_canvas() {
+    destroy_render_target(&g_canvas.target);
+}
+
+void begin_canvas() {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &g_canvas.prev_fbo);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, g_canvas.prev_clear_color);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_canvas.target.fbo);
+    glViewport(0, 0, (int)g_canvas.target.tex.w, (int)g_canvas.target.tex.h);
+    set_ortho_projection((int)g_canvas.target.tex.w, (int)g_canvas.target.tex.h);
+
+    // Transparent black, so the premultiplied canvas composites correctly over the background
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void end_canvas() {
+    glBindFramebuffer(GL_FRAMEBUFFER, g_canvas.prev_fbo);
+    glViewport(0, 0, g_window_state.w, g_window_state.h);
+    set_ortho_projection(g_window_state.w, g_window_state.h);
+
+    float *c = g_canvas.prev_clear_color;
+    glClearColor(c[0], c[1], c[2], c[3]);
+}
+
+void present_canvas() {
+    Texture tex = g_canvas.target.tex;
+
+    float scale = glm_min(g_window_state.w / tex.w, g_window_state.h / tex.h);
+    if (g_canvas.integer_scale && scale >= 1.0f) scale = floorf(scale);
+
+    // Nearest keeps glyph edges crisp on magnification; minification needs filtering
+    GLenum filter = scale >= 1.0f ? GL_NEAREST : GL_LINEAR;
+    glBindTexture(GL_TEXTURE_2D, tex.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    Rect dest = {0};
+    dest.w = floorf(tex.w * scale);
+    dest.h = floorf(tex.h * scale);
+    dest.x = floorf((g_window_state.w - dest.w) * 0.5f);
+    dest.y = floorf((g_window_state.h - dest.h) * 0.5f);
+
+    // FBO rows are bottom-up, so sample the source rect flipped
+    draw_texture(dest, tex, (Rect){0.0f, tex.h, tex.w, -tex.h}, (vec4){1.0f, 1.0f, 1.0f, 1.0f});
+}
+
+void profiler_gpu_begin(const char *name) {
+    assert(g_profiler.active_gpu_zone == NULL);
+
+    Gpu_Zone *zone = NULL;
+    for (uint32_t i = 0; i < g_profiler.gpu_zone_count; i++) {
+        if (strcmp(g_profiler.gpu_zones[i].name, name) == 0) {
+            zone = &g_profiler.gpu_zones[i];
+            break;
+        }
+    }
+
+    if (zone == NULL) {
+        if (g_profiler.gpu_zone_count == MAX_GPU_ZONES) exit_with_error("Too many GPU profiler zones");
+        zone = &g_profiler.gpu_zones[g_profiler.gpu_zone_count++];
+        zone->name = name;
+        glGenQueries(GPU_QUERY_LATENCY, zone->queries);
+    }
+
+    // The query in this slot was issued GPU_QUERY_LATENCY frames ago, so it's normally ready
+    uint32_t slot = g_profiler.frame_index % GPU_QUERY_LATENCY;
+    if (zone->pending[slot]) {
+        uint64_t elapsed_ns = 0;
+        glGetQueryObjectui64v(zone->queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+        zone->total_ms += (double)elapsed_ns / 1.0e6;
+        zone->samples++;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, zone->queries[slot]);
+    zone->pending[slot] = true;
+    g_profiler.active_gpu_zone = zone;
+}
+
+void profiler_gpu_end() {
+    assert(g_profiler.active_gpu_zone != NULL);
+    glEndQuery(GL_TIME_ELAPSED);
+    g_profiler.active_gpu_zone = NULL;
+}
+
+void profiler_count(const char *name, uint64_t value) {
+    for (uint32_t i = 0; i < g_profiler.counter_count; i++) {
+        if (strcmp(g_profiler.counters[i].name, name) == 0) {
+            g_profiler.counters[i].total += value;
+            return;
+        }
+    }
+
+    if (g_profiler.counter_count == MAX_PROFILER_COUNTERS) exit_with_error("Too many profiler counters");
+    g_profiler.counters[g_profiler.counter_count++] = (Profiler_Counter){name, value};
+}
+
+void profiler_end_frame() {
+    profiler_count("gl perf warnings", g_gl_debug.frame_perf_warnings);
+    g_gl_debug.frame_perf_warnings = 0;
+
+    g_profiler.frame_index++;
+    g_profiler.frames_since_report++;
+
+    double now = glfwGetTime();
+    if (now - g_profiler.last_report_time < 1.0) return;
+
+    if (g_profiler.report_enabled) {
+        double frame_ms = (now - g_profiler.last_report_time) * 1000.0 / g_profiler.frames_since_report;
+        trace_log("Profiler: %.2f ms/frame (%u frames)", frame_ms, g_profiler.frames_since_report);
+        for (uint32_t i = 0; i < g_profiler.gpu_zone_count; i++) {
+            Gpu_Zone *zone = &g_profiler.gpu_zones[i];
+            if (zone->samples == 0) continue;
+            trace_log("  GPU %-18s %8.3f ms", zone->name, zone->total_ms / zone->samples);
+        }
+        for (uint32_t i = 0; i < g_profiler.counter_count; i++) {
+            Profiler_Counter *counter = &g_profiler.counters[i];
+            trace_log("  CNT %-18s %8.1f /frame", counter->name, (double)counter->total / g_profiler.frames_since_report);
+        }
+        report_perf_zones();
+        report_overdraw();
+    }
+
+    for (uint32_t i = 0; i < g_profiler.gpu_zone_count; i++) {
+        g_profiler.gpu_zones[i].total_ms = 0.0;
+        g_profiler.gpu_zones[i].samples = 0;
+    }
+    for (uint32_t i = 0; i < g_profiler.counter_count; i++) {
+        g_profiler.counters[i].total = 0;
+    }
+    reset_perf_zones();
+    memset(g_overdraw.samples, 0, sizeof(g_overdraw.samples));
+    g_overdraw.pixels = 0.0;
+    g_profiler.frames_since_report = 0;
+    g_profiler.last_report_time = now;
+}
+
+// Background and cell grid straight into the bound target, layered by depth when enabled.
+// Expects the grid already uploaded this frame, so the heatmap redraw reuses the same instances.
+void draw_scene(Texture painting, Ascii_Atlas atlas, bool measure_layers) {
+    if (!g_overdraw.depth_layering) {
+        if (measure_layers) overdraw_begin(LAYER_BACKGROUND);
+        draw_background(painting, atlas.tex);
+        if (measure_layers) overdraw_end();
+        if (measure_layers) overdraw_begin(LAYER_GLYPHS);
+        draw_cell_grid_pass(&g_cell_grid, atlas, CELL_PASS_ALL);
+        if (measure_layers) overdraw_end();
+        return;
+    }
+
+    // Opaque cells first, writing depth, so early-Z rejects the background under them;
+    // the translucent layers after them only test
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    if (measure_layers) overdraw_begin(LAYER_OPAQUE_CELLS);
+    draw_cell_grid_pass(&g_cell_grid, atlas, CELL_PASS_OPAQUE);
+    if (measure_layers) overdraw_end();
+
+    glEnable(GL_BLEND);
+    glDepthMask(GL_FALSE);
+    if (measure_layers) overdraw_begin(LAYER_BACKGROUND);
+    draw_background(painting, atlas.tex);
+    if (measure_layers) overdraw_end();
+    if (measure_layers) overdraw_begin(LAYER_GLYPHS);
+    draw_cell_grid_pass(&g_cell_grid, atlas, CELL_PASS_TRANSLUCENT);
+    if (measure_layers) overdraw_end();
+    glDepthMask(GL_TRUE);
+    glDisable(GL_DEPTH_TEST);
+}
+
+void initialize_heatmap() {
+    // Blue through green and yellow to red over 0..8 fragments, white beyond
+    static const char *heatmap_frag_source =
+        "#version 430 core\n"
+        "out vec4 FragColor;\n"
+        "in vec2 TexCoord;\n"
+        "uniform sampler2D counts;\n"
+        "void main() {\n"
+        "    float n = texture(counts, TexCoord).r;\n"
+        "    float t = clamp(n / 8.0, 0.0, 1.0);\n"
+        "    vec3 c = n < 0.5 ? vec3(0.0) : clamp(vec3(2.0 * t - 0.5, 1.5 - abs(4.0 * t - 2.0), 1.0 - 2.0 * t), 0.0, 1.0);\n"
+        "    if (n > 8.5) c = vec3(1.0);\n"
+        "    FragColor = vec4(c, 1.0);\n"
+        "}";
+
+    g_heatmap.shader = build_program_from_src(fullscreen_vert_source, heatmap_frag_source);
+    glGenQueries(GPU_QUERY_LATENCY, g_heatmap.queries);
+}
+
+void destroy_heatmap() {
+    destroy_render_target(&g_heatmap.target);
+    glDeleteProgram(g_heatmap.shader);
+    glDeleteQueries(GPU_QUERY_LATENCY, g_heatmap.queries);
+}
+
+void set_fragment_counting(bool enabled) {
+    glUseProgram(g_gl_state.shader);
+    glUniform1i(glGetUniformLocation(g_gl_state.shader, "count_fragments"), enabled);
+    glUseProgram(g_gl_state.cell_shader);
+    glUniform1i(glGetUniformLocation(g_gl_state.cell_shader, "count_fragments"), enabled);
+    glUseProgram(0);
+}
+
+// Redraws the scene counting fragments, then replaces the presented frame with the heatmap.
+// Depth layering applies here too, so the view shows what early-Z saves. The canvas path is
+// counted as if drawn directly. Both paths have uploaded the grid by now, so its instances are
+// drawn again as they are rather than compacted and uploaded a second time.
+void draw_heatmap(Texture painting, Ascii_Atlas atlas) {
+    int w = g_window_state.w, h = g_window_state.h;
+    if (w <= 0 || h <= 0) return;
+    if (!g_heatmap.target.fbo || g_heatmap.target.tex.w != w || g_heatmap.target.tex.h != h) {
+        destroy_render_target(&g_heatmap.target);
+        g_heatmap.target = create_render_target(w, h, GL_R32F, "heatmap");
+        attach_depth_texture(&g_heatmap.target, "heatmap");
+    }
+
+    profiler_gpu_begin("heatmap");
+    int32_t prev_fbo = 0;
+    float prev_clear_color[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, prev_clear_color);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, g_heatmap.target.fbo);
+    glViewport(0, 0, w, h);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    uint32_t slot = g_profiler.frame_index % GPU_QUERY_LATENCY;
+    if (g_heatmap.pending[slot]) {
+        uint64_t fragments = 0;
+        glGetQueryObjectui64v(g_heatmap.queries[slot], GL_QUERY_RESULT, &fragments);
+        profiler_count("heatmap fragments", fragments);
+    }
+
+    // The opaque pass runs with blending off; it draws first into a cleared target, so its
+    // overwrite still counts one
+    set_fragment_counting(true);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBeginQuery(GL_SAMPLES_PASSED, g_heatmap.queries[slot]);
+    draw_scene(painting, atlas, false);
+    glEndQuery(GL_SAMPLES_PASSED);
+    g_heatmap.pending[slot] = true;
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    set_fragment_counting(false);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+    glClearColor(prev_clear_color[0], prev_clear_color[1], prev_clear_color[2], prev_clear_color[3]);
+    glDisable(GL_BLEND);
+    glUseProgram(g_heatmap.shader);
+    glBindVertexArray(g_bloom.empty_vao);
+    glBindTexture(GL_TEXTURE_2D, g_heatmap.target.tex.id);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glEnable(GL_BLEND);
+    profiler_gpu_end();
+}
+
+void initialize_palette() {
+    assert((int)PALETTE_USED <= (int)PALETTE_SIZE);
+
+    g_palette.ubo = gen_tracked_buffer("palette");
+    glBindBuffer(GL_UNIFORM_BUFFER, g_palette.ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(g_palette.colors), NULL, GL_DYNAMIC_DRAW);
+    set_tracked_gl_size(MEM_BUFFER, g_palette.ubo, sizeof(g_palette.colors));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, g_palette.ubo);
+
+    update_palette(0.0);
+}
+
+void destroy_palette() {
+    delete_tracked_buffer(&g_palette.ubo);
+}
+
+// Straight-alpha color in, premultiplied RGBA8 out (R in the low byte, for unpackUnorm4x8)
+uint32_t pack_palette_color(vec4 color, float additive) {
+    float a = glm_clamp(color[3], 0.0f, 1.0f);
+    float channels[4] = {color[0] * a, color[1] * a, color[2] * a, a * (1.0f - additive)};
+    uint32_t packed = 0;
+    for (int c = 0; c < 4; c++) packed |= (uint32_t)(glm_clamp(channels[c], 0.0f, 1.0f) * 255.0f + 0.5f) << (8 * c);
+    return packed;
+}
+
+// Rebuilt and uploaded each frame only while cycling; other modes upload once when selected
+void update_palette(double time) {
+    static const vec3 phase_colors[PHASE_COUNT] = {{0.25f, 0.55f, 1.0f}, {0.95f, 0.7f, 0.2f}, {0.3f, 0.3f, 0.35f}};
+    static bool uploaded = false;
+    static Palette_Mode uploaded_mode;
+    if (uploaded && g_palette.mode != PALETTE_CYCLE && uploaded_mode == g_palette.mode) return;
+
+    for (int i = 0; i < PALETTE_RAMP_SIZE; i++) {
+        float d = (float)i / (PALETTE_RAMP_SIZE - 1);
+        vec4 color = {0.2f + 0.8f * d * d, 0.4f + 0.6f * d, 1.0f, 0.35f + 0.65f * d};
+        if (g_palette.mode == PALETTE_CYCLE) {
+            // Bands of hue travelling up the ramp
+            float phase = 6.2831853f * (d * 2.0f - (float)time * 0.5f);
+            color[0] = 0.5f + 0.5f * cosf(phase);
+            color[1] = 0.5f + 0.5f * cosf(phase - 2.0943951f);
+            color[2] = 0.5f + 0.5f * cosf(phase + 2.0943951f);
+        } else if (g_palette.mode == PALETTE_HEAT) {
+            // Black body: black, red, yellow, white
+            color[0] = glm_clamp(d * 3.0f, 0.0f, 1.0f);
+            color[1] = glm_clamp(d * 3.0f - 1.0f, 0.0f, 1.0f);
+            color[2] = glm_clamp(d * 3.0f - 2.0f, 0.0f, 1.0f);
+            color[3] = glm_clamp(d * 4.0f, 0.0f, 1.0f);
+        }
+        // The densest dye glows
+        g_palette.colors[PALETTE_RAMP + i] = pack_palette_color(color, glm_clamp((d - 0.7f) / 0.3f, 0.0f, 1.0f));
+    }
+
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        for (int level = 0; level < PALETTE_PHASE_LEVELS; level++) {
+            float share = (float)level / (PALETTE_PHASE_LEVELS - 1);
+            vec4 color = {phase_colors[k][0], phase_colors[k][1], phase_colors[k][2], 0.3f + 0.7f * share};
+            g_palette.colors[PALETTE_PHASES + k * PALETTE_PHASE_LEVELS + level] = pack_palette_color(color, 0.0f);
+        }
+    }
+
+    g_palette.colors[PALETTE_SOLID] = pack_palette_color((vec4){0.55f, 0.5f, 0.45f, 1.0f}, 0.0f);
+    g_palette.colors[PALETTE_TEXT] = pack_palette_color((vec4){1.0f, 0.85f, 0.3f, 1.0f}, 0.0f);
+    g_palette.colors[PALETTE_OUTLINE] = pack_palette_color((vec4){0.95f, 0.9f, 0.8f, 1.0f}, 0.5f);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, g_palette.ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(g_palette.colors), g_palette.colors);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded = true;
+    uploaded_mode = g_palette.mode;
+}
+
+void initialize_overdraw_meter() {
+    g_overdraw.depth_layering = true;
+    for (int i = 0; i < LAYER_COUNT; i++) glGenQueries(GPU_QUERY_LATENCY, g_overdraw.queries[i]);
+    glDepthFunc(GL_LESS);
+}
+
+void destroy_overdraw_meter() {
+    for (int i = 0; i < LAYER_COUNT; i++) glDeleteQueries(GPU_QUERY_LATENCY, g_overdraw.queries[i]);
+}
+
+void overdraw_begin(Draw_Layer layer) {
+    uint32_t slot = g_profiler.frame_index % GPU_QUERY_LATENCY;
+    if (g_overdraw.pending[layer][slot]) {
+        uint64_t samples = 0;
+        glGetQueryObjectui64v(g_overdraw.queries[layer][slot], GL_QUERY_RESULT, &samples);
+        g_overdraw.samples[layer] += samples;
+    }
+    // Every measured frame draws the background exactly once
+    if (layer == LAYER_BACKGROUND) g_overdraw.pixels += (double)g_window_state.w * g_window_state.h;
+
+    glBeginQuery(GL_SAMPLES_PASSED, g_overdraw.queries[layer][slot]);
+    g_overdraw.pending[layer][slot] = true;
+}
+
+void overdraw_end() {
+    glEndQuery(GL_SAMPLES_PASSED);
+}
+
+void report_overdraw() {
+    if (g_overdraw.pixels <= 0.0) return;
+
+    double total = 0.0;
+    for (int i = 0; i < LAYER_COUNT; i++) total += (double)g_overdraw.samples[i];
+    trace_log("  Overdraw %.2fx window (opaque cells %.2f, background %.2f, glyphs %.2f), depth layering %s",
+              total / g_overdraw.pixels, g_overdraw.samples[LAYER_OPAQUE_CELLS] / g_overdraw.pixels,
+              g_overdraw.samples[LAYER_BACKGROUND] / g_overdraw.pixels, g_overdraw.samples[LAYER_GLYPHS] / g_overdraw.pixels,
+              g_overdraw.depth_layering ? "on" : "off");
+}
+
+void initialize_latency_tracker() {
+    for (int i = 0; i < LATENCY_FRAMES_IN_FLIGHT; i++) glGenQueries(1, &g_latency.frames[i].query);
+    g_latency.last_report_time = glfwGetTime();
+}
+
+void destroy_latency_tracker() {
+    for (int i = 0; i < LATENCY_FRAMES_IN_FLIGHT; i++) {
+        Latency_Frame *frame = &g_latency.frames[i];
+        if (frame->pending) latency_retire_frame(frame, true);
+        glDeleteQueries(1, &frame->query);
+    }
+    if (g_latency.enabled) report_latency();
+}
+
+void latency_record_input(uint64_t time_ns) {
+    if (!g_latency.enabled) return;
+    if (g_latency.pending_count == LATENCY_MAX_EVENTS) {
+        g_latency.dropped_events++;
+        return;
+    }
+    g_latency.pending_ns[g_latency.pending_count++] = time_ns;
+}
+
+void latency_begin_frame() {
+    uint64_t now = now_ns();
+    Latency_Frame *frame = &g_latency.frames[g_latency.frame_index % LATENCY_FRAMES_IN_FLIGHT];
+    if (frame->pending) latency_retire_frame(frame, true);
+
+    memcpy(frame->input_ns, g_latency.pending_ns, g_latency.pending_count * sizeof(uint64_t));
+    frame->input_count = g_latency.pending_count;
+    frame->sim_ns = now;
+    g_latency.pending_count = 0;
+}
+
+void latency_end_frame() {
+    Latency_Frame *frame = &g_latency.frames[g_latency.frame_index % LATENCY_FRAMES_IN_FLIGHT];
+    g_latency.frame_index++;
+
+    // Frames without input carry nothing to measure, so they cost no fence
+    if (frame->input_count > 0) {
+        frame->swap_ns = now_ns();
+        glQueryCounter(frame->query, GL_TIMESTAMP);
+        frame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frame->pending = true;
+        if (g_latency.gpu_to_cpu_ns == 0) latency_calibrate_clock();
+    }
+
+    for (int i = 0; i < LATENCY_FRAMES_IN_FLIGHT; i++) {
+        if (g_latency.frames[i].pending) latency_retire_frame(&g_latency.frames[i], false);
+    }
+
+    if (!g_latency.enabled) return;
+    double now = glfwGetTime();
+    if (now - g_latency.last_report_time < 1.0) return;
+    g_latency.last_report_time = now;
+    if (g_latency.sample_count > 0) report_latency();
+    latency_calibrate_clock();
+}
+
+void latency_retire_frame(Latency_Frame *frame, bool wait) {
+    GLenum status = glClientWaitSync(frame->fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+    bool signaled = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+    if (!signaled && !wait) return;
+
+    if (signaled) {
+        // The fence only says the frame is done; the timestamp query says when
+        uint64_t gpu_ns = 0;
+        glGetQueryObjectui64v(frame->query, GL_QUERY_RESULT, &gpu_ns);
+        uint64_t photon_ns = (uint64_t)((int64_t)gpu_ns + g_latency.gpu_to_cpu_ns);
+        if (photon_ns < frame->swap_ns) photon_ns = frame->swap_ns;
+
+        for (uint32_t i = 0; i < frame->input_count && g_latency.sample_count < LATENCY_MAX_SAMPLES; i++) {
+            uint32_t k = g_latency.sample_count++;
+            g_latency.total_ms[k] = (photon_ns - frame->input_ns[i]) / 1.0e6f;
+            g_latency.queue_ms[k] = (frame->sim_ns - frame->input_ns[i]) / 1.0e6f;
+            g_latency.cpu_ms[k] = (frame->swap_ns - frame->sim_ns) / 1.0e6f;
+            g_latency.gpu_ms[k] = (photon_ns - frame->swap_ns) / 1.0e6f;
+        }
+    } else {
+        // Blocking waits only happen when the slot is needed again, so a frame still not done
+        // after the timeout is dropped instead of leaving its fence to be overwritten
+        g_latency.dropped_frames++;
+    }
+
+    glDeleteSync(frame->fence);
+    frame->fence = NULL;
+    frame->pending = false;
+    frame->input_count = 0;
+}
+
+// Read both clocks back to back; the GL read is synchronous but cheap, and only runs once per report
+void latency_calibrate_clock() {
+    GLint64 gpu_ns = 0;
+    uint64_t before = now_ns();
+    glGetInteger64v(GL_TIMESTAMP, &gpu_ns);
+    uint64_t after = now_ns();
+    g_latency.gpu_to_cpu_ns = (int64_t)(before + (after - before) / 2) - gpu_ns;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts in place; nearest-rank
+float percentile(float *values, uint32_t count, float p) {
+    qsort(values, count, sizeof(float), compare_floats);
+    uint32_t rank = (uint32_t)ceilf(p * count);
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+void report_latency() {
+    uint32_t n = g_latency.sample_count;
+    if (n == 0) {
+        trace_log("Input latency: no input events measured");
+        return;
+    }
+
+    double queue = 0.0, cpu = 0.0, gpu = 0.0;
+    for (uint32_t i = 0; i < n; i++) {
+        queue += g_latency.queue_ms[i];
+        cpu += g_latency.cpu_ms[i];
+        gpu += g_latency.gpu_ms[i];
+    }
+
+    float p50 = percentile(g_latency.total_ms, n, 0.5f);
+    float p90 = percentile(g_latency.total_ms, n, 0.9f);
+    float p99 = percentile(g_latency.total_ms, n, 0.99f);
+    trace_log("Input latency (%u events): p50 %.2f ms  p90 %.2f ms  p99 %.2f ms  max %.2f ms",
+              n, p50, p90, p99, g_latency.total_ms[n - 1]);
+    trace_log("  mean: %.2f ms to frame start, %.2f ms sim+render to swap, %.2f ms swap to GPU done",
+              queue / n, cpu / n, gpu / n);
+    trace_log("  + up to one refresh of scan-out, not measured");
+    if (g_latency.dropped_events) trace_log("  %u events dropped (more than %d in one frame)", g_latency.dropped_events, LATENCY_MAX_EVENTS);
+    if (g_latency.dropped_frames) trace_log("  %u frames dropped (fence wait timed out)", g_latency.dropped_frames);
+
+    g_latency.sample_count = 0;
+    g_latency.dropped_events = 0;
+    g_latency.dropped_frames = 0;
+}
+
+Fluid_Params default_fluid_params() {
+    Fluid_Params params = {0};
+    params.w = FLUID_WIDTH;
+    params.h = FLUID_HEIGHT;
+    params.dt = 0.1f;
+    params.viscosity = 0.00001f;
+    params.diffusion = 0.00001f;
+    params.inflow_speed = 2.0f;
+    params.inflow_density = 1.0f;
+    params.iterations = 20;
+    return params;
+}
+
+void initialize_fluid(Fluid *fluid, Fluid_Params params) {
+    *fluid = (Fluid){0};
+    fluid->params = params;
+    fluid->stride = params.w + 2;
+
+    size_t bytes = (size_t)(params.w + 2) * (params.h + 2) * sizeof(float);
+    fluid->u = xcalloc(bytes, "fluid");
+    fluid->v = xcalloc(bytes, "fluid");
+    fluid->u_prev = xcalloc(bytes, "fluid");
+    fluid->v_prev = xcalloc(bytes, "fluid");
+    fluid->density = xcalloc(bytes, "fluid");
+    fluid->density_prev = xcalloc(bytes, "fluid");
+    fluid->scratch = xcalloc(bytes, "fluid");
+    fluid->pressure = xcalloc(bytes, "fluid");
+
+    if (params.scenario == SCENARIO_WIND_TUNNEL) {
+        // Slightly off-centre so the wake goes unstable without a kick
+        fluid_add_circle_obstacle(fluid, params.w * 0.25f, params.h * 0.5f + 0.5f, params.h * 0.1f);
+    }
+    if (params.scenario == SCENARIO_MULTIPHASE) initialize_multiphase(fluid);
+    if (params.scenario == SCENARIO_BODIES) {
+        // Bodies are rasterized every step; the cell list is sized for the worst case once
+        size_t cells = (size_t)fluid->stride * (params.h + 2);
+        fluid->solid = xcalloc(cells, "fluid");
+        fluid->solid_cells = xmalloc(cells * sizeof(int), "fluid");
+        fluid->solid_cell_u = xmalloc(cells * sizeof(float), "fluid");
+        fluid->solid_cell_v = xmalloc(cells * sizeof(float), "fluid");
+    }
+}
+
+void destroy_fluid(Fluid *fluid) {
+    xfree(fluid->u);
+    xfree(fluid->v);
+    xfree(fluid->u_prev);
+    xfree(fluid->v_prev);
+    xfree(fluid->density);
+    xfree(fluid->density_prev);
+    xfree(fluid->scratch);
+    xfree(fluid->pressure);
+    xfree(fluid->solid);
+    xfree(fluid->solid_cells);
+    xfree(fluid->solid_cell_u);
+    xfree(fluid->solid_cell_v);
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        xfree(fluid->phase[k]);
+        xfree(fluid->phase_prev[k]);
+    }
+    xfree(fluid->rho);
+    xfree(fluid->beta_x);
+    xfree(fluid->beta_y);
+    xfree(fluid->pcg_r);
+    xfree(fluid->pcg_d);
+    xfree(fluid->pcg_q);
+    xfree(fluid->pcg_z);
+    for (int l = 1; l < fluid->mg_level_count; l++) {
+        xfree(fluid->mg_levels[l].beta_x);
+        xfree(fluid->mg_levels[l].beta_y);
+        xfree(fluid->mg_levels[l].x);
+        xfree(fluid->mg_levels[l].b);
+    }
+    xfree(fluid->row_sums);
+    *fluid = (Fluid){0};
+}
+
+// b: 0 = scalar (copy), 1 = mirror u at the left/right walls, 2 = mirror v at the top/bottom walls
+void fluid_set_boundary(Fluid *fluid, int b, float *x) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+
+    for (int j = 1; j <= h; j++) fluid_set_row_boundary(fluid, b, x, j);
+
+    x[0 + 0 * s]           = 0.5f * (x[1 + 0 * s] + x[0 + 1 * s]);
+    x[0 + (h + 1) * s]     = 0.5f * (x[1 + (h + 1) * s] + x[0 + h * s]);
+    x[w + 1 + 0 * s]       = 0.5f * (x[w + 0 * s] + x[w + 1 + 1 * s]);
+    x[w + 1 + (h + 1) * s] = 0.5f * (x[w + (h + 1) * s] + x[w + 1 + h * s]);
+
+    if (fluid->solid) fluid_apply_obstacles(fluid, b, x);
+}
+
+// Edge cells of row j, plus the ghost row above or below when j is the first or last row. Split
+// out so the wavefront solver can close each row as soon as a sweep finishes it.
+void fluid_set_row_boundary(Fluid *fluid, int b, float *x, int j) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+
+    if (fluid->params.scenario == SCENARIO_WIND_TUNNEL) {
+        // Fixed inflow on the left, zero-gradient outflow on the right, free-slip top and bottom
+        x[0 + j * s]     = b == 1 ? fluid->params.inflow_speed : b == 2 ? 0.0f : x[1 + j * s];
+        x[w + 1 + j * s] = x[w + j * s];
+    } else {
+        x[0 + j * s]     = b == 1 ? -x[1 + j * s] : x[1 + j * s];
+        x[w + 1 + j * s] = b == 1 ? -x[w + j * s] : x[w + j * s];
+    }
+
+    if (j == 1) {
+        for (int i = 1; i <= w; i++) x[i + 0 * s] = b == 2 ? -x[i + 1 * s] : x[i + 1 * s];
+    }
+    if (j == h) {
+        for (int i = 1; i <= w; i++) x[i + (h + 1) * s] = b == 2 ? -x[i + h * s] : x[i + h * s];
+    }
+}
+
+// No-slip velocity inside obstacles; scalars take the mean of their fluid neighbours (zero
+// normal gradient across the obstacle surface)
+void fluid_apply_obstacles(Fluid *fluid, int b, float *x) {
+    int s = fluid->stride;
+    uint8_t *solid = fluid->solid;
+
+    for (int k = 0; k < fluid->solid_cell_count; k++) {
+        int idx = fluid->solid_cells[k];
+        if (b != 0) {
+            float *velocity = b == 1 ? fluid->solid_cell_u : fluid->solid_cell_v;
+            x[idx] = velocity ? velocity[k] : 0.0f;
+            continue;
+        }
+
+        float sum = 0.0f;
+        int count = 0;
+        if (!solid[idx - 1]) { sum += x[idx - 1]; count++; }
+        if (!solid[idx + 1]) { sum += x[idx + 1]; count++; }
+        if (!solid[idx - s]) { sum += x[idx - s]; count++; }
+        if (!solid[idx + s]) { sum += x[idx + s]; count++; }
+        x[idx] = count ? sum / count : 0.0f;
+    }
+}
+
+void fluid_add_circle_obstacle(Fluid *fluid, float cx, float cy, float radius) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    size_t cell_count = (size_t)s * (h + 2);
+
+    if (fluid->solid == NULL) fluid->solid = xcalloc(cell_count, "fluid");
+
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) {
+            float dx = i - cx, dy = j - cy;
+            if (dx * dx + dy * dy <= radius * radius) fluid->solid[i + j * s] = 1;
+        }
+    }
+
+    fluid->solid_cell_count = 0;
+    for (size_t idx = 0; idx < cell_count; idx++) fluid->solid_cell_count += fluid->solid[idx];
+
+    xfree(fluid->solid_cells);
+    fluid->solid_cells = xmalloc(fluid->solid_cell_count * sizeof(int), "fluid");
+    int k = 0;
+    for (size_t idx = 0; idx < cell_count; idx++) {
+        if (fluid->solid[idx]) fluid->solid_cells[k++] = (int)idx;
+    }
+}
+
+typedef struct Lin_Solve_Job {
+    Fluid *fluid;
+    float *x, *x0;
+    float a, inv_c;
+    int color;
+    int tile_cols;
+} Lin_Solve_Job;
+
+// Red-black Gauss-Seidel relaxation of (x - a * laplacian(x)) / c = x0. Cells of one colour only
+// read the other colour, so rows of a half-sweep can be split across threads.
+void fluid_lin_solve(Fluid *fluid, int b, float *x, float *x0, float a, float c) {
+    Kernel_Tuning tuning = g_tuning[TUNE_STENCIL];
+    Lin_Solve_Job job = {fluid, x, x0, a, 1.0f / c, 0, tuning.tile_cols};
+
+    // Obstacles are fixed up from the solid cell list between sweeps, which needs the whole field
+    if (fluid->params.temporal_depth > 1 && !fluid->solid) {
+        fluid_lin_solve_wavefront(fluid, b, x, x0, a, c);
+        return;
+    }
+
+    if (fluid->params.solver == SOLVER_JACOBI) {
+        // Ping-pong between x and scratch; the job's color field selects the direction
+        size_t bytes = (size_t)fluid->stride * (fluid->params.h + 2) * sizeof(float);
+        memcpy(fluid->scratch, x, bytes);
+        for (int k = 0; k < fluid->params.iterations; k++) {
+            job.color = k & 1;
+            parallel_for(1, fluid->params.h + 1, tuning, fluid_jacobi_rows, &job);
+            fluid_set_boundary(fluid, b, job.color ? x : fluid->scratch);
+        }
+        if (fluid->params.iterations & 1) memcpy(x, fluid->scratch, bytes);
+        return;
+    }
+
+    for (int k = 0; k < fluid->params.iterations; k++) {
+        for (job.color = 0; job.color < 2; job.color++) {
+            parallel_for(1, fluid->params.h + 1, tuning, fluid_lin_solve_rows, &job);
+        }
+        fluid_set_boundary(fluid, b, x);
+    }
+}
+
+void fluid_lin_solve_rows(void *ctx, int begin, int end) {
+    Lin_Solve_Job *job = ctx;
+    int w = job->fluid->params.w, s = job->fluid->stride;
+    int tile = job->tile_cols > 0 ? job->tile_cols : w;
+    float *x = job->x, *x0 = job->x0;
+    uint8_t *solid = job->fluid->solid;
+
+    for (int tile_start = 1; tile_start <= w; tile_start += tile) {
+        int tile_end = glm_min(tile_start + tile, w + 1);
+        for (int j = begin; j < end; j++) {
+            int i = tile_start + ((tile_start + j + job->color) & 1);
+            for (; i < tile_end; i += 2) {
+                int idx = i + j * s;
+                if (solid && solid[idx]) continue;
+                x[idx] = (x0[idx] + job->a * (x[idx - 1] + x[idx + 1] + x[idx - s] + x[idx + s])) * job->inv_c;
+            }
+        }
+    }
+}
+
+typedef struct Wavefront_Job {
+    Lin_Solve_Job solve;
+    int b;
+    bool jacobi;
+    int first_sweep;
+    int stage;
+} Wavefront_Job;
+
+// Temporal blocking: a pass runs up to temporal_depth sweeps (Jacobi iterations or red-black
+// half-sweeps) as a pipeline down the rows. At each stage sweep t relaxes a tile of
+// TEMPORAL_BLOCK_ROWS rows that trails sweep t - 1 by one row more than a tile. That lag keeps
+// each sweep's inputs finished and not yet overwritten, so the tiles of a stage run in parallel,
+// and the field streams from memory once per pass instead of once per sweep. Each sweep closes
+// the edges of its rows as it goes, so the result matches plain sweeping exactly.
+void fluid_lin_solve_wavefront(Fluid *fluid, int b, float *x, float *x0, float a, float c) {
+    int h = fluid->params.h;
+    bool jacobi = fluid->params.solver == SOLVER_JACOBI;
+    int sweep_count = fluid->params.iterations * (jacobi ? 1 : 2);
+    int depth = glm_min(fluid->params.temporal_depth, TEMPORAL_MAX_DEPTH);
+
+    Kernel_Tuning tiles = g_tuning[TUNE_STENCIL];
+    tiles.grain = 1;
+    Wavefront_Job job = {{fluid, x, x0, a, 1.0f / c, 0, tiles.tile_cols}, b, jacobi, 0, 0};
+
+    size_t bytes = (size_t)fluid->stride * (h + 2) * sizeof(float);
+    if (jacobi) memcpy(fluid->scratch, x, bytes);
+
+    for (job.first_sweep = 0; job.first_sweep < sweep_count; job.first_sweep += depth) {
+        int pass_sweeps = glm_min(depth, sweep_count - job.first_sweep);
+        int lag = (pass_sweeps - 1) * (TEMPORAL_BLOCK_ROWS + 1);
+        int stage_count = (h + lag + TEMPORAL_BLOCK_ROWS - 1) / TEMPORAL_BLOCK_ROWS;
+        for (job.stage = 0; job.stage < stage_count; job.stage++) {
+            parallel_for(0, pass_sweeps, tiles, fluid_wavefront_tiles, &job);
+        }
+    }
+
+    // Corners are never read by the stencil, so only the final field needs them
+    float *result = jacobi && (sweep_count & 1) ? fluid->scratch : x;
+    fluid_set_boundary(fluid, b, result);
+    if (result != x) memcpy(x, result, bytes);
+}
+
+void fluid_wavefront_tiles(void *ctx, int begin, int end) {
+    Wavefront_Job *job = ctx;
+    int h = job->solve.fluid->params.h;
+
+    for (int t = begin; t < end; t++) {
+        int first = job->stage * TEMPORAL_BLOCK_ROWS - t * (TEMPORAL_BLOCK_ROWS + 1) + 1;
+        int row_begin = glm_max(first, 1);
+        int row_end = glm_min(first + TEMPORAL_BLOCK_ROWS, h + 1);
+        if (row_begin >= row_end) continue;
+
+        // Same kernels as plain sweeping; color picks the Jacobi direction or the red-black half
+        Lin_Solve_Job sweep = job->solve;
+        sweep.color = (job->first_sweep + t) & 1;
+        float *closed = NULL;
+        if (job->jacobi) {
+            fluid_jacobi_rows(&sweep, row_begin, row_end);
+            closed = sweep.color ? sweep.x : sweep.fluid->scratch;
+        } else {
+            fluid_lin_solve_rows(&sweep, row_begin, row_end);
+            // Plain red-black sweeping closes the edges after the black half only
+            if (sweep.color) closed = sweep.x;
+        }
+        if (closed) {
+            for (int j = row_begin; j < row_end; j++) fluid_set_row_boundary(sweep.fluid, job->b, closed, j);
+        }
+    }
+}
+
+void fluid_add_inflow(Fluid *fluid) {
+    int h = fluid->params.h, s = fluid->stride;
+
+    if (fluid->params.scenario == SCENARIO_WIND_TUNNEL) {
+        // Dye streaks entering with the free stream
+        for (int j = 1; j <= h; j++) {
+            if (j % 6 < 2) fluid->density[1 + j * s] = fluid->params.inflow_density;
+        }
+        return;
+    }
+
+    int half_width = h / 12 > 1 ? h / 12 : 1;
+    float wobble = sinf((float)fluid->step_count * 0.05f) * 0.3f;
+
+    for (int j = h / 2 - half_width; j <= h / 2 + half_width; j++) {
+        for (int i = 1; i <= 3; i++) {
+            int idx = i + j * s;
+            fluid->density[idx] += fluid->params.inflow_density * fluid->params.dt * 4.0f;
+            fluid->u[idx] = fluid->params.inflow_speed;
+            fluid->v[idx] = wobble * fluid->params.inflow_speed;
+        }
+    }
+}
+
+// Drag impulse and a puff of dye under the cursor; the window is mapped onto the whole fluid
+void fluid_stir(Fluid *fluid, Mouse_State *mouse) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    int ci = 1 + (int)(mouse->x * w / glm_max(g_window_state.w, 1));
+    int cj = 1 + (int)(mouse->y * h / glm_max(g_window_state.h, 1));
+    float du = (float)mouse->dx * w / glm_max(g_window_state.w, 1) / fluid->params.dt;
+    float dv = (float)mouse->dy * h / glm_max(g_window_state.h, 1) / fluid->params.dt;
+    mouse->dx = mouse->dy = 0.0;
+
+    for (int j = glm_max(cj - 2, 1); j <= glm_min(cj + 2, h); j++) {
+        for (int i = glm_max(ci - 2, 1); i <= glm_min(ci + 2, w); i++) {
+            int idx = i + j * s;
+            fluid->u[idx] += du / glm_max(w, h);
+            fluid->v[idx] += dv / glm_max(w, h);
+            fluid->density[idx] = glm_min(fluid->density[idx] + 0.5f, 1.0f);
+        }
+    }
+}
+
+void fluid_diffuse(Fluid *fluid, int b, float *x, float *x0, float rate) {
+    int n = glm_max(fluid->params.w, fluid->params.h);
+    float a = fluid->params.dt * rate * n * n;
+    fluid_lin_solve(fluid, b, x, x0, a, 1.0f + 4.0f * a);
+}
+
+void fluid_jacobi_rows(void *ctx, int begin, int end) {
+    Lin_Solve_Job *job = ctx;
+    int w = job->fluid->params.w, s = job->fluid->stride;
+    float *src = job->color ? job->fluid->scratch : job->x;
+    float *dst = job->color ? job->x : job->fluid->scratch;
+    float *x0 = job->x0;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            dst[idx] = (x0[idx] + job->a * (src[idx - 1] + src[idx + 1] + src[idx - s] + src[idx + s])) * job->inv_c;
+        }
+    }
+}
+
+typedef struct Advect_Job {
+    Fluid *fluid;
+    float *d, *d0, *u, *v;
+} Advect_Job;
+
+// Semi-Lagrangian backtrace with bilinear sampling
+void fluid_advect(Fluid *fluid, int b, float *d, float *d0, float *u, float *v) {
+    Advect_Job job = {fluid, d, d0, u, v};
+    parallel_for(1, fluid->params.h + 1, g_tuning[TUNE_ADVECT], fluid_advect_rows, &job);
+    fluid_set_boundary(fluid, b, d);
+}
+
+void fluid_advect_rows(void *ctx, int begin, int end) {
+    Advect_Job *job = ctx;
+    int w = job->fluid->params.w, h = job->fluid->params.h, s = job->fluid->stride;
+    float dt0 = job->fluid->params.dt * glm_max(w, h);
+    float *d = job->d, *d0 = job->d0, *u = job->u, *v = job->v;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float x = glm_clamp(i - dt0 * u[idx], 0.5f, w + 0.5f);
+            float y = glm_clamp(j - dt0 * v[idx], 0.5f, h + 0.5f);
+
+            int i0 = (int)x, j0 = (int)y;
+            float s1 = x - i0, s0 = 1.0f - s1;
+            float t1 = y - j0, t0 = 1.0f - t1;
+
+            int k = i0 + j0 * s;
+            d[idx] = s0 * (t0 * d0[k] + t1 * d0[k + s]) + s1 * (t0 * d0[k + 1] + t1 * d0[k + 1 + s]);
+        }
+    }
+}
+
+typedef struct Project_Job {
+    Fluid *fluid;
+    float *u, *v, *p, *div;
+} Project_Job;
+
+void fluid_project(Fluid *fluid, float *u, float *v, float *p, float *div) {
+    Project_Job job = {fluid, u, v, p, div};
+    int h = fluid->params.h;
+
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], fluid_divergence_rows, &job);
+    fluid_set_boundary(fluid, 0, div);
+    fluid_set_boundary(fluid, 0, p);
+
+    fluid_lin_solve(fluid, 0, p, div, 1.0f, 4.0f);
+
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], fluid_subtract_gradient_rows, &job);
+    fluid_set_boundary(fluid, 1, u);
+    fluid_set_boundary(fluid, 2, v);
+}
+
+void fluid_divergence_rows(void *ctx, int begin, int end) {
+    Project_Job *job = ctx;
+    int w = job->fluid->params.w, s = job->fluid->stride;
+    float n = (float)glm_max(w, job->fluid->params.h);
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            job->div[idx] = -0.5f * (job->u[idx + 1] - job->u[idx - 1] + job->v[idx + s] - job->v[idx - s]) / n;
+            job->p[idx] = 0.0f;
+        }
+    }
+}
+
+float fluid_divergence_norm(Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    double sum = 0.0;
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float div = 0.5f * (fluid->u[idx + 1] - fluid->u[idx - 1] + fluid->v[idx + s] - fluid->v[idx - s]);
+            sum += (double)div * div;
+        }
+    }
+    return (float)sqrt(sum / ((double)w * h));
+}
+
+void fluid_subtract_gradient_rows(void *ctx, int begin, int end) {
+    Project_Job *job = ctx;
+    int w = job->fluid->params.w, s = job->fluid->stride;
+    float n = (float)glm_max(w, job->fluid->params.h);
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            job->u[idx] -= 0.5f * n * (job->p[idx + 1] - job->p[idx - 1]);
+            job->v[idx] -= 0.5f * n * (job->p[idx + s] - job->p[idx - s]);
+        }
+    }
+}
+
+#define SWAP_FIELDS(a, b) do { float *tmp_ = (a); (a) = (b); (b) = tmp_; } while (0)
+
+void step_fluid(Fluid *fluid) {
+    if (fluid->params.scenario == SCENARIO_MULTIPHASE) {
+        step_multiphase(fluid);
+        return;
+    }
+
+    uint64_t cells = (uint64_t)fluid->params.w * fluid->params.h;
+    Perf_Scope scope;
+
+    scope = perf_zone_begin("fluid inflow");
+    fluid_add_inflow(fluid);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("fluid diffuse");
+    SWAP_FIELDS(fluid->u_prev, fluid->u);
+    fluid_diffuse(fluid, 1, fluid->u, fluid->u_prev, fluid->params.viscosity);
+    SWAP_FIELDS(fluid->v_prev, fluid->v);
+    fluid_diffuse(fluid, 2, fluid->v, fluid->v_prev, fluid->params.viscosity);
+    perf_zone_end(&scope, cells * 2);
+
+    scope = perf_zone_begin("fluid project");
+    fluid_project(fluid, fluid->u, fluid->v, fluid->pressure, fluid->v_prev);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("fluid advect");
+    SWAP_FIELDS(fluid->u_prev, fluid->u);
+    SWAP_FIELDS(fluid->v_prev, fluid->v);
+    fluid_advect(fluid, 1, fluid->u, fluid->u_prev, fluid->u_prev, fluid->v_prev);
+    fluid_advect(fluid, 2, fluid->v, fluid->v_prev, fluid->u_prev, fluid->v_prev);
+    perf_zone_end(&scope, cells * 2);
+
+    scope = perf_zone_begin("fluid project");
+    fluid_project(fluid, fluid->u, fluid->v, fluid->pressure, fluid->v_prev);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("fluid diffuse");
+    SWAP_FIELDS(fluid->density_prev, fluid->density);
+    fluid_diffuse(fluid, 0, fluid->density, fluid->density_prev, fluid->params.diffusion);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("fluid advect");
+    SWAP_FIELDS(fluid->density_prev, fluid->density);
+    fluid_advect(fluid, 0, fluid->density, fluid->density_prev, fluid->u, fluid->v);
+    perf_zone_end(&scope, cells);
+
+    // Slow fade so the jet doesn't saturate the closed box; the tunnel washes dye out instead
+    if (fluid->params.scenario != SCENARIO_WIND_TUNNEL) {
+        for (int i = 0; i < fluid->stride * (fluid->params.h + 2); i++) fluid->density[i] *= 0.99f;
+    }
+
+    fluid->step_count++;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void perf_open_thread_counters() {
+    t_perf.opened = true;
+    t_perf.leader_fd = -1;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) t_perf.group_slots[i] = -1;
+
+#ifdef __linux__
+    static const uint32_t types[PERF_COUNTER_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+    };
+    static const uint64_t configs[PERF_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+    };
+
+    // Counters the PMU doesn't support are skipped; the rest still form one group read
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.disabled = t_perf.leader_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, t_perf.leader_fd, 0);
+        if (fd == -1) {
+            if (i == PERF_CYCLES) break;
+            continue;
+        }
+
+        if (t_perf.leader_fd == -1) t_perf.leader_fd = fd;
+        t_perf.group_slots[i] = t_perf.group_size++;
+    }
+
+    if (t_perf.leader_fd != -1) {
+        ioctl(t_perf.leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(t_perf.leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        t_perf.available = true;
+    }
+#endif
+
+    static bool reported;
+    if (!t_perf.available && !__atomic_exchange_n(&reported, true, __ATOMIC_RELAXED)) {
+        trace_log("Hardware performance counters unavailable; perf zones report wall time only");
+    }
+}
+
+void perf_read_counters(uint64_t counts[PERF_COUNTER_COUNT]) {
+    memset(counts, 0, PERF_COUNTER_COUNT * sizeof(uint64_t));
+
+#ifdef __linux__
+    if (!t_perf.available) return;
+
+    uint64_t values[1 + PERF_COUNTER_COUNT];
+    ssize_t bytes = read(t_perf.leader_fd, values, sizeof(values));
+    if (bytes < (ssize_t)sizeof(uint64_t)) return;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (t_perf.group_slots[i] >= 0) counts[i] = values[1 + t_perf.group_slots[i]];
+    }
+#endif
+}
+
+Perf_Scope perf_zone_begin(const char *name) {
+    if (!t_perf.opened) perf_open_thread_counters();
+
+    Perf_Scope scope = {0};
+
+    uint32_t zone_count = __atomic_load_n(&g_perf_zone_count, __ATOMIC_ACQUIRE);
+    uint32_t i = 0;
+    while (i < zone_count && strcmp(g_perf_zones[i].name, name) != 0) i++;
+    if (i == zone_count) {
+        // New zones are only registered from the thread that calls parallel_for (the render
+        // thread, or the main thread in headless modes); workers never open zones
+        if (zone_count == MAX_PERF_ZONES) exit_with_error("Too many perf zones");
+        g_perf_zones[i].name = name;
+        __atomic_store_n(&g_perf_zone_count, zone_count + 1, __ATOMIC_RELEASE);
+    }
+    scope.zone = i;
+    scope.depth = t_perf.open_zone_count;
+    if (t_perf.open_zone_count < MAX_PERF_ZONE_DEPTH) t_perf.open_zones[t_perf.open_zone_count++] = i;
+
+    perf_read_counters(scope.start);
+    scope.start_ns = now_ns();
+    return scope;
+}
+
+void perf_zone_end(Perf_Scope *scope, uint64_t cells) {
+    uint64_t end_ns = now_ns();
+    uint64_t end[PERF_COUNTER_COUNT];
+    perf_read_counters(end);
+
+    Perf_Zone *zone = &g_perf_zones[scope->zone];
+    __atomic_fetch_add(&zone->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zone->cells, cells, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&zone->wall_ns, end_ns - scope->start_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        __atomic_fetch_add(&zone->counts[i], end[i] - scope->start[i], __ATOMIC_RELAXED);
+    }
+    t_perf.open_zone_count = scope->depth;
+}
+
+// A worker's counter deltas for one parallel_for, added to every zone the caller had open
+void perf_add_worker_counts(const uint32_t *zones, int zone_count, const uint64_t start[PERF_COUNTER_COUNT]) {
+    uint64_t end[PERF_COUNTER_COUNT];
+    perf_read_counters(end);
+    for (int z = 0; z < zone_count; z++) {
+        Perf_Zone *zone = &g_perf_zones[zones[z]];
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            __atomic_fetch_add(&zone->counts[i], end[i] - start[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void report_perf_zones() {
+    for (uint32_t i = 0; i < g_perf_zone_count; i++) {
+        Perf_Zone *zone = &g_perf_zones[i];
+        if (zone->calls == 0) continue;
+
+        double ms_per_call = zone->wall_ns / 1.0e6 / zone->calls;
+        if (t_perf.available) {
+            double cycles = (double)zone->counts[PERF_CYCLES];
+            double cells = zone->cells ? (double)zone->cells : 1.0;
+            trace_log("  CPU %-18s %8.3f ms  IPC %.2f  LLC miss/cell %.3f  br miss/cell %.3f  stalled %4.1f%%",
+                      zone->name, ms_per_call,
+                      cycles > 0 ? zone->counts[PERF_INSTRUCTIONS] / cycles : 0.0,
+                      zone->counts[PERF_LLC_MISSES] / cells,
+                      zone->counts[PERF_BRANCH_MISSES] / cells,
+                      cycles > 0 ? 100.0 * zone->counts[PERF_STALLED_CYCLES] / cycles : 0.0);
+        } else {
+            trace_log("  CPU %-18s %8.3f ms  %.2f ns/cell", zone->name, ms_per_call,
+                      zone->cells ? (double)zone->wall_ns / zone->cells : 0.0);
+        }
+    }
+}
+
+void reset_perf_zones() {
+    for (uint32_t i = 0; i < g_perf_zone_count; i++) {
+        Perf_Zone *zone = &g_perf_zones[i];
+        zone->calls = zone->cells = zone->wall_ns = 0;
+        memset(zone->counts, 0, sizeof(zone->counts));
+    }
+}
+
+uint64_t perf_zone_wall_ns(const char *name) {
+    for (uint32_t i = 0; i < g_perf_zone_count; i++) {
+        if (strcmp(g_perf_zones[i].name, name) == 0) return g_perf_zones[i].wall_ns;
+    }
+    return 0;
+}
+
+Roofline measure_roofline() {
+    Roofline roofline = {0};
+    roofline.bandwidth_gbs = measure_triad_bandwidth();
+    roofline.peak_gflops = measure_peak_gflops();
+    trace_log("Roofline: %.2f GB/s triad bandwidth, %.2f GFLOP/s single-core peak, ridge at %.2f flop/byte",
+              roofline.bandwidth_gbs, roofline.peak_gflops, roofline.peak_gflops / roofline.bandwidth_gbs);
+    return roofline;
+}
+
+// STREAM-style triad over arrays well past LLC size; best of several repeats
+double measure_triad_bandwidth() {
+    size_t bytes = TRIAD_ELEMENT_COUNT * sizeof(double);
+    double *a = xmalloc(bytes, "bench");
+    double *b = xmalloc(bytes, "bench");
+    double *c = xmalloc(bytes, "bench");
+    for (int i = 0; i < TRIAD_ELEMENT_COUNT; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    double best_ns = 1e30;
+    double scalar = 3.0;
+    for (int r = 0; r < TRIAD_REPEATS; r++) {
+        uint64_t start = now_ns();
+        for (int i = 0; i < TRIAD_ELEMENT_COUNT; i++) a[i] = b[i] + scalar * c[i];
+        double elapsed = (double)(now_ns() - start);
+        if (elapsed < best_ns) best_ns = elapsed;
+    }
+
+    volatile double sink = a[TRIAD_ELEMENT_COUNT / 2];
+    (void)sink;
+
+    xfree(a);
+    xfree(b);
+    xfree(c);
+
+    return 3.0 * bytes / best_ns;
+}
+
+// Independent multiply-add chains on 4-wide registers, enough of them to hide FP latency. This is
+// the roof for the widest code the build emits: SSE mul + add, or FMA when compiled for it.
+double measure_peak_gflops() {
+    enum { CHAINS = 12, ITERATIONS = 4 * 1024 * 1024 };
+#ifdef HAVE_SSE
+    __m128 acc[CHAINS];
+    for (int k = 0; k < CHAINS; k++) acc[k] = _mm_set1_ps((float)k * 0.001f);
+
+    __m128 mul = _mm_set1_ps(0.999999f), add = _mm_set1_ps(0.000001f);
+    uint64_t start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int k = 0; k < CHAINS; k++) {
+#ifdef __FMA__
+            acc[k] = _mm_fmadd_ps(acc[k], mul, add);
+#else
+            acc[k] = _mm_add_ps(_mm_mul_ps(acc[k], mul), add);
+#endif
+        }
+    }
+    double elapsed = (double)(now_ns() - start);
+
+    float lanes[4];
+    for (int k = 1; k < CHAINS; k++) acc[0] = _mm_add_ps(acc[0], acc[k]);
+    _mm_storeu_ps(lanes, acc[0]);
+    volatile float sink = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    (void)sink;
+
+    return 2.0 * 4.0 * CHAINS * (double)ITERATIONS / elapsed;
+#else
+    float acc[CHAINS];
+    for (int k = 0; k < CHAINS; k++) acc[k] = (float)k * 0.001f;
+
+    float mul = 0.999999f, add = 0.000001f;
+    uint64_t start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int k = 0; k < CHAINS; k++) acc[k] = acc[k] * mul + add;
+    }
+    double elapsed = (double)(now_ns() - start);
+
+    float sum = 0.0f;
+    for (int k = 0; k < CHAINS; k++) sum += acc[k];
+    volatile float sink = sum;
+    (void)sink;
+
+    return 2.0 * CHAINS * (double)ITERATIONS / elapsed;
+#endif
+}
+
+void register_hot_kernel(const char *zone, double bytes_per_cell, double flops_per_cell) {
+    for (uint32_t i = 0; i < g_hot_kernel_count; i++) {
+        if (strcmp(g_hot_kernels[i].zone, zone) == 0) {
+            g_hot_kernels[i].bytes_per_cell = bytes_per_cell;
+            g_hot_kernels[i].flops_per_cell = flops_per_cell;
+            return;
+        }
+    }
+
+    if (g_hot_kernel_count == MAX_HOT_KERNELS) exit_with_error("Too many hot kernels");
+    g_hot_kernels[g_hot_kernel_count++] = (Hot_Kernel){zone, bytes_per_cell, flops_per_cell};
+}
+
+void register_fluid_kernels(Fluid_Params params) {
+    double iterations = (double)params.iterations;
+    // With temporal blocking the relaxation streams the field once per pass of several sweeps
+    double passes = iterations;
+    if (params.temporal_depth > 1) passes /= params.solver == SOLVER_JACOBI ? params.temporal_depth : params.temporal_depth / 2.0;
+
+    // Per relaxation pass: stream x0 and x (read + write), 7 flops per sweep
+    register_hot_kernel("fluid diffuse", 12.0 * passes, 7.0 * iterations);
+    // Divergence (read u, v; write div, p), relaxation sweeps, gradient subtract (read p, rw u, v)
+    register_hot_kernel("fluid project", 16.0 + 12.0 * passes + 20.0, 6.0 + 7.0 * iterations + 8.0);
+    // Read u, v and the sampled field, write the result; backtrace + bilinear ~ 22 flops
+    register_hot_kernel("fluid advect", 16.0, 22.0);
+    // Read density, write one Cell
+    register_hot_kernel("render prep", 4.0 + sizeof(Cell), 10.0);
+}
+
+void report_kernel_efficiency(Roofline roofline) {
+    trace_log("Kernel efficiency vs roofline:");
+    trace_log("  %-16s %9s %9s %8s %10s %7s  %s", "kernel", "GB/s", "GFLOP/s", "AI", "roof", "eff", "bound");
+
+    for (uint32_t i = 0; i < g_hot_kernel_count; i++) {
+        Hot_Kernel *kernel = &g_hot_kernels[i];
+
+        Perf_Zone *zone = NULL;
+        for (uint32_t z = 0; z < g_perf_zone_count; z++) {
+            if (strcmp(g_perf_zones[z].name, kernel->zone) == 0) zone = &g_perf_zones[z];
+        }
+        if (zone == NULL || zone->wall_ns == 0) continue;
+
+        double gbs = kernel->bytes_per_cell * zone->cells / zone->wall_ns;
+        double gflops = kernel->flops_per_cell * zone->cells / zone->wall_ns;
+        double intensity = kernel->flops_per_cell / kernel->bytes_per_cell;
+        double roof = glm_min(roofline.peak_gflops, intensity * roofline.bandwidth_gbs);
+        bool memory_bound = intensity * roofline.bandwidth_gbs < roofline.peak_gflops;
+
+        trace_log("  %-16s %9.2f %9.2f %8.2f %10.2f %6.1f%%  %s",
+                  kernel->zone, gbs, gflops, intensity, roof, 100.0 * gflops / roof,
+                  memory_bound ? "memory" : "compute");
+    }
+}
+
+void run_bench() {
+    trace_log("Bench: calibrating roofline");
+#ifndef __OPTIMIZE__
+    trace_log("  Unoptimized build: peak and kernel rates are not representative (use make bench)");
+#endif
+    Roofline roofline = measure_roofline();
+
+    // Headless: only the CPU side of the pipeline, no window or GL context
+    Fluid fluid;
+    initialize_fluid(&fluid, default_fluid_params());
+    register_fluid_kernels(fluid.params);
+
+    Cell_Grid grid = {0};
+    grid.tile_dim = 1;
+    grid.view_count = 1;
+    reflow_cell_grid(&grid, 160, 90);
+
+    for (int i = 0; i < BENCH_WARMUP_STEPS; i++) step_fluid(&fluid);
+    reset_perf_zones();
+
+    trace_log("Bench: %d steps on a %dx%d fluid, %ux%u cells", BENCH_STEP_COUNT,
+              fluid.params.w, fluid.params.h, grid.cols, grid.rows);
+    uint64_t start = now_ns();
+    for (int i = 0; i < BENCH_STEP_COUNT; i++) {
+        step_fluid(&fluid);
+
+        Perf_Scope scope = perf_zone_begin("render prep");
+        fill_cells_from_fluid(&grid, &fluid);
+        perf_zone_end(&scope, grid.cols * grid.rows);
+    }
+    double elapsed_ms = (now_ns() - start) / 1.0e6;
+
+    trace_log("Bench: %.3f ms/step", elapsed_ms / BENCH_STEP_COUNT);
+    report_perf_zones();
+    report_kernel_efficiency(roofline);
+
+    destroy_fluid(&fluid);
+    destroy_cell_grid(&grid);
+}
+
+// Relaxation alone on a pressure-like system, plain sweeps against wavefront passes of increasing
+// depth. Effective bandwidth counts the 12 bytes per cell a plain sweep streams, so blocked runs
+// exceeding the triad figure are served from cache; the diff column checks they match exactly.
+void run_temporal_bench() {
+    static const int sizes[][2] = {{128, 96}, {512, 384}, {2048, 1536}};
+    static const int depths[] = {1, 2, 4, 8, 16};
+    enum { SOLVES = 5 };
+
+    double triad = measure_triad_bandwidth();
+    trace_log("Temporal blocking bench (triad %.2f GB/s, %d-row tiles):", triad, TEMPORAL_BLOCK_ROWS);
+    trace_log("  %-12s %10s %6s %10s %10s %10s %10s", "solver", "grid", "depth", "ms/solve", "eff GB/s", "speedup", "max diff");
+
+    for (int solver = 0; solver < SOLVER_COUNT; solver++) {
+        for (size_t g = 0; g < sizeof(sizes) / sizeof(sizes[0]); g++) {
+            Fluid_Params params = default_fluid_params();
+            params.w = sizes[g][0];
+            params.h = sizes[g][1];
+            params.solver = (Fluid_Solver)solver;
+            Fluid fluid;
+            initialize_fluid(&fluid, params);
+
+            size_t count = (size_t)fluid.stride * (params.h + 2);
+            float *rhs = fluid.u_prev, *reference = xcalloc(count * sizeof(float), "temporal bench");
+            uint32_t seed = 12345;
+            for (size_t k = 0; k < count; k++) rhs[k] = random_float(&seed) - 0.5f;
+
+            int sweeps = params.iterations * (solver == SOLVER_JACOBI ? 1 : 2);
+            double baseline_ms = 0.0;
+            for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+                fluid.params.temporal_depth = depths[d];
+                uint64_t start = now_ns();
+                for (int k = 0; k < SOLVES; k++) {
+                    memset(fluid.pressure, 0, count * sizeof(float));
+                    fluid_lin_solve(&fluid, 0, fluid.pressure, rhs, 1.0f, 4.0f);
+                }
+                double ms = (now_ns() - start) / 1.0e6 / SOLVES;
+
+                float diff = 0.0f;
+                if (d == 0) {
+                    memcpy(reference, fluid.pressure, count * sizeof(float));
+                    baseline_ms = ms;
+                }
+                for (size_t k = 0; k < count; k++) diff = glm_max(diff, fabsf(fluid.pressure[k] - reference[k]));
+
+                double bytes = 12.0 * params.w * params.h * sweeps;
+                trace_log("  %-12s %4dx%-5d %6d %10.3f %10.2f %9.2fx %10.2g", g_solver_names[solver], params.w, params.h,
+                          depths[d], ms, bytes / (ms * 1.0e6), baseline_ms / ms, diff);
+            }
+
+            xfree(reference);
+            destroy_fluid(&fluid);
+        }
+    }
+}
+
+int cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) return 1;
+    return count > MAX_THREADS ? MAX_THREADS : (int)count;
+}
+
+// Decaying velocity and pressure fields drift into denormals, which cost ~100x per op on x86
+// and made the large 3D grids several times slower. The MXCSR state is per thread.
+void enable_flush_to_zero() {
+#ifdef HAVE_SSE
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#endif
+}
+
+void initialize_thread_pool(int worker_count) {
+    if (worker_count < 0) worker_count = 0;
+    if (worker_count > MAX_THREADS - 1) worker_count = MAX_THREADS - 1;
+
+    pthread_mutex_init(&g_thread_pool.mutex, NULL);
+    pthread_cond_init(&g_thread_pool.work_cond, NULL);
+    pthread_cond_init(&g_thread_pool.done_cond, NULL);
+
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&g_thread_pool.workers[i], NULL, thread_pool_worker, (void *)(intptr_t)i) != 0) {
+            exit_with_error("Failed to create worker thread %d", i);
+        }
+    }
+    g_thread_pool.worker_count = worker_count;
+
+    trace_log("Thread pool: %d workers + main thread", worker_count);
+}
+
+void destroy_thread_pool() {
+    pthread_mutex_lock(&g_thread_pool.mutex);
+    g_thread_pool.shutdown = true;
+    pthread_cond_broadcast(&g_thread_pool.work_cond);
+    pthread_mutex_unlock(&g_thread_pool.mutex);
+
+    for (int i = 0; i < g_thread_pool.worker_count; i++) pthread_join(g_thread_pool.workers[i], NULL);
+    g_thread_pool.worker_count = 0;
+}
+
+void *thread_pool_worker(void *arg) {
+    int index = (int)(intptr_t)arg;
+    uint64_t seen_generation = 0;
+
+    enable_flush_to_zero();
+
+    pthread_mutex_lock(&g_thread_pool.mutex);
+    for (;;) {
+        while (!g_thread_pool.shutdown && g_thread_pool.generation == seen_generation) {
+            pthread_cond_wait(&g_thread_pool.work_cond, &g_thread_pool.mutex);
+        }
+        if (g_thread_pool.shutdown) break;
+
+        seen_generation = g_thread_pool.generation;
+        if (index >= g_thread_pool.participants) continue;
+
+        uint32_t zones[MAX_PERF_ZONE_DEPTH];
+        int zone_count = g_thread_pool.perf_zone_count;
+        memcpy(zones, g_thread_pool.perf_zones, zone_count * sizeof(uint32_t));
+        pthread_mutex_unlock(&g_thread_pool.mutex);
+
+        uint64_t start[PERF_COUNTER_COUNT] = {0};
+        if (zone_count > 0) {
+            if (!t_perf.opened) perf_open_thread_counters();
+            perf_read_counters(start);
+        }
+        thread_pool_run_chunks();
+        if (zone_count > 0) perf_add_worker_counts(zones, zone_count, start);
+
+        pthread_mutex_lock(&g_thread_pool.mutex);
+
+        if (--g_thread_pool.remaining == 0) pthread_cond_signal(&g_thread_pool.done_cond);
+    }
+    pthread_mutex_unlock(&g_thread_pool.mutex);
+
+    return NULL;
+}
+
+void thread_pool_run_chunks() {
+    int grain = g_thread_pool.grain;
+    int end = g_thread_pool.end;
+    for (;;) {
+        int begin = __atomic_fetch_add(&g_thread_pool.next, grain, __ATOMIC_RELAXED);
+        if (begin >= end) break;
+        g_thread_pool.fn(g_thread_pool.ctx, begin, begin + grain < end ? begin + grain : end);
+    }
+}
+
+// Only called from one thread (the render thread in interactive runs); jobs don't nest
+void parallel_for(int begin, int end, Kernel_Tuning tuning, Parallel_Fn *fn, void *ctx) {
+    int grain = tuning.grain > 0 ? tuning.grain : 1;
+    int chunk_count = (end - begin + grain - 1) / grain;
+    int helpers = tuning.threads - 1;
+    if (helpers > g_thread_pool.worker_count) helpers = g_thread_pool.worker_count;
+    if (helpers > chunk_count - 1) helpers = chunk_count - 1;
+
+    if (helpers <= 0) {
+        if (begin < end) fn(ctx, begin, end);
+        return;
+    }
+
+    pthread_mutex_lock(&g_thread_pool.mutex);
+    g_thread_pool.fn = fn;
+    g_thread_pool.ctx = ctx;
+    g_thread_pool.next = begin;
+    g_thread_pool.end = end;
+    g_thread_pool.grain = grain;
+    g_thread_pool.participants = helpers;
+    g_thread_pool.remaining = helpers;
+    g_thread_pool.perf_zone_count = t_perf.open_zone_count;
+    memcpy(g_thread_pool.perf_zones, t_perf.open_zones, t_perf.open_zone_count * sizeof(uint32_t));
+    g_thread_pool.generation++;
+    pthread_cond_broadcast(&g_thread_pool.work_cond);
+    pthread_mutex_unlock(&g_thread_pool.mutex);
+
+    thread_pool_run_chunks();
+
+    pthread_mutex_lock(&g_thread_pool.mutex);
+    while (g_thread_pool.remaining > 0) pthread_cond_wait(&g_thread_pool.done_cond, &g_thread_pool.mutex);
+    pthread_mutex_unlock(&g_thread_pool.mutex);
+}
+
+void default_tuning() {
+    int threads = g_thread_pool.worker_count + 1;
+    for (int k = 0; k < TUNED_KERNEL_COUNT; k++) {
+        g_tuning[k] = (Kernel_Tuning){threads, 4, 0};
+    }
+}
+
+// One cache file per host, since the fleet is heterogeneous and home dirs may be shared
+void tuning_cache_path(char *out, size_t size) {
+    char host[128] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    const char *cache_dir = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (cache_dir && cache_dir[0]) snprintf(out, size, "%s/ascii-fluid-tuning-%s.txt", cache_dir, host);
+    else if (home && home[0]) {
+        snprintf(out, size, "%s/.cache", home);
+        mkdir(out, 0755);
+        snprintf(out, size, "%s/.cache/ascii-fluid-tuning-%s.txt", home, host);
+    }
+    else snprintf(out, size, "ascii-fluid-tuning-%s.txt", host);
+}
+
+int load_tuning_entries(Tuning_Entry *entries, int max_entries) {
+    char path[512];
+    tuning_cache_path(path, sizeof(path));
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+
+    int count = 0;
+    char line[256];
+    while (count < max_entries && fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') continue;
+        Tuning_Entry *e = &entries[count];
+        if (sscanf(line, "%31s %d %d %d %d %d", e->kernel, &e->fluid_w, &e->fluid_h,
+                   &e->tuning.threads, &e->tuning.grain, &e->tuning.tile_cols) == 6) {
+            count++;
+        }
+    }
+    fclose(file);
+
+    return count;
+}
+
+void load_tuning(Fluid_Params params) {
+    default_tuning();
+
+    Tuning_Entry entries[MAX_TUNING_ENTRIES];
+    int count = load_tuning_entries(entries, MAX_TUNING_ENTRIES);
+
+    int loaded = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].fluid_w != params.w || entries[i].fluid_h != params.h) continue;
+        for (int k = 0; k < TUNED_KERNEL_COUNT; k++) {
+            if (strcmp(entries[i].kernel, g_tuned_kernel_names[k]) == 0) {
+                g_tuning[k] = entries[i].tuning;
+                loaded++;
+            }
+        }
+    }
+
+    if (loaded > 0) trace_log("Loaded %d tuned kernel configs for %dx%d", loaded, params.w, params.h);
+}
+
+void save_tuning(Fluid_Params params) {
+    Tuning_Entry entries[MAX_TUNING_ENTRIES];
+    int count = load_tuning_entries(entries, MAX_TUNING_ENTRIES);
+
+    for (int k = 0; k < TUNED_KERNEL_COUNT; k++) {
+        int i = 0;
+        while (i < count && !(entries[i].fluid_w == params.w && entries[i].fluid_h == params.h &&
+                              strcmp(entries[i].kernel, g_tuned_kernel_names[k]) == 0)) i++;
+        if (i == count) {
+            if (count == MAX_TUNING_ENTRIES) break;
+            count++;
+        }
+        snprintf(entries[i].kernel, sizeof(entries[i].kernel), "%s", g_tuned_kernel_names[k]);
+        entries[i].fluid_w = params.w;
+        entries[i].fluid_h = params.h;
+        entries[i].tuning = g_tuning[k];
+    }
+
+    char path[512];
+    tuning_cache_path(path, sizeof(path));
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        trace_log("Failed to write tuning cache %s", path);
+        return;
+    }
+    fprintf(file, "# kernel fluid_w fluid_h threads grain tile_cols\n");
+    for (int i = 0; i < count; i++) {
+        Tuning_Entry *e = &entries[i];
+        fprintf(file, "%s %d %d %d %d %d\n", e->kernel, e->fluid_w, e->fluid_h,
+                e->tuning.threads, e->tuning.grain, e->tuning.tile_cols);
+    }
+    fclose(file);
+
+    trace_log("Saved tuning cache to %s", path);
+}
+
+// Best-of-N wall time of one invocation of the kernel with the current g_tuning
+double time_tuned_kernel(Tuned_Kernel kernel, Fluid *fluid, Cell_Grid *grid) {
+    enum { REPEATS = 7 };
+    double best_ns = 1e30;
+
+    for (int r = 0; r < REPEATS; r++) {
+        uint64_t start = now_ns();
+        switch (kernel) {
+            case TUNE_STENCIL:
+                fluid_diffuse(fluid, 0, fluid->density_prev, fluid->density, fluid->params.diffusion);
+                break;
+            case TUNE_ADVECT:
+                fluid_advect(fluid, 0, fluid->density_prev, fluid->density, fluid->u, fluid->v);
+                break;
+            case TUNE_RENDER_PREP:
+                fill_cells_from_fluid(grid, fluid);
+                break;
+            default:
+                break;
+        }
+        double elapsed = (double)(now_ns() - start);
+        if (elapsed < best_ns) best_ns = elapsed;
+    }
+
+    return best_ns;
+}
+
+// Coordinate descent over threads, grain and column tile size per kernel
+void run_autotune() {
+    Fluid_Params params = default_fluid_params();
+    int max_threads = g_thread_pool.worker_count + 1;
+
+    trace_log("Autotune: %dx%d fluid, up to %d threads", params.w, params.h, max_threads);
+
+    Fluid fluid;
+    initialize_fluid(&fluid, params);
+    for (int i = 0; i < BENCH_WARMUP_STEPS; i++) step_fluid(&fluid);
+
+    Cell_Grid grid = {0};
+    grid.tile_dim = 1;
+    grid.view_count = 1;
+    reflow_cell_grid(&grid, params.w, params.h);
+
+    int thread_candidates[16], thread_candidate_count = 0;
+    for (int t = 1; t < max_threads && thread_candidate_count < 15; t *= 2) thread_candidates[thread_candidate_count++] = t;
+    thread_candidates[thread_candidate_count++] = max_threads;
+
+    static const int grain_candidates[] = {1, 2, 4, 8, 16, 32};
+    int tile_candidates[] = {16, 32, 64, 128, 0};
+
+    for (int k = 0; k < TUNED_KERNEL_COUNT; k++) {
+        Kernel_Tuning *tuning = &g_tuning[k];
+        *tuning = (Kernel_Tuning){max_threads, 4, 0};
+        double best = time_tuned_kernel(k, &fluid, &grid);
+
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 0; i < thread_candidate_count; i++) {
+                Kernel_Tuning prev = *tuning;
+                tuning->threads = thread_candidates[i];
+                double t = time_tuned_kernel(k, &fluid, &grid);
+                if (t < best) best = t;
+                else *tuning = prev;
+            }
+            for (size_t i = 0; i < sizeof(grain_candidates) / sizeof(grain_candidates[0]); i++) {
+                Kernel_Tuning prev = *tuning;
+                tuning->grain = grain_candidates[i];
+                double t = time_tuned_kernel(k, &fluid, &grid);
+                if (t < best) best = t;
+                else *tuning = prev;
+            }
+            // Column tiling only applies to the stencil sweeps
+            if (k != TUNE_STENCIL) continue;
+            for (size_t i = 0; i < sizeof(tile_candidates) / sizeof(tile_candidates[0]); i++) {
+                Kernel_Tuning prev = *tuning;
+                tuning->tile_cols = tile_candidates[i];
+                double t = time_tuned_kernel(k, &fluid, &grid);
+                if (t < best) best = t;
+                else *tuning = prev;
+            }
+        }
+
+        trace_log("  %-12s threads %2d  grain %2d  tile %3d  -> %.3f ms",
+                  g_tuned_kernel_names[k], tuning->threads, tuning->grain, tuning->tile_cols, best / 1.0e6);
+    }
+
+    save_tuning(params);
+
+    destroy_fluid(&fluid);
+    destroy_cell_grid(&grid);
+}
+
+bool parse_sweep_spec(const char *path, Sweep_Spec *spec) {
+    *spec = (Sweep_Spec){0};
+    spec->steps = 500;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return false;
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *key = strtok(line, " \t\r\n");
+        if (key == NULL || key[0] == '#') continue;
+
+        for (char *value = strtok(NULL, " \t\r\n"); value; value = strtok(NULL, " \t\r\n")) {
+            if (strcmp(key, "viscosity") == 0 && spec->viscosity_count < MAX_SWEEP_VALUES) {
+                spec->viscosities[spec->viscosity_count++] = strtof(value, NULL);
+            } else if (strcmp(key, "grid") == 0 && spec->grid_count < MAX_SWEEP_VALUES) {
+                int w, h;
+                if (sscanf(value, "%dx%d", &w, &h) != 2 || w < 4 || h < 4) {
+                    exit_with_error("Bad grid size '%s' in %s", value, path);
+                }
+                spec->grid_ws[spec->grid_count] = w;
+                spec->grid_hs[spec->grid_count++] = h;
+            } else if (strcmp(key, "solver") == 0 && spec->solver_count < MAX_SWEEP_VALUES) {
+                int solver = 0;
+                while (solver < SOLVER_COUNT && strcmp(value, g_solver_names[solver]) != 0) solver++;
+                if (solver == SOLVER_COUNT) exit_with_error("Unknown solver '%s' in %s", value, path);
+                spec->solvers[spec->solver_count++] = (Fluid_Solver)solver;
+            } else if (strcmp(key, "inflow") == 0 && spec->inflow_count < MAX_SWEEP_VALUES) {
+                spec->inflow_speeds[spec->inflow_count++] = strtof(value, NULL);
+            } else if (strcmp(key, "steps") == 0) {
+                spec->steps = atoi(value);
+            } else {
+                exit_with_error("Unknown or overfull sweep key '%s' in %s", key, path);
+            }
+        }
+    }
+    fclose(file);
+
+    // Unspecified axes sweep just the default
+    Fluid_Params defaults = default_fluid_params();
+    if (spec->viscosity_count == 0) spec->viscosities[spec->viscosity_count++] = defaults.viscosity;
+    if (spec->grid_count == 0) {
+        spec->grid_ws[0] = defaults.w;
+        spec->grid_hs[0] = defaults.h;
+        spec->grid_count = 1;
+    }
+    if (spec->solver_count == 0) spec->solvers[spec->solver_count++] = defaults.solver;
+    if (spec->inflow_count == 0) spec->inflow_speeds[spec->inflow_count++] = defaults.inflow_speed;
+
+    return true;
+}
+
+int sweep_case_count(Sweep_Spec *spec) {
+    return spec->viscosity_count * spec->grid_count * spec->solver_count * spec->inflow_count;
+}
+
+Fluid_Params sweep_case_params(Sweep_Spec *spec, int case_index) {
+    Fluid_Params params = default_fluid_params();
+
+    int i = case_index;
+    params.inflow_speed = spec->inflow_speeds[i % spec->inflow_count];
+    i /= spec->inflow_count;
+    params.solver = spec->solvers[i % spec->solver_count];
+    i /= spec->solver_count;
+    params.w = spec->grid_ws[i % spec->grid_count];
+    params.h = spec->grid_hs[i % spec->grid_count];
+    i /= spec->grid_count;
+    params.viscosity = spec->viscosities[i % spec->viscosity_count];
+
+    return params;
+}
+
+void write_fluid_snapshot(FILE *file, Fluid *fluid) {
+    static const char ramp[] = " .:-=+*#%@";
+    enum { RAMP_LAST = sizeof(ramp) - 2 };
+
+    int w = fluid->params.w, h = fluid->params.h;
+    int cols = w < SNAPSHOT_MAX_COLS ? w : SNAPSHOT_MAX_COLS;
+    // Terminal cells are about twice as tall as wide
+    int rows = (int)((float)h * cols / w * 0.5f);
+    if (rows < 1) rows = 1;
+
+    for (int y = 0; y < rows; y++) {
+        int fy = 1 + y * h / rows;
+        for (int x = 0; x < cols; x++) {
+            int fx = 1 + x * w / cols;
+            float d = glm_clamp(fluid->density[fx + fy * fluid->stride], 0.0f, 1.0f);
+            fputc(ramp[(int)(d * RAMP_LAST + 0.5f)], file);
+        }
+        fputc('\n', file);
+    }
+}
+
+// Runs in a worker process. Results are written to temp files and renamed into place, so a
+// case only counts as done once both its snapshot and metrics exist.
+void run_batch_case(Sweep_Spec *spec, int case_index, const char *out_dir) {
+    Fluid_Params params = sweep_case_params(spec, case_index);
+
+    Fluid fluid;
+    initialize_fluid(&fluid, params);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < spec->steps; i++) step_fluid(&fluid);
+    double ms_per_step = (now_ns() - start) / 1.0e6 / (spec->steps > 0 ? spec->steps : 1);
+
+    double total_density = 0.0;
+    float max_speed = 0.0f;
+    int s = fluid.stride;
+    for (int j = 1; j <= params.h; j++) {
+        for (int i = 1; i <= params.w; i++) {
+            int idx = i + j * s;
+            total_density += fluid.density[idx];
+            float speed = sqrtf(fluid.u[idx] * fluid.u[idx] + fluid.v[idx] * fluid.v[idx]);
+            if (speed > max_speed) max_speed = speed;
+        }
+    }
+    float divergence = fluid_divergence_norm(&fluid);
+
+    char path[1024], tmp_path[sizeof(path) + 8];
+
+    snprintf(path, sizeof(path), "%s/case_%04d.txt", out_dir, case_index);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) exit_with_error("Failed to write %s", tmp_path);
+    write_fluid_snapshot(file, &fluid);
+    fclose(file);
+    rename(tmp_path, path);
+
+    snprintf(path, sizeof(path), "%s/case_%04d.metrics", out_dir, case_index);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    file = fopen(tmp_path, "w");
+    if (file == NULL) exit_with_error("Failed to write %s", tmp_path);
+    fprintf(file, "%d,%g,%dx%d,%s,%g,%d,%.4f,%.6g,%.6g,%.6g\n",
+            case_index, params.viscosity, params.w, params.h, g_solver_names[params.solver], params.inflow_speed,
+            spec->steps, ms_per_step, total_density, max_speed, divergence);
+    fclose(file);
+    rename(tmp_path, path);
+
+    destroy_fluid(&fluid);
+}
+
+void run_batch(const char *spec_path, const char *out_dir) {
+    Sweep_Spec spec;
+    if (!parse_sweep_spec(spec_path, &spec)) exit_with_error("Failed to read sweep spec %s", spec_path);
+
+    int case_count = sweep_case_count(&spec);
+    if (case_count > MAX_SWEEP_CASES) exit_with_error("Sweep has %d cases (max %d)", case_count, MAX_SWEEP_CASES);
+
+    mkdir(out_dir, 0755);
+
+    int pool_size = cpu_count();
+    trace_log("Batch: %d cases, %d steps each, %d worker processes -> %s", case_count, spec.steps, pool_size, out_dir);
+
+    int running = 0, launched = 0, skipped = 0, failed = 0;
+    for (int c = 0; c < case_count || running > 0;) {
+        if (c < case_count && running < pool_size) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/case_%04d.metrics", out_dir, c);
+            if (access(path, F_OK) == 0) {
+                skipped++;
+                c++;
+                continue;
+            }
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid < 0) exit_with_error("fork failed");
+            if (pid == 0) {
+                run_batch_case(&spec, c, out_dir);
+                fflush(stdout);
+                _exit(0);
+            }
+
+            running++;
+            launched++;
+            c++;
+            continue;
+        }
+
+        int status = 0;
+        if (wait(&status) > 0) {
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+        }
+    }
+
+    // Collect every finished case (including ones from earlier runs) into one table
+    char summary_path[1024];
+    snprintf(summary_path, sizeof(summary_path), "%s/summary.csv", out_dir);
+    FILE *summary = fopen(summary_path, "w");
+    if (summary == NULL) exit_with_error("Failed to write %s", summary_path);
+    fprintf(summary, "case,viscosity,grid,solver,inflow,steps,ms_per_step,total_density,max_speed,divergence_rms\n");
+    for (int c = 0; c < case_count; c++) {
+        char path[1024], line[512];
+        snprintf(path, sizeof(path), "%s/case_%04d.metrics", out_dir, c);
+        FILE *metrics = fopen(path, "r");
+        if (metrics == NULL) continue;
+        if (fgets(line, sizeof(line), metrics)) fputs(line, summary);
+        fclose(metrics);
+    }
+    fclose(summary);
+
+    trace_log("Batch: ran %d, resumed past %d, %d failed; summary in %s", launched, skipped, failed, summary_path);
+}
+
+Fluid_Params wind_tunnel_params() {
+    Fluid_Params params = default_fluid_params();
+    params.scenario = SCENARIO_WIND_TUNNEL;
+    params.w = TUNNEL_WIDTH;
+    params.h = TUNNEL_HEIGHT;
+    // Free stream of ~0.6 cells per step keeps advection well inside CFL
+    params.inflow_speed = 0.04f;
+    params.viscosity = 0.00001f;
+    params.diffusion = 0.0f;
+    return params;
+}
+
+void start_scenario(Fluid_Scenario scenario) {
+    destroy_wind_tunnel(&g_tunnel);
+    destroy_body_world(&g_bodies);
+    if (g_fluid.u) destroy_fluid(&g_fluid);
+
+    Fluid_Params params = default_fluid_params();
+    if (scenario == SCENARIO_WIND_TUNNEL) params = wind_tunnel_params();
+    if (scenario == SCENARIO_MULTIPHASE) params = multiphase_fluid_params();
+    params.scenario = scenario;
+    params.temporal_depth = g_temporal_depth;
+
+    initialize_fluid(&g_fluid, params);
+    register_fluid_kernels(g_fluid.params);
+
+    if (scenario == SCENARIO_WIND_TUNNEL) initialize_wind_tunnel(&g_tunnel, &g_fluid, NULL);
+    if (scenario == SCENARIO_BODIES) initialize_body_world(&g_bodies, &g_fluid, g_body_count);
+    trace_log("Scenario: %s (%dx%d)", g_scenario_names[scenario], g_fluid.params.w, g_fluid.params.h);
+}
+
+void initialize_wind_tunnel(Wind_Tunnel *tunnel, Fluid *fluid, const char *log_path) {
+    FILE *log_file = tunnel->log_file;
+    *tunnel = (Wind_Tunnel){0};
+    tunnel->enabled = true;
+    tunnel->log_file = log_path ? fopen(log_path, "w") : log_file;
+
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float n = (float)glm_max(w, h);
+
+    // Obstacle extent across the flow, in domain units (cell size 1 / n)
+    int min_j = h + 1, max_j = 0;
+    for (int k = 0; k < fluid->solid_cell_count; k++) {
+        int j = fluid->solid_cells[k] / s;
+        if (j < min_j) min_j = j;
+        if (j > max_j) max_j = j;
+    }
+    tunnel->diameter = (max_j - min_j + 1) / n;
+
+    // One entry per fluid-solid face; normal points from the body into the fluid
+    int max_faces = fluid->solid_cell_count * 4;
+    tunnel->face_cells = xmalloc(max_faces * sizeof(int), "wind tunnel");
+    tunnel->face_nx = xmalloc(max_faces * sizeof(float), "wind tunnel");
+    tunnel->face_ny = xmalloc(max_faces * sizeof(float), "wind tunnel");
+
+    static const int offsets_x[4] = {-1, 1, 0, 0};
+    static const int offsets_y[4] = {0, 0, -1, 1};
+    for (int k = 0; k < fluid->solid_cell_count; k++) {
+        int idx = fluid->solid_cells[k];
+        for (int d = 0; d < 4; d++) {
+            int neighbour = idx + offsets_x[d] + offsets_y[d] * s;
+            if (fluid->solid[neighbour]) continue;
+            tunnel->face_cells[tunnel->face_count] = neighbour;
+            tunnel->face_nx[tunnel->face_count] = (float)offsets_x[d];
+            tunnel->face_ny[tunnel->face_count] = (float)offsets_y[d];
+            tunnel->face_count++;
+        }
+    }
+
+    if (tunnel->log_file) {
+        tunnel->log_buffer = xmalloc(TUNNEL_LOG_BUFFER_SIZE, "wind tunnel");
+        fprintf(tunnel->log_file, "step,time,cd,cl\n");
+    }
+
+    trace_log("Wind tunnel: D = %.4f, Re = %.0f, %d boundary faces",
+              tunnel->diameter, fluid->params.inflow_speed * tunnel->diameter / fluid->params.viscosity, tunnel->face_count);
+}
+
+void destroy_wind_tunnel(Wind_Tunnel *tunnel) {
+    if (!tunnel->enabled) return;
+
+    flush_wind_tunnel_log(tunnel);
+    xfree(tunnel->face_cells);
+    xfree(tunnel->face_nx);
+    xfree(tunnel->face_ny);
+    xfree(tunnel->log_buffer);
+
+    FILE *log_file = tunnel->log_file;
+    *tunnel = (Wind_Tunnel){0};
+    tunnel->log_file = log_file;
+}
+
+void update_wind_tunnel(Wind_Tunnel *tunnel, Fluid *fluid) {
+    Perf_Scope scope = perf_zone_begin("tunnel forces");
+
+    int w = fluid->params.w, h = fluid->params.h;
+    float n = (float)glm_max(w, h);
+    float dx = 1.0f / n;
+    float dt = fluid->params.dt;
+    // The projection solves for p * dt / rho in these units (rho = 1)
+    float pressure_scale = 1.0f / dt;
+    // Wall shear: nu * u_t / (dx / 2), integrated over a face of length dx
+    float shear_scale = 2.0f * fluid->params.viscosity;
+
+    float fx = 0.0f, fy = 0.0f;
+    int *cells = tunnel->face_cells;
+    float *nx = tunnel->face_nx, *ny = tunnel->face_ny;
+    float *p = fluid->pressure, *u = fluid->u, *v = fluid->v;
+    for (int f = 0; f < tunnel->face_count; f++) {
+        float pf = p[cells[f]] * pressure_scale;
+        fx += -pf * nx[f] * dx + shear_scale * u[cells[f]] * fabsf(ny[f]);
+        fy += -pf * ny[f] * dx + shear_scale * v[cells[f]] * fabsf(nx[f]);
+    }
+
+    float speed = fluid->params.inflow_speed;
+    float dynamic = 0.5f * speed * speed * tunnel->diameter;
+    tunnel->drag_coefficient = fx / dynamic;
+    // Grid y points down, lift is conventionally up
+    tunnel->lift_coefficient = -fy / dynamic;
+    tunnel->time += dt;
+
+    // Strouhal from upward crossings of the lift through its running mean
+    tunnel->lift_mean += (tunnel->lift_coefficient - tunnel->lift_mean) * 0.01f;
+    bool above = tunnel->lift_coefficient > tunnel->lift_mean;
+    if (above && !tunnel->lift_above_mean) {
+        if (tunnel->last_crossing_time > 0.0) {
+            tunnel->period_sum += tunnel->time - tunnel->last_crossing_time;
+            tunnel->period_count++;
+            double period = tunnel->period_sum / tunnel->period_count;
+            tunnel->strouhal = (float)(tunnel->diameter / (period * speed));
+        }
+        tunnel->last_crossing_time = tunnel->time;
+    }
+    tunnel->lift_above_mean = above;
+
+    // Buffered CSV, written out in large blocks
+    if (tunnel->log_buffer) {
+        if (tunnel->log_used > TUNNEL_LOG_BUFFER_SIZE - 128) flush_wind_tunnel_log(tunnel);
+        tunnel->log_used += snprintf(tunnel->log_buffer + tunnel->log_used, TUNNEL_LOG_BUFFER_SIZE - tunnel->log_used,
+                                     "%llu,%.4f,%.5f,%.5f\n", (unsigned long long)fluid->step_count, tunnel->time,
+                                     tunnel->drag_coefficient, tunnel->lift_coefficient);
+    }
+
+    perf_zone_end(&scope, tunnel->face_count);
+}
+
+void flush_wind_tunnel_log(Wind_Tunnel *tunnel) {
+    if (tunnel->log_file == NULL || tunnel->log_used == 0) return;
+    fwrite(tunnel->log_buffer, 1, tunnel->log_used, tunnel->log_file);
+    fflush(tunnel->log_file);
+    tunnel->log_used = 0;
+}
+
+void write_wind_tunnel_overlay(Wind_Tunnel *tunnel, Fluid *fluid, Cell_Grid *grid) {
+    char text[128];
+    float reynolds = fluid->params.inflow_speed * tunnel->diameter / fluid->params.viscosity;
+    snprintf(text, sizeof(text), " Re %.0f  Cd %6.3f  Cl %6.3f  St %5.3f  t %.1f ",
+             reynolds, tunnel->drag_coefficient, tunnel->lift_coefficient, tunnel->strouhal, tunnel->time);
+    write_cells_text(grid, 0, 0, text, PALETTE_TEXT);
+}
+
+void write_cells_text(Cell_Grid *grid, uint32_t x, uint32_t y, const char *text, uint8_t color) {
+    if (y >= grid->rows * grid->view_count) return;
+    for (; *text && x < grid->cols; text++, x++) {
+        Cell *cell = &grid->cells[x + y * grid->cols];
+        cell->glyph = (uint8_t)*text;
+        cell->color = color;
+    }
+}
+
+size_t smoke_memory_bytes(int n) {
+    size_t cells = (size_t)(n + 2) * (n + 2) * (n + 2);
+    return 8 * cells * sizeof(float) + (size_t)(n + 2) * (n + 2) * sizeof(float);
+}
+
+void initialize_smoke(Smoke_3D *smoke, int n) {
+    *smoke = (Smoke_3D){0};
+    smoke->n = n;
+    smoke->stride_y = n + 2;
+    smoke->stride_z = (n + 2) * (n + 2);
+    smoke->iterations = 20;
+    smoke->dt = 0.1f;
+    smoke->buoyancy = 0.02f;
+
+    size_t bytes = (size_t)smoke->stride_z * (n + 2) * sizeof(float);
+    smoke->u = xcalloc(bytes, "smoke 3d");
+    smoke->v = xcalloc(bytes, "smoke 3d");
+    smoke->w = xcalloc(bytes, "smoke 3d");
+    smoke->u_prev = xcalloc(bytes, "smoke 3d");
+    smoke->v_prev = xcalloc(bytes, "smoke 3d");
+    smoke->w_prev = xcalloc(bytes, "smoke 3d");
+    smoke->density = xcalloc(bytes, "smoke 3d");
+    smoke->density_prev = xcalloc(bytes, "smoke 3d");
+}
+
+void destroy_smoke(Smoke_3D *smoke) {
+    xfree(smoke->u);
+    xfree(smoke->v);
+    xfree(smoke->w);
+    xfree(smoke->u_prev);
+    xfree(smoke->v_prev);
+    xfree(smoke->w_prev);
+    xfree(smoke->density);
+    xfree(smoke->density_prev);
+    *smoke = (Smoke_3D){0};
+}
+
+void toggle_smoke(int n) {
+    if (g_smoke.u) {
+        destroy_smoke(&g_smoke);
+        xfree(g_smoke_view.image);
+        g_smoke_view = (Smoke_View){0};
+        trace_log("3D smoke disabled");
+        return;
+    }
+    if (n <= 0) return;
+    // The emitter writes rows n - 3 .. n - 1 around the centre, so tiny grids would underflow
+    n = glm_clamp(n, 8, SMOKE_MAX_SIZE);
+
+    initialize_smoke(&g_smoke, n);
+    g_smoke_view = (Smoke_View){0};
+    g_smoke_view.axis = 2;
+    g_smoke_view.slice = n / 2;
+    g_smoke_view.image = xcalloc((size_t)(n + 2) * (n + 2) * sizeof(float), "smoke 3d");
+    trace_log("3D smoke: %d^3, %.1f MB", n, smoke_memory_bytes(n) / (double)ONE_MB);
+}
+
+// Closed box: each velocity component mirrors at the walls it is normal to. Edges and
+// corners aren't touched by the 7-point stencils so only faces are set.
+void smoke_set_boundary(Smoke_3D *smoke, int b, float *x) {
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+
+    for (int k = 1; k <= n; k++) {
+        for (int j = 1; j <= n; j++) {
+            int row = j * sy + k * sz;
+            x[0 + row]     = b == 1 ? -x[1 + row] : x[1 + row];
+            x[n + 1 + row] = b == 1 ? -x[n + row] : x[n + row];
+        }
+        for (int i = 1; i <= n; i++) {
+            int col = i + k * sz;
+            x[col + 0 * sy]       = b == 2 ? -x[col + 1 * sy] : x[col + 1 * sy];
+            x[col + (n + 1) * sy] = b == 2 ? -x[col + n * sy] : x[col + n * sy];
+        }
+    }
+    for (int j = 1; j <= n; j++) {
+        for (int i = 1; i <= n; i++) {
+            int col = i + j * sy;
+            x[col + 0 * sz]       = b == 3 ? -x[col + 1 * sz] : x[col + 1 * sz];
+            x[col + (n + 1) * sz] = b == 3 ? -x[col + n * sz] : x[col + n * sz];
+        }
+    }
+}
+
+typedef struct Smoke_Solve_Job {
+    Smoke_3D *smoke;
+    float *x, *x0;
+    float a, inv_c;
+    int color;
+} Smoke_Solve_Job;
+
+// Red-black Gauss-Seidel, z-slabs in parallel. Within a slab the sweep walks blocks of
+// SMOKE_BLOCK_ROWS rows through every plane, so the three planes the stencil touches stay in
+// cache instead of streaming whole (n + 2)^2 planes.
+void smoke_lin_solve(Smoke_3D *smoke, int b, float *x, float *x0, float a, float c) {
+    Smoke_Solve_Job job = {smoke, x, x0, a, 1.0f / c, 0};
+    Kernel_Tuning slabs = g_tuning[TUNE_STENCIL];
+    slabs.grain = 1;
+
+    for (int iter = 0; iter < smoke->iterations; iter++) {
+        for (job.color = 0; job.color < 2; job.color++) {
+            parallel_for(1, smoke->n + 1, slabs, smoke_lin_solve_slabs, &job);
+        }
+        smoke_set_boundary(smoke, b, x);
+    }
+}
+
+void smoke_lin_solve_slabs(void *ctx, int begin, int end) {
+    Smoke_Solve_Job *job = ctx;
+    int n = job->smoke->n, sy = job->smoke->stride_y, sz = job->smoke->stride_z;
+    float *x = job->x, *x0 = job->x0;
+    float a = job->a, inv_c = job->inv_c;
+
+    for (int block = 1; block <= n; block += SMOKE_BLOCK_ROWS) {
+        int block_end = glm_min(block + SMOKE_BLOCK_ROWS, n + 1);
+        for (int k = begin; k < end; k++) {
+            for (int j = block; j < block_end; j++) {
+                int i = 1 + ((1 + j + k + job->color) & 1);
+                for (; i <= n; i += 2) {
+                    int idx = i + j * sy + k * sz;
+                    x[idx] = (x0[idx] + a * (x[idx - 1] + x[idx + 1] + x[idx - sy] + x[idx + sy] +
+                                             x[idx - sz] + x[idx + sz])) * inv_c;
+                }
+            }
+        }
+    }
+}
+
+typedef struct Smoke_Advect_Job {
+    Smoke_3D *smoke;
+    float *d, *d0, *u, *v, *w;
+} Smoke_Advect_Job;
+
+void smoke_advect(Smoke_3D *smoke, int b, float *d, float *d0, float *u, float *v, float *w) {
+    Smoke_Advect_Job job = {smoke, d, d0, u, v, w};
+    Kernel_Tuning slabs = g_tuning[TUNE_ADVECT];
+    slabs.grain = 1;
+    parallel_for(1, smoke->n + 1, slabs, smoke_advect_slabs, &job);
+    smoke_set_boundary(smoke, b, d);
+}
+
+void smoke_advect_slabs(void *ctx, int begin, int end) {
+    Smoke_Advect_Job *job = ctx;
+    Smoke_3D *smoke = job->smoke;
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+    float dt0 = smoke->dt * n;
+    float *d = job->d, *d0 = job->d0, *u = job->u, *v = job->v, *w = job->w;
+
+    for (int k = begin; k < end; k++) {
+        for (int j = 1; j <= n; j++) {
+            for (int i = 1; i <= n; i++) {
+                int idx = i + j * sy + k * sz;
+                float x = glm_clamp(i - dt0 * u[idx], 0.5f, n + 0.5f);
+                float y = glm_clamp(j - dt0 * v[idx], 0.5f, n + 0.5f);
+                float z = glm_clamp(k - dt0 * w[idx], 0.5f, n + 0.5f);
+
+                int i0 = (int)x, j0 = (int)y, k0 = (int)z;
+                float s1 = x - i0, t1 = y - j0, r1 = z - k0;
+                float s0 = 1.0f - s1, t0 = 1.0f - t1, r0 = 1.0f - r1;
+                int base = i0 + j0 * sy + k0 * sz;
+
+                d[idx] = r0 * (s0 * (t0 * d0[base] + t1 * d0[base + sy]) +
+                               s1 * (t0 * d0[base + 1] + t1 * d0[base + 1 + sy])) +
+                         r1 * (s0 * (t0 * d0[base + sz] + t1 * d0[base + sy + sz]) +
+                               s1 * (t0 * d0[base + 1 + sz] + t1 * d0[base + 1 + sy + sz]));
+            }
+        }
+    }
+}
+
+typedef struct Smoke_Project_Job {
+    Smoke_3D *smoke;
+    float *p, *div;
+} Smoke_Project_Job;
+
+// Pressure and divergence live in u_prev / v_prev, which are dead between advections
+void smoke_project(Smoke_3D *smoke) {
+    Smoke_Project_Job job = {smoke, smoke->u_prev, smoke->v_prev};
+    Kernel_Tuning slabs = g_tuning[TUNE_STENCIL];
+    slabs.grain = 1;
+
+    parallel_for(1, smoke->n + 1, slabs, smoke_divergence_slabs, &job);
+    smoke_set_boundary(smoke, 0, job.div);
+    smoke_set_boundary(smoke, 0, job.p);
+
+    smoke_lin_solve(smoke, 0, job.p, job.div, 1.0f, 6.0f);
+
+    parallel_for(1, smoke->n + 1, slabs, smoke_subtract_gradient_slabs, &job);
+    smoke_set_boundary(smoke, 1, smoke->u);
+    smoke_set_boundary(smoke, 2, smoke->v);
+    smoke_set_boundary(smoke, 3, smoke->w);
+}
+
+void smoke_divergence_slabs(void *ctx, int begin, int end) {
+    Smoke_Project_Job *job = ctx;
+    Smoke_3D *smoke = job->smoke;
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+    float h = 1.0f / n;
+
+    for (int k = begin; k < end; k++) {
+        for (int j = 1; j <= n; j++) {
+            for (int i = 1; i <= n; i++) {
+                int idx = i + j * sy + k * sz;
+                job->div[idx] = -0.5f * h * (smoke->u[idx + 1] - smoke->u[idx - 1] +
+                                             smoke->v[idx + sy] - smoke->v[idx - sy] +
+                                             smoke->w[idx + sz] - smoke->w[idx - sz]);
+                job->p[idx] = 0.0f;
+            }
+        }
+    }
+}
+
+void smoke_subtract_gradient_slabs(void *ctx, int begin, int end) {
+    Smoke_Project_Job *job = ctx;
+    Smoke_3D *smoke = job->smoke;
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+    float scale = 0.5f * n;
+    float *p = job->p;
+
+    for (int k = begin; k < end; k++) {
+        for (int j = 1; j <= n; j++) {
+            for (int i = 1; i <= n; i++) {
+                int idx = i + j * sy + k * sz;
+                smoke->u[idx] -= scale * (p[idx + 1] - p[idx - 1]);
+                smoke->v[idx] -= scale * (p[idx + sy] - p[idx - sy]);
+                smoke->w[idx] -= scale * (p[idx + sz] - p[idx - sz]);
+            }
+        }
+    }
+}
+
+// Emitter near the floor (j = n is the bottom of the view) with a slowly precessing kick,
+// plus buoyancy pushing dense smoke up
+void smoke_add_source(Smoke_3D *smoke) {
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+    int radius = n / 10 > 1 ? n / 10 : 1;
+    float phase = (float)smoke->step_count * 0.03f;
+    float swirl = 0.3f * smoke->buoyancy * 10.0f;
+
+    for (int k = n / 2 - radius; k <= n / 2 + radius; k++) {
+        for (int j = n - 3; j <= n - 1; j++) {
+            for (int i = n / 2 - radius; i <= n / 2 + radius; i++) {
+                int idx = i + j * sy + k * sz;
+                smoke->density[idx] = 1.0f;
+                smoke->u[idx] = swirl * cosf(phase);
+                smoke->w[idx] = swirl * sinf(phase);
+            }
+        }
+    }
+
+    for (int k = 1; k <= n; k++) {
+        for (int j = 1; j <= n; j++) {
+            float *v = smoke->v + j * sy + k * sz;
+            float *d = smoke->density + j * sy + k * sz;
+            for (int i = 1; i <= n; i++) v[i] -= smoke->dt * smoke->buoyancy * d[i];
+        }
+    }
+}
+
+void step_smoke(Smoke_3D *smoke) {
+    long long cells = (long long)smoke->n * smoke->n * smoke->n;
+
+    Perf_Scope scope = perf_zone_begin("smoke source");
+    smoke_add_source(smoke);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("smoke project");
+    smoke_project(smoke);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("smoke advect");
+    SWAP_FIELDS(smoke->u_prev, smoke->u);
+    SWAP_FIELDS(smoke->v_prev, smoke->v);
+    SWAP_FIELDS(smoke->w_prev, smoke->w);
+    smoke_advect(smoke, 1, smoke->u, smoke->u_prev, smoke->u_prev, smoke->v_prev, smoke->w_prev);
+    smoke_advect(smoke, 2, smoke->v, smoke->v_prev, smoke->u_prev, smoke->v_prev, smoke->w_prev);
+    smoke_advect(smoke, 3, smoke->w, smoke->w_prev, smoke->u_prev, smoke->v_prev, smoke->w_prev);
+
+    SWAP_FIELDS(smoke->density_prev, smoke->density);
+    smoke_advect(smoke, 0, smoke->density, smoke->density_prev, smoke->u, smoke->v, smoke->w);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("smoke project");
+    smoke_project(smoke);
+    perf_zone_end(&scope, cells);
+
+    smoke->step_count++;
+}
+
+typedef struct Smoke_View_Job {
+    Smoke_View *view;
+    Smoke_3D *smoke;
+} Smoke_View_Job;
+
+void update_smoke_view(Smoke_View *view, Smoke_3D *smoke) {
+    Perf_Scope scope = perf_zone_begin("smoke view");
+    Smoke_View_Job job = {view, smoke};
+    parallel_for(1, smoke->n + 1, g_tuning[TUNE_RENDER_PREP], smoke_view_rows, &job);
+    perf_zone_end(&scope, (long long)smoke->n * smoke->n * (view->mode == SMOKE_VIEW_SLICE ? 1 : smoke->n));
+}
+
+// Each task owns a run of image rows and reduces along the view axis into them. The inner
+// loop is always over x, so every axis streams memory contiguously.
+void smoke_view_rows(void *ctx, int begin, int end) {
+    Smoke_View_Job *job = ctx;
+    Smoke_View *view = job->view;
+    Smoke_3D *smoke = job->smoke;
+    int n = smoke->n, sy = smoke->stride_y, sz = smoke->stride_z;
+    int image_stride = n + 2;
+    bool reduce = view->mode != SMOKE_VIEW_SLICE;
+    int first = reduce ? 1 : view->slice;
+    int last = reduce ? n : view->slice;
+    float inv_n = 1.0f / n;
+
+    for (int row = begin; row < end; row++) {
+        float *out = view->image + row * image_stride;
+
+        if (view->axis == 0) {
+            // Image is (z, y): each output pixel reduces one contiguous x run
+            for (int k = 1; k <= n; k++) {
+                float *src = smoke->density + row * sy + k * sz;
+                float acc = 0.0f;
+                for (int i = first; i <= last; i++) {
+                    acc = view->mode == SMOKE_VIEW_MAX ? glm_max(acc, src[i]) : acc + src[i];
+                }
+                out[k] = view->mode == SMOKE_VIEW_AVERAGE ? acc * inv_n : acc;
+            }
+            continue;
+        }
+
+        // Image is (x, y) for the z axis and (x, z) for the y axis: reduce whole x rows
+        for (int i = 1; i <= n; i++) out[i] = 0.0f;
+        for (int t = first; t <= last; t++) {
+            float *src = view->axis == 2 ? smoke->density + row * sy + t * sz
+                                         : smoke->density + t * sy + row * sz;
+            if (view->mode == SMOKE_VIEW_MAX) {
+                for (int i = 1; i <= n; i++) out[i] = glm_max(out[i], src[i]);
+            } else {
+                for (int i = 1; i <= n; i++) out[i] += src[i];
+            }
+        }
+        if (view->mode == SMOKE_VIEW_AVERAGE) {
+            for (int i = 1; i <= n; i++) out[i] *= inv_n;
+        }
+    }
+}
+
+void run_smoke_bench() {
+    static const int sizes[] = {32, 64, 96, 128};
+
+    trace_log("3D smoke bench:");
+    trace_log("  %6s %10s %10s %12s %12s", "size", "MB", "steps/s", "ms/step", "Mcells/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        Smoke_3D smoke;
+        Smoke_View view = {SMOKE_VIEW_MAX, 2, 0, NULL};
+        initialize_smoke(&smoke, sizes[s]);
+        view.image = xcalloc((size_t)(smoke.n + 2) * (smoke.n + 2) * sizeof(float), "smoke 3d");
+
+        step_smoke(&smoke);
+
+        // Run for about a second, at least a few steps
+        int steps = 0;
+        uint64_t start = now_ns();
+        while (steps < 3 || now_ns() - start < 1000000000ull) {
+            step_smoke(&smoke);
+            update_smoke_view(&view, &smoke);
+            steps++;
+        }
+        double seconds = (now_ns() - start) / 1.0e9;
+        double cells = (double)smoke.n * smoke.n * smoke.n;
+
+        trace_log("  %4d^3 %10.1f %10.2f %12.2f %12.1f", smoke.n, smoke_memory_bytes(smoke.n) / (double)ONE_MB,
+                  steps / seconds, 1000.0 * seconds / steps, cells * steps / seconds / 1.0e6);
+
+        xfree(view.image);
+        destroy_smoke(&smoke);
+    }
+    report_perf_zones();
+}
+
+Reaction_Params default_reaction_params() {
+    Reaction_Params params = {0};
+    params.n = REACTION_DEFAULT_SIZE;
+    params.feed = g_reaction_presets[0].feed;
+    params.kill = g_reaction_presets[0].kill;
+    // Explicit stepping is stable while 4 * D * dt <= 1
+    params.diffusion_u = 0.2f;
+    params.diffusion_v = 0.1f;
+    params.dt = 1.0f;
+    params.steps_per_frame = REACTION_STEPS_PER_FRAME;
+    return params;
+}
+
+void initialize_reaction(Reaction_Diffusion *rd, Reaction_Params params) {
+    *rd = (Reaction_Diffusion){0};
+    rd->params = params;
+    rd->stride = params.n + 2;
+
+    size_t bytes = (size_t)rd->stride * rd->stride * sizeof(float);
+    rd->u = xmalloc(bytes, "reaction");
+    rd->v = xcalloc(bytes, "reaction");
+    rd->u_next = xcalloc(bytes, "reaction");
+    rd->v_next = xcalloc(bytes, "reaction");
+    for (size_t k = 0; k < bytes / sizeof(float); k++) rd->u[k] = 1.0f;
+
+    uint32_t rng = 0x9e3779b9u;
+    for (int k = 0; k < REACTION_SEED_COUNT; k++) {
+        int ci = 1 + (int)(random_float(&rng) * params.n);
+        int cj = 1 + (int)(random_float(&rng) * params.n);
+        reaction_seed(rd, ci, cj, glm_max(params.n / 32, 2), &rng);
+    }
+}
+
+void destroy_reaction(Reaction_Diffusion *rd) {
+    xfree(rd->u);
+    xfree(rd->v);
+    xfree(rd->u_next);
+    xfree(rd->v_next);
+    *rd = (Reaction_Diffusion){0};
+}
+
+void reaction_seed(Reaction_Diffusion *rd, int ci, int cj, int radius, uint32_t *rng) {
+    int n = rd->params.n, s = rd->stride;
+    for (int j = glm_max(cj - radius, 1); j <= glm_min(cj + radius, n); j++) {
+        for (int i = glm_max(ci - radius, 1); i <= glm_min(ci + radius, n); i++) {
+            rd->u[i + j * s] = 0.5f + 0.1f * (random_float(rng) - 0.5f);
+            rd->v[i + j * s] = 0.25f + 0.1f * (random_float(rng) - 0.5f);
+        }
+    }
+}
+
+// Periodic: ghost columns first, then whole ghost rows (corners included) from the far side
+void reaction_wrap(Reaction_Diffusion *rd) {
+    int n = rd->params.n, s = rd->stride;
+    float *fields[2] = {rd->u, rd->v};
+
+    for (int f = 0; f < 2; f++) {
+        float *x = fields[f];
+        for (int j = 1; j <= n; j++) {
+            x[0 + j * s] = x[n + j * s];
+            x[n + 1 + j * s] = x[1 + j * s];
+        }
+        memcpy(x, x + n * s, s * sizeof(float));
+        memcpy(x + (n + 1) * s, x + s, s * sizeof(float));
+    }
+}
+
+// Both Laplacians and the reaction terms in one pass, so u and v are read once and written once
+// per step. dt is folded into the coefficients; the SSE path does four cells per iteration and
+// the scalar loop finishes the row.
+void reaction_rows(void *ctx, int begin, int end) {
+    Reaction_Diffusion *rd = ctx;
+    Reaction_Params *p = &rd->params;
+    int n = p->n, s = rd->stride;
+    float dux = p->dt * p->diffusion_u * (1.0f + p->anisotropy), duy = p->dt * p->diffusion_u * (1.0f - p->anisotropy);
+    float dvx = p->dt * p->diffusion_v * (1.0f + p->anisotropy), dvy = p->dt * p->diffusion_v * (1.0f - p->anisotropy);
+    float feed = p->dt * p->feed, decay = p->dt * (p->feed + p->kill), dt = p->dt;
+    const float *u = rd->u, *v = rd->v;
+    float *u_next = rd->u_next, *v_next = rd->v_next;
+
+    for (int j = begin; j < end; j++) {
+        int i = 1;
+#ifdef HAVE_SSE
+        if (!rd->scalar_kernel) {
+            __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+            __m128 dux4 = _mm_set1_ps(dux), duy4 = _mm_set1_ps(duy), dvx4 = _mm_set1_ps(dvx), dvy4 = _mm_set1_ps(dvy);
+            __m128 feed4 = _mm_set1_ps(feed), decay4 = _mm_set1_ps(decay), dt4 = _mm_set1_ps(dt);
+            for (; i + 3 <= n; i += 4) {
+                int idx = i + j * s;
+                __m128 uc = _mm_loadu_ps(u + idx), vc = _mm_loadu_ps(v + idx);
+                __m128 u2 = _mm_mul_ps(two, uc), v2 = _mm_mul_ps(two, vc);
+                __m128 lap_u = _mm_add_ps(_mm_mul_ps(dux4, _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(u + idx - 1), _mm_loadu_ps(u + idx + 1)), u2)),
+                                          _mm_mul_ps(duy4, _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(u + idx - s), _mm_loadu_ps(u + idx + s)), u2)));
+                __m128 lap_v = _mm_add_ps(_mm_mul_ps(dvx4, _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(v + idx - 1), _mm_loadu_ps(v + idx + 1)), v2)),
+                                          _mm_mul_ps(dvy4, _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(v + idx - s), _mm_loadu_ps(v + idx + s)), v2)));
+                __m128 uvv = _mm_mul_ps(dt4, _mm_mul_ps(uc, _mm_mul_ps(vc, vc)));
+                _mm_storeu_ps(u_next + idx, _mm_add_ps(uc, _mm_add_ps(_mm_sub_ps(lap_u, uvv), _mm_mul_ps(feed4, _mm_sub_ps(one, uc)))));
+                _mm_storeu_ps(v_next + idx, _mm_add_ps(vc, _mm_sub_ps(_mm_add_ps(lap_v, uvv), _mm_mul_ps(decay4, vc))));
+            }
+        }
+#endif
+        for (; i <= n; i++) {
+            int idx = i + j * s;
+            float uc = u[idx], vc = v[idx];
+            float lap_u = dux * (u[idx - 1] + u[idx + 1] - 2.0f * uc) + duy * (u[idx - s] + u[idx + s] - 2.0f * uc);
+            float lap_v = dvx * (v[idx - 1] + v[idx + 1] - 2.0f * vc) + dvy * (v[idx - s] + v[idx + s] - 2.0f * vc);
+            float uvv = dt * uc * vc * vc;
+            u_next[idx] = uc + (lap_u - uvv + feed * (1.0f - uc));
+            v_next[idx] = vc + (lap_v + uvv - decay * vc);
+        }
+    }
+}
+
+void step_reaction(Reaction_Diffusion *rd, int steps) {
+    Perf_Scope scope = perf_zone_begin("reaction");
+    for (int k = 0; k < steps; k++) {
+        reaction_wrap(rd);
+        parallel_for(1, rd->params.n + 1, g_tuning[TUNE_STENCIL], reaction_rows, rd);
+
+        float *swap = rd->u;
+        rd->u = rd->u_next;
+        rd->u_next = swap;
+        swap = rd->v;
+        rd->v = rd->v_next;
+        rd->v_next = swap;
+        rd->step_count++;
+    }
+    perf_zone_end(&scope, (uint64_t)rd->params.n * rd->params.n * steps);
+}
+
+// Dragging paints fresh autocatalyst under the cursor; the window maps onto the whole grid
+void reaction_stir(Reaction_Diffusion *rd, Mouse_State *mouse) {
+    int n = rd->params.n;
+    int ci = 1 + (int)(mouse->x * n / glm_max(g_window_state.w, 1));
+    int cj = 1 + (int)(mouse->y * n / glm_max(g_window_state.h, 1));
+    uint32_t rng = (uint32_t)rd->step_count * 2654435761u | 1u;
+    reaction_seed(rd, ci, cj, glm_max(n / 64, 1), &rng);
+}
+
+void fill_cells_from_reaction(Cell_Grid *grid, Reaction_Diffusion *rd) {
+    // v rarely rises above 0.4, so stretch it over the ramp
+    Fill_Cells_Job job = {grid, rd->v, NULL, rd->params.n, rd->params.n, rd->stride, NULL, 0, 2.5f};
+    parallel_for(0, (int)grid->rows, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+void toggle_reaction(Reaction_Params params) {
+    if (g_reaction.u) {
+        destroy_reaction(&g_reaction);
+        trace_log("Reaction-diffusion disabled");
+        return;
+    }
+
+    initialize_reaction(&g_reaction, params);
+    trace_log("Reaction-diffusion: %d^2, feed %.4f, kill %.4f, anisotropy %.2f, %d steps per frame", params.n,
+              params.feed, params.kill, params.anisotropy, params.steps_per_frame);
+}
+
+void run_reaction_bench() {
+    static const int sizes[] = {256, 512, 1024};
+
+    trace_log("Reaction-diffusion bench (%d threads):", g_tuning[TUNE_STENCIL].threads);
+    trace_log("  %6s %8s %10s %12s %10s", "size", "kernel", "steps/s", "Mcells/s", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        Reaction_Params params = default_reaction_params();
+        params.n = sizes[s];
+
+        double scalar_rate = 0.0;
+        for (int scalar = 1; scalar >= 0; scalar--) {
+            Reaction_Diffusion rd;
+            initialize_reaction(&rd, params);
+            rd.scalar_kernel = scalar;
+            step_reaction(&rd, params.steps_per_frame);
+
+            // Run for about a second, in frame-sized batches
+            int steps = 0;
+            uint64_t start = now_ns();
+            while (steps < 4 * params.steps_per_frame || now_ns() - start < 1000000000ull) {
+                step_reaction(&rd, params.steps_per_frame);
+                steps += params.steps_per_frame;
+            }
+            double rate = steps / ((now_ns() - start) / 1.0e9);
+            if (scalar) scalar_rate = rate;
+
+            trace_log("  %4d^2 %8s %10.0f %12.1f %9.2fx", params.n, scalar ? "scalar" : "simd", rate,
+                      rate * params.n * params.n / 1.0e6, rate / scalar_rate);
+            destroy_reaction(&rd);
+        }
+    }
+}
+
+Euler_Params default_euler_params() {
+    Euler_Params params = {0};
+    params.n = EULER_DEFAULT_SIZE;
+    params.scenario = EULER_BLAST;
+    params.limiter = LIMITER_VAN_LEER;
+    params.gamma = 1.4f;
+    params.cfl = 0.8f;
+    params.steps_per_frame = EULER_STEPS_PER_FRAME;
+    return params;
+}
+
+void initialize_euler(Euler_Gas *gas, Euler_Params params) {
+    *gas = (Euler_Gas){0};
+    gas->params = params;
+    gas->stride = params.n + 2;
+
+    size_t bytes = (size_t)gas->stride * gas->stride * sizeof(float);
+    gas->rho = xcalloc(bytes, "euler");
+    gas->mx = xcalloc(bytes, "euler");
+    gas->my = xcalloc(bytes, "euler");
+    gas->energy = xcalloc(bytes, "euler");
+    gas->row_max_speed = xcalloc((size_t)gas->stride * sizeof(float), "euler");
+    gas->row_max_density = xcalloc((size_t)gas->stride * sizeof(float), "euler");
+    euler_set_initial_state(gas);
+}
+
+void destroy_euler(Euler_Gas *gas) {
+    xfree(gas->rho);
+    xfree(gas->mx);
+    xfree(gas->my);
+    xfree(gas->energy);
+    xfree(gas->row_max_speed);
+    xfree(gas->row_max_density);
+    *gas = (Euler_Gas){0};
+}
+
+// Sod's tube along x (rho 1, p 1 against rho 0.125, p 0.1), or a circular blast (p 10 inside
+// radius 0.1 in still gas at p 0.1) in a closed box
+void euler_set_initial_state(Euler_Gas *gas) {
+    int n = gas->params.n, s = gas->stride;
+    float gamma = gas->params.gamma;
+
+    for (int j = 1; j <= n; j++) {
+        for (int i = 1; i <= n; i++) {
+            float x = (i - 0.5f) / n, y = (j - 0.5f) / n;
+            float rho = 1.0f, p = 0.1f;
+            if (gas->params.scenario == EULER_SHOCK_TUBE) {
+                if (x < 0.5f) p = 1.0f;
+                else rho = 0.125f;
+            } else if ((x - 0.5f) * (x - 0.5f) + (y - 0.5f) * (y - 0.5f) < 0.01f) {
+                p = 10.0f;
+            }
+            int idx = i + j * s;
+            gas->rho[idx] = rho;
+            gas->mx[idx] = 0.0f;
+            gas->my[idx] = 0.0f;
+            gas->energy[idx] = p / (gamma - 1.0f);
+        }
+    }
+    gas->time = 0.0;
+    gas->step_count = 0;
+}
+
+void euler_speed_rows(void *ctx, int begin, int end) {
+    Euler_Gas *gas = ctx;
+    int n = gas->params.n, s = gas->stride;
+    float gamma = gas->params.gamma;
+
+    for (int j = begin; j < end; j++) {
+        float speed = 0.0f, density = 0.0f;
+        for (int i = 1; i <= n; i++) {
+            int idx = i + j * s;
+            float rho = gas->rho[idx];
+            float u = gas->mx[idx] / rho, v = gas->my[idx] / rho;
+            float p = (gamma - 1.0f) * (gas->energy[idx] - 0.5f * rho * (u * u + v * v));
+            float c = sqrtf(gamma * glm_max(p, 1e-6f) / rho);
+            speed = glm_max(speed, glm_max(fabsf(u), fabsf(v)) + c);
+            density = glm_max(density, rho);
+        }
+        gas->row_max_speed[j] = speed;
+        gas->row_max_density[j] = density;
+    }
+}
+
+typedef struct Euler_Sweep_Job {
+    Euler_Gas *gas;
+    int axis;
+    float dt_dx;
+} Euler_Sweep_Job;
+
+// Dimensional splitting: each task owns whole rows (axis 0) or columns (axis 1). A line is
+// copied out with its normal momentum first, given a two-cell halo (zero-gradient for the tube,
+// mirrored walls for the blast), solved, and copied back.
+void euler_sweep_lines(void *ctx, int begin, int end) {
+    Euler_Sweep_Job *job = ctx;
+    Euler_Gas *gas = job->gas;
+    int n = gas->params.n, s = gas->stride;
+    int step = job->axis == 0 ? 1 : s;
+    float *normal = job->axis == 0 ? gas->mx : gas->my;
+    float *tangential = job->axis == 0 ? gas->my : gas->mx;
+    float *fields[4] = {gas->rho, normal, tangential, gas->energy};
+    float wall = gas->params.scenario == EULER_BLAST ? -1.0f : 1.0f;
+    Euler_Line line;
+
+    for (int k = begin; k < end; k++) {
+        int first = job->axis == 0 ? 1 + k * s : k + s;
+        for (int v = 0; v < 4; v++) {
+            float *q = line.q[v];
+            for (int i = 0; i < n; i++) q[i + 2] = fields[v][first + i * step];
+
+            bool mirror = gas->params.scenario == EULER_BLAST;
+            float sign = v == 1 ? wall : 1.0f;
+            q[1] = sign * q[2];
+            q[0] = sign * q[mirror ? 3 : 2];
+            q[n + 2] = sign * q[n + 1];
+            q[n + 3] = sign * q[mirror ? n : n + 1];
+        }
+
+        euler_solve_line(&line, n, job->dt_dx, gas->params.gamma, gas->params.limiter);
+
+        for (int v = 0; v < 4; v++) {
+            for (int i = 0; i < n; i++) fields[v][first + i * step] = line.q[v][i + 2];
+        }
+    }
+}
+
+static inline float limit_slope(float a, float b, Slope_Limiter limiter) {
+    if (a * b <= 0.0f) return 0.0f;
+    if (limiter == LIMITER_MINMOD) return fabsf(a) < fabsf(b) ? a : b;
+    if (limiter == LIMITER_VAN_LEER) return 2.0f * a * b / (a + b);
+    float m = glm_min(glm_min(2.0f * fabsf(a), 2.0f * fabsf(b)), 0.5f * fabsf(a + b));
+    return a > 0.0f ? m : -m;
+}
+
+// Limited slopes of cell i, its face values, and their half-step evolution in primitive form
+static inline void euler_face_states(Euler_Line *line, int i, float half, float gamma, Slope_Limiter limiter) {
+    float *rho = line->w[0], *un = line->w[1], *ut = line->w[2], *p = line->w[3];
+    float d_rho = limit_slope(rho[i] - rho[i - 1], rho[i + 1] - rho[i], limiter);
+    float d_un = limit_slope(un[i] - un[i - 1], un[i + 1] - un[i], limiter);
+    float d_ut = limit_slope(ut[i] - ut[i - 1], ut[i + 1] - ut[i], limiter);
+    float d_p = limit_slope(p[i] - p[i - 1], p[i + 1] - p[i], limiter);
+
+    float e_rho = -half * (un[i] * d_rho + rho[i] * d_un);
+    float e_un = -half * (un[i] * d_un + d_p / rho[i]);
+    float e_ut = -half * un[i] * d_ut;
+    float e_p = -half * (gamma * p[i] * d_un + un[i] * d_p);
+
+    line->left[0][i] = glm_max(rho[i] - 0.5f * d_rho + e_rho, 1e-6f);
+    line->left[1][i] = un[i] - 0.5f * d_un + e_un;
+    line->left[2][i] = ut[i] - 0.5f * d_ut + e_ut;
+    line->left[3][i] = glm_max(p[i] - 0.5f * d_p + e_p, 1e-6f);
+    line->right[0][i] = glm_max(rho[i] + 0.5f * d_rho + e_rho, 1e-6f);
+    line->right[1][i] = un[i] + 0.5f * d_un + e_un;
+    line->right[2][i] = ut[i] + 0.5f * d_ut + e_ut;
+    line->right[3][i] = glm_max(p[i] + 0.5f * d_p + e_p, 1e-6f);
+}
+
+// HLLC flux through face i + 1/2, from the right face of cell i and the left face of cell i + 1
+static inline void euler_hllc_flux(Euler_Line *line, int i, float gamma) {
+    float gm1 = gamma - 1.0f;
+    float rl = line->right[0][i], ul = line->right[1][i], vl = line->right[2][i], pl = line->right[3][i];
+    float rr = line->left[0][i + 1], ur = line->left[1][i + 1], vr = line->left[2][i + 1], pr = line->left[3][i + 1];
+    float el = pl / gm1 + 0.5f * rl * (ul * ul + vl * vl);
+    float er = pr / gm1 + 0.5f * rr * (ur * ur + vr * vr);
+    float cl = sqrtf(gamma * pl / rl), cr = sqrtf(gamma * pr / rr);
+
+    float sl = glm_min(ul - cl, ur - cr), sr = glm_max(ul + cl, ur + cr);
+    float ml = rl * (sl - ul), mr = rr * (sr - ur);
+    float ss = (pr - pl + ul * ml - ur * mr) / (ml - mr);
+
+    // Upwind side, then its star state when the contact lies on the other side of the face
+    bool use_left = ss >= 0.0f;
+    float r = use_left ? rl : rr, u = use_left ? ul : ur, v = use_left ? vl : vr;
+    float pk = use_left ? pl : pr, e = use_left ? el : er, sk = use_left ? sl : sr;
+    float f0 = r * u, f1 = r * u * u + pk, f2 = r * u * v, f3 = (e + pk) * u;
+
+    bool star = use_left ? sl < 0.0f : sr > 0.0f;
+    float scale = r * (sk - u) / (sk - ss);
+    float s3 = scale * (e / r + (ss - u) * (ss + pk / (r * (sk - u))));
+    line->flux[0][i] = star ? f0 + sk * (scale - r) : f0;
+    line->flux[1][i] = star ? f1 + sk * (scale * ss - r * u) : f1;
+    line->flux[2][i] = star ? f2 + sk * (scale * v - r * v) : f2;
+    line->flux[3][i] = star ? f3 + sk * (s3 - e) : f3;
+}
+
+#ifdef HAVE_SSE
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 limit_slope_ps(__m128 a, __m128 b, Slope_Limiter limiter) {
+    __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 same_sign = _mm_cmpgt_ps(_mm_mul_ps(a, b), _mm_setzero_ps());
+    __m128 abs_a = _mm_andnot_ps(sign, a), abs_b = _mm_andnot_ps(sign, b);
+    __m128 slope;
+    if (limiter == LIMITER_MINMOD) {
+        slope = select_ps(_mm_cmplt_ps(abs_a, abs_b), a, b);
+    } else if (limiter == LIMITER_VAN_LEER) {
+        slope = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(2.0f), _mm_mul_ps(a, b)), _mm_add_ps(a, b));
+    } else {
+        __m128 two = _mm_set1_ps(2.0f);
+        __m128 m = _mm_min_ps(_mm_min_ps(_mm_mul_ps(two, abs_a), _mm_mul_ps(two, abs_b)),
+                              _mm_mul_ps(_mm_set1_ps(0.5f), _mm_andnot_ps(sign, _mm_add_ps(a, b))));
+        slope = _mm_or_ps(m, _mm_and_ps(sign, a));
+    }
+    // Lanes with opposite signs (or a zero) may hold 0/0 above; the mask clears them
+    return _mm_and_ps(same_sign, slope);
+}
+
+// Four cells of euler_face_states
+static inline void euler_face_states_ps(Euler_Line *line, int i, float half, float gamma, Slope_Limiter limiter) {
+    __m128 q[4], d[4];
+    for (int v = 0; v < 4; v++) {
+        __m128 prev = _mm_loadu_ps(line->w[v] + i - 1), next = _mm_loadu_ps(line->w[v] + i + 1);
+        q[v] = _mm_loadu_ps(line->w[v] + i);
+        d[v] = limit_slope_ps(_mm_sub_ps(q[v], prev), _mm_sub_ps(next, q[v]), limiter);
+    }
+
+    __m128 h = _mm_set1_ps(-half);
+    __m128 e[4];
+    e[0] = _mm_mul_ps(h, _mm_add_ps(_mm_mul_ps(q[1], d[0]), _mm_mul_ps(q[0], d[1])));
+    e[1] = _mm_mul_ps(h, _mm_add_ps(_mm_mul_ps(q[1], d[1]), _mm_div_ps(d[3], q[0])));
+    e[2] = _mm_mul_ps(h, _mm_mul_ps(q[1], d[2]));
+    e[3] = _mm_mul_ps(h, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma), q[3]), d[1]), _mm_mul_ps(q[1], d[3])));
+
+    __m128 minimum = _mm_set1_ps(1e-6f), point_five = _mm_set1_ps(0.5f);
+    for (int v = 0; v < 4; v++) {
+        __m128 centre = _mm_add_ps(q[v], e[v]), offset = _mm_mul_ps(point_five, d[v]);
+        __m128 left = _mm_sub_ps(centre, offset), right = _mm_add_ps(centre, offset);
+        if (v == 0 || v == 3) {
+            left = _mm_max_ps(left, minimum);
+            right = _mm_max_ps(right, minimum);
+        }
+        _mm_storeu_ps(line->left[v] + i, left);
+        _mm_storeu_ps(line->right[v] + i, right);
+    }
+}
+
+// Four faces of euler_hllc_flux, the upwind and star selections done with masks
+static inline void euler_hllc_flux_ps(Euler_Line *line, int i, float gamma) {
+    __m128 zero = _mm_setzero_ps(), point_five = _mm_set1_ps(0.5f);
+    __m128 g = _mm_set1_ps(gamma), inv_gm1 = _mm_set1_ps(1.0f / (gamma - 1.0f));
+    __m128 rl = _mm_loadu_ps(line->right[0] + i), ul = _mm_loadu_ps(line->right[1] + i);
+    __m128 vl = _mm_loadu_ps(line->right[2] + i), pl = _mm_loadu_ps(line->right[3] + i);
+    __m128 rr = _mm_loadu_ps(line->left[0] + i + 1), ur = _mm_loadu_ps(line->left[1] + i + 1);
+    __m128 vr = _mm_loadu_ps(line->left[2] + i + 1), pr = _mm_loadu_ps(line->left[3] + i + 1);
+
+    __m128 el = _mm_add_ps(_mm_mul_ps(pl, inv_gm1), _mm_mul_ps(_mm_mul_ps(point_five, rl), _mm_add_ps(_mm_mul_ps(ul, ul), _mm_mul_ps(vl, vl))));
+    __m128 er = _mm_add_ps(_mm_mul_ps(pr, inv_gm1), _mm_mul_ps(_mm_mul_ps(point_five, rr), _mm_add_ps(_mm_mul_ps(ur, ur), _mm_mul_ps(vr, vr))));
+    __m128 cl = _mm_sqrt_ps(_mm_div_ps(_mm_mul_ps(g, pl), rl)), cr = _mm_sqrt_ps(_mm_div_ps(_mm_mul_ps(g, pr), rr));
+
+    __m128 sl = _mm_min_ps(_mm_sub_ps(ul, cl), _mm_sub_ps(ur, cr)), sr = _mm_max_ps(_mm_add_ps(ul, cl), _mm_add_ps(ur, cr));
+    __m128 ml = _mm_mul_ps(rl, _mm_sub_ps(sl, ul)), mr = _mm_mul_ps(rr, _mm_sub_ps(sr, ur));
+    __m128 ss = _mm_div_ps(_mm_add_ps(_mm_sub_ps(pr, pl), _mm_sub_ps(_mm_mul_ps(ul, ml), _mm_mul_ps(ur, mr))), _mm_sub_ps(ml, mr));
+
+    __m128 use_left = _mm_cmpge_ps(ss, zero);
+    __m128 r = select_ps(use_left, rl, rr), u = select_ps(use_left, ul, ur), v = select_ps(use_left, vl, vr);
+    __m128 pk = select_ps(use_left, pl, pr), e = select_ps(use_left, el, er), sk = select_ps(use_left, sl, sr);
+    __m128 ru = _mm_mul_ps(r, u);
+    __m128 f[4] = {ru, _mm_add_ps(_mm_mul_ps(ru, u), pk), _mm_mul_ps(ru, v), _mm_mul_ps(_mm_add_ps(e, pk), u)};
+
+    __m128 star = select_ps(use_left, _mm_cmplt_ps(sl, zero), _mm_cmpgt_ps(sr, zero));
+    __m128 sku = _mm_sub_ps(sk, u);
+    __m128 scale = _mm_div_ps(_mm_mul_ps(r, sku), _mm_sub_ps(sk, ss));
+    __m128 s3 = _mm_mul_ps(scale, _mm_add_ps(_mm_div_ps(e, r),
+                                             _mm_mul_ps(_mm_sub_ps(ss, u), _mm_add_ps(ss, _mm_div_ps(pk, _mm_mul_ps(r, sku))))));
+    __m128 star_state[4] = {scale, _mm_mul_ps(scale, ss), _mm_mul_ps(scale, v), s3};
+    __m128 state[4] = {r, ru, _mm_mul_ps(r, v), e};
+    for (int k = 0; k < 4; k++) {
+        __m128 corrected = _mm_add_ps(f[k], _mm_mul_ps(sk, _mm_sub_ps(star_state[k], state[k])));
+        _mm_storeu_ps(line->flux[k] + i, select_ps(star, corrected, f[k]));
+    }
+}
+#endif
+
+// MUSCL-Hancock with the HLLC Riemann solver on one line of count cells (indices 2..count+1).
+// The slope and flux stages dominate and run four cells per SSE iteration with the branches as
+// masks, finishing with the scalar versions; the conversions are plain loops over SoA arrays.
+void euler_solve_line(Euler_Line *line, int count, float dt_dx, float gamma, Slope_Limiter limiter) {
+    float gm1 = gamma - 1.0f;
+    float half = 0.5f * dt_dx;
+
+    // Primitive variables
+    for (int i = 0; i < count + 4; i++) {
+        float r = line->q[0][i];
+        float a = line->q[1][i] / r, b = line->q[2][i] / r;
+        line->w[0][i] = r;
+        line->w[1][i] = a;
+        line->w[2][i] = b;
+        line->w[3][i] = glm_max(gm1 * (line->q[3][i] - 0.5f * r * (a * a + b * b)), 1e-6f);
+    }
+
+    int i = 1;
+#ifdef HAVE_SSE
+    for (; i + 4 <= count + 3; i += 4) euler_face_states_ps(line, i, half, gamma, limiter);
+#endif
+    for (; i < count + 3; i++) euler_face_states(line, i, half, gamma, limiter);
+
+    i = 1;
+#ifdef HAVE_SSE
+    for (; i + 4 <= count + 2; i += 4) euler_hllc_flux_ps(line, i, gamma);
+#endif
+    for (; i < count + 2; i++) euler_hllc_flux(line, i, gamma);
+
+    // Conservative update of the interior cells
+    for (int v = 0; v < 4; v++) {
+        float *q = line->q[v], *f = line->flux[v];
+        for (int k = 2; k < count + 2; k++) q[k] -= dt_dx * (f[k] - f[k - 1]);
+    }
+}
+
+// CFL time step from the fastest signal; the sweep order alternates every step (Strang-style) so
+// the splitting error does not accumulate along one axis
+void step_euler(Euler_Gas *gas) {
+    Perf_Scope scope = perf_zone_begin("euler");
+    int n = gas->params.n;
+
+    parallel_for(1, n + 1, g_tuning[TUNE_STENCIL], euler_speed_rows, gas);
+    float max_speed = 1e-6f;
+    gas->max_density = 0.0f;
+    for (int j = 1; j <= n; j++) {
+        max_speed = glm_max(max_speed, gas->row_max_speed[j]);
+        gas->max_density = glm_max(gas->max_density, gas->row_max_density[j]);
+    }
+    gas->dt = gas->params.cfl / (n * max_speed);
+
+    Kernel_Tuning lines = g_tuning[TUNE_STENCIL];
+    Euler_Sweep_Job job = {gas, 0, gas->dt * n};
+    for (int k = 0; k < 2; k++) {
+        job.axis = (int)((gas->step_count + k) & 1);
+        parallel_for(1, n + 1, lines, euler_sweep_lines, &job);
+    }
+
+    gas->time += gas->dt;
+    gas->step_count++;
+    perf_zone_end(&scope, (uint64_t)n * n);
+}
+
+double euler_total_mass(Euler_Gas *gas) {
+    double mass = 0.0;
+    for (int j = 1; j <= gas->params.n; j++) {
+        for (int i = 1; i <= gas->params.n; i++) mass += gas->rho[i + j * gas->stride];
+    }
+    return mass / ((double)gas->params.n * gas->params.n);
+}
+
+void fill_cells_from_euler(Cell_Grid *grid, Euler_Gas *gas) {
+    // Density scaled by this step's peak, so weak and strong blasts both use the whole ramp
+    Fill_Cells_Job job = {grid, gas->rho, NULL, gas->params.n, gas->params.n, gas->stride, NULL, 0,
+                          1.0f / glm_max(gas->max_density, 1e-6f)};
+    parallel_for(0, (int)grid->rows, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+void toggle_euler(Euler_Params params) {
+    if (g_euler.rho) {
+        destroy_euler(&g_euler);
+        trace_log("Euler gas disabled");
+        return;
+    }
+
+    initialize_euler(&g_euler, params);
+    trace_log("Euler gas: %s, %d^2, %s limiter, CFL %.2f", g_euler_scenario_names[params.scenario], params.n,
+              g_limiter_names[params.limiter], params.cfl);
+}
+
+// Blast in a closed box, so mass is conserved to round-off and the drift column doubles as a check
+void run_euler_bench() {
+    static const int sizes[] = {256, 512, 1024};
+
+    trace_log("Euler bench, blast wave (%d threads):", g_tuning[TUNE_STENCIL].threads);
+    trace_log("  %6s %10s %10s %12s %12s", "size", "limiter", "steps/s", "Mcells/s", "mass drift");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int limiter = 0; limiter < LIMITER_COUNT; limiter++) {
+            Euler_Params params = default_euler_params();
+            params.n = sizes[s];
+            params.limiter = (Slope_Limiter)limiter;
+            Euler_Gas gas;
+            initialize_euler(&gas, params);
+            double mass = euler_total_mass(&gas);
+
+            // Run for about a second, at least a few steps
+            int steps = 0;
+            uint64_t start = now_ns();
+            while (steps < 3 || now_ns() - start < 1000000000ull) {
+                step_euler(&gas);
+                steps++;
+            }
+            double rate = steps / ((now_ns() - start) / 1.0e9);
+
+            trace_log("  %4d^2 %10s %10.1f %12.1f %12.2g", params.n, g_limiter_names[limiter], rate,
+                      rate * params.n * params.n / 1.0e6, fabs(euler_total_mass(&gas) - mass) / mass);
+            destroy_euler(&gas);
+        }
+    }
+}
+
+Amr_Params default_amr_params() {
+    Amr_Params params = {0};
+    params.max_level = AMR_DEFAULT_MAX_LEVEL;
+    params.refine_density = 0.1f;
+    params.coarsen_density = 0.03f;
+    params.refine_vorticity = 0.2f;
+    params.coarsen_vorticity = 0.06f;
+    // Unsplit 2D upwind needs the Courant numbers of both axes to sum below one
+    params.cfl = 0.4f;
+    params.period = 4.0f;
+    params.steps_per_frame = AMR_STEPS_PER_FRAME;
+    return params;
+}
+
+void initialize_amr(Amr_Grid *amr, Amr_Params params) {
+    *amr = (Amr_Grid){0};
+    amr->params = params;
+
+    // Roots are allocated first and never freed, so root (x, y) is node y * AMR_ROOTS + x
+    for (int y = 0; y < AMR_ROOTS; y++) {
+        for (int x = 0; x < AMR_ROOTS; x++) {
+            int node = amr_alloc_node(amr, 0, x, y, -1);
+            amr->nodes[node].block = amr_alloc_block(amr);
+        }
+    }
+
+    // Refine against the analytic field, resetting every level from it, so the finest blocks
+    // start sharp instead of interpolated
+    Kernel_Tuning tuning = g_tuning[TUNE_STENCIL];
+    for (int pass = 0;; pass++) {
+        amr_collect_leaves(amr);
+        parallel_for(0, amr->leaf_count, tuning, amr_set_initial_blocks, amr);
+        if (pass == params.max_level) break;
+
+        parallel_for(0, amr->leaf_count, tuning, amr_fill_halo_blocks, amr);
+        parallel_for(0, amr->leaf_count, tuning, amr_indicator_blocks, amr);
+        int leaf_count = amr->leaf_count;
+        for (int k = 0; k < leaf_count; k++) {
+            Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+            if (leaf->density_jump > params.refine_density || leaf->vorticity > params.refine_vorticity) {
+                amr_refine(amr, amr->leaves[k]);
+            }
+        }
+        amr_balance(amr);
+    }
+}
+
+void destroy_amr(Amr_Grid *amr) {
+    xfree(amr->nodes);
+    xfree(amr->free_nodes);
+    xfree(amr->leaves);
+    xfree(amr->data);
+    xfree(amr->next);
+    xfree(amr->free_blocks);
+    xfree(amr->image);
+    *amr = (Amr_Grid){0};
+}
+
+int amr_alloc_node(Amr_Grid *amr, int level, int x, int y, int parent) {
+    int node;
+    if (amr->free_node_count > 0) {
+        node = amr->free_nodes[--amr->free_node_count];
+    } else {
+        if (amr->node_count == amr->node_capacity) {
+            int capacity = amr->node_capacity ? amr->node_capacity * 2 : 64;
+            amr->nodes = xrealloc(amr->nodes, capacity * sizeof(Amr_Node), "amr");
+            amr->free_nodes = xrealloc(amr->free_nodes, capacity * sizeof(int), "amr");
+            amr->leaves = xrealloc(amr->leaves, capacity * sizeof(int), "amr");
+            amr->node_capacity = capacity;
+        }
+        node = amr->node_count++;
+    }
+    amr->nodes[node] = (Amr_Node){level, x, y, parent, {-1, -1, -1, -1}, -1, 0.0f, 0.0f};
+    return node;
+}
+
+int amr_alloc_block(Amr_Grid *amr) {
+    if (amr->free_block_count > 0) return amr->free_blocks[--amr->free_block_count];
+
+    if (amr->block_count == amr->block_capacity) {
+        int capacity = amr->block_capacity ? amr->block_capacity * 2 : 64;
+        amr->data = xrealloc(amr->data, (size_t)capacity * AMR_BLOCK_AREA * sizeof(float), "amr");
+        amr->next = xrealloc(amr->next, (size_t)capacity * AMR_BLOCK_AREA * sizeof(float), "amr");
+        amr->free_blocks = xrealloc(amr->free_blocks, capacity * sizeof(int), "amr");
+        amr->block_capacity = capacity;
+    }
+    return amr->block_count++;
+}
+
+// A disc of dye with a steep but smooth edge
+float amr_initial_density(float x, float y) {
+    float r = sqrtf((x - 0.5f) * (x - 0.5f) + (y - 0.75f) * (y - 0.75f));
+    return 0.5f - 0.5f * tanhf((r - 0.15f) / 0.008f);
+}
+
+// LeVeque's swirl: u = sin^2(pi x) sin(2 pi y), v = -sin^2(pi y) sin(2 pi x), scaled by
+// cos(pi t / period). Divergence free, zero normal velocity on the walls.
+void amr_swirl(Amr_Grid *amr, float x, float y, float *u, float *v, float *vorticity) {
+    float c = cosf(GLM_PIf * (float)amr->time / amr->params.period);
+    float sx = sinf(GLM_PIf * x), sy = sinf(GLM_PIf * y);
+    *u = c * sx * sx * sinf(2.0f * GLM_PIf * y);
+    *v = -c * sy * sy * sinf(2.0f * GLM_PIf * x);
+    *vorticity = -2.0f * GLM_PIf * c * (sy * sy * cosf(2.0f * GLM_PIf * x) + sx * sx * cosf(2.0f * GLM_PIf * y));
+}
+
+int amr_find_leaf(Amr_Grid *amr, float x, float y) {
+    int node = (int)(y * AMR_ROOTS) * AMR_ROOTS + (int)(x * AMR_ROOTS);
+    while (amr->nodes[node].children[0] >= 0) {
+        Amr_Node *parent = &amr->nodes[node];
+        float size = 1.0f / (float)(AMR_ROOTS << parent->level);
+        int quadrant = (x >= (parent->x + 0.5f) * size) + 2 * (y >= (parent->y + 0.5f) * size);
+        node = parent->children[quadrant];
+    }
+    return node;
+}
+
+// Value of the leaf cell containing (x, y); points outside the domain clamp to the edge cells
+float amr_sample(Amr_Grid *amr, float x, float y) {
+    x = glm_clamp(x, 0.0f, 0.999999f);
+    y = glm_clamp(y, 0.0f, 0.999999f);
+    Amr_Node *leaf = &amr->nodes[amr_find_leaf(amr, x, y)];
+    float cells = (float)(AMR_ROOTS * AMR_BLOCK << leaf->level);
+    int i = glm_clamp((int)(x * cells) - leaf->x * AMR_BLOCK, 0, AMR_BLOCK - 1);
+    int j = glm_clamp((int)(y * cells) - leaf->y * AMR_BLOCK, 0, AMR_BLOCK - 1);
+    return amr->data[leaf->block * AMR_BLOCK_AREA + (j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO];
+}
+
+// Each halo cell averages four quarter-cell samples: that is the mean of a finer neighbour's
+// 2x2 cells (the tree is 2:1 balanced) and a plain copy from a same-level or coarser one
+void amr_fill_halo_blocks(void *ctx, int begin, int end) {
+    Amr_Grid *amr = ctx;
+
+    for (int k = begin; k < end; k++) {
+        Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+        float h = 1.0f / (float)(AMR_ROOTS * AMR_BLOCK << leaf->level);
+        float ox = leaf->x * AMR_BLOCK * h, oy = leaf->y * AMR_BLOCK * h;
+        float *block = amr->data + leaf->block * AMR_BLOCK_AREA;
+
+        for (int j = -AMR_HALO; j < AMR_BLOCK + AMR_HALO; j++) {
+            bool halo_row = j < 0 || j >= AMR_BLOCK;
+            for (int i = -AMR_HALO; i < AMR_BLOCK + AMR_HALO; i++) {
+                if (!halo_row && i == 0) i = AMR_BLOCK;
+                float x = ox + (i + 0.5f) * h, y = oy + (j + 0.5f) * h, d = 0.25f * h;
+                block[(j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO] =
+                    0.25f * (amr_sample(amr, x - d, y - d) + amr_sample(amr, x + d, y - d) +
+                             amr_sample(amr, x - d, y + d) + amr_sample(amr, x + d, y + d));
+            }
+        }
+    }
+}
+
+// Conservative upwind update with minmod-limited slopes (Fromm-style, corrected for the Courant
+// number). The swirl is separable, so its face velocities come from four short tables per block.
+void amr_step_blocks(void *ctx, int begin, int end) {
+    Amr_Grid *amr = ctx;
+    float dt = amr->dt;
+    float c = cosf(GLM_PIf * (float)amr->time / amr->params.period);
+
+    for (int k = begin; k < end; k++) {
+        Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+        float h = 1.0f / (float)(AMR_ROOTS * AMR_BLOCK << leaf->level);
+        float ox = leaf->x * AMR_BLOCK * h, oy = leaf->y * AMR_BLOCK * h;
+        const float *q = amr->data + leaf->block * AMR_BLOCK_AREA;
+        float *out = amr->next + leaf->block * AMR_BLOCK_AREA;
+
+        float face_x[AMR_BLOCK + 1], face_y[AMR_BLOCK + 1], centre_x[AMR_BLOCK], centre_y[AMR_BLOCK];
+        for (int i = 0; i <= AMR_BLOCK; i++) {
+            float sx = sinf(GLM_PIf * (ox + i * h)), sy = sinf(GLM_PIf * (oy + i * h));
+            face_x[i] = sx * sx;
+            face_y[i] = sy * sy;
+        }
+        for (int i = 0; i < AMR_BLOCK; i++) {
+            centre_x[i] = sinf(2.0f * GLM_PIf * (ox + (i + 0.5f) * h));
+            centre_y[i] = sinf(2.0f * GLM_PIf * (oy + (i + 0.5f) * h));
+        }
+
+        float flux_x[AMR_BLOCK][AMR_BLOCK + 1], flux_y[AMR_BLOCK + 1][AMR_BLOCK];
+        for (int j = 0; j <= AMR_BLOCK; j++) {
+            for (int i = 0; i <= AMR_BLOCK; i++) {
+                int idx = (j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO;
+                if (j < AMR_BLOCK) {
+                    float u = c * face_x[i] * centre_y[j], courant = u * dt / h;
+                    float slope_l = limit_slope(q[idx - 1] - q[idx - 2], q[idx] - q[idx - 1], LIMITER_MINMOD);
+                    float slope_r = limit_slope(q[idx] - q[idx - 1], q[idx + 1] - q[idx], LIMITER_MINMOD);
+                    float upwind = u > 0.0f ? q[idx - 1] + 0.5f * (1.0f - courant) * slope_l : q[idx] - 0.5f * (1.0f + courant) * slope_r;
+                    flux_x[j][i] = u * upwind;
+                }
+                if (i < AMR_BLOCK) {
+                    int s = AMR_BLOCK_STRIDE;
+                    float v = -c * face_y[j] * centre_x[i], courant = v * dt / h;
+                    float slope_b = limit_slope(q[idx - s] - q[idx - 2 * s], q[idx] - q[idx - s], LIMITER_MINMOD);
+                    float slope_t = limit_slope(q[idx] - q[idx - s], q[idx + s] - q[idx], LIMITER_MINMOD);
+                    float upwind = v > 0.0f ? q[idx - s] + 0.5f * (1.0f - courant) * slope_b : q[idx] - 0.5f * (1.0f + courant) * slope_t;
+                    flux_y[j][i] = v * upwind;
+                }
+            }
+        }
+
+        float ratio = dt / h;
+        for (int j = 0; j < AMR_BLOCK; j++) {
+            for (int i = 0; i < AMR_BLOCK; i++) {
+                int idx = (j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO;
+                out[idx] = q[idx] - ratio * (flux_x[j][i + 1] - flux_x[j][i] + flux_y[j + 1][i] - flux_y[j][i]);
+            }
+        }
+    }
+}
+
+// Undivided density jump (halo included, so edges between blocks count) and |vorticity| * h
+void amr_indicator_blocks(void *ctx, int begin, int end) {
+    Amr_Grid *amr = ctx;
+
+    for (int k = begin; k < end; k++) {
+        Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+        float h = 1.0f / (float)(AMR_ROOTS * AMR_BLOCK << leaf->level);
+        float ox = leaf->x * AMR_BLOCK * h, oy = leaf->y * AMR_BLOCK * h;
+        const float *q = amr->data + leaf->block * AMR_BLOCK_AREA;
+
+        float jump = 0.0f, vorticity = 0.0f;
+        for (int j = -1; j < AMR_BLOCK; j++) {
+            for (int i = -1; i < AMR_BLOCK; i++) {
+                int idx = (j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO;
+                jump = glm_max(jump, glm_max(fabsf(q[idx + 1] - q[idx]), fabsf(q[idx + AMR_BLOCK_STRIDE] - q[idx])));
+                if (i < 0 || j < 0) continue;
+                float u, v, w;
+                amr_swirl(amr, ox + (i + 0.5f) * h, oy + (j + 0.5f) * h, &u, &v, &w);
+                vorticity = glm_max(vorticity, fabsf(w) * h);
+            }
+        }
+        leaf->density_jump = jump;
+        leaf->vorticity = vorticity;
+    }
+}
+
+void amr_set_initial_blocks(void *ctx, int begin, int end) {
+    Amr_Grid *amr = ctx;
+
+    for (int k = begin; k < end; k++) {
+        Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+        float h = 1.0f / (float)(AMR_ROOTS * AMR_BLOCK << leaf->level);
+        float *block = amr->data + leaf->block * AMR_BLOCK_AREA;
+        for (int j = 0; j < AMR_BLOCK; j++) {
+            for (int i = 0; i < AMR_BLOCK; i++) {
+                float x = (leaf->x * AMR_BLOCK + i + 0.5f) * h, y = (leaf->y * AMR_BLOCK + j + 0.5f) * h;
+                block[(j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO] = amr_initial_density(x, y);
+            }
+        }
+    }
+}
+
+// Split a leaf into four, each child cell taking its parent cell's value (conservative)
+void amr_refine(Amr_Grid *amr, int node) {
+    int block = amr->nodes[node].block;
+
+    for (int c = 0; c < 4; c++) {
+        Amr_Node parent = amr->nodes[node];
+        int child = amr_alloc_node(amr, parent.level + 1, parent.x * 2 + (c & 1), parent.y * 2 + (c >> 1), node);
+        int child_block = amr_alloc_block(amr);
+        amr->nodes[child].block = child_block;
+        amr->nodes[child].density_jump = parent.density_jump;
+        amr->nodes[child].vorticity = parent.vorticity;
+        amr->nodes[node].children[c] = child;
+
+        const float *src = amr->data + block * AMR_BLOCK_AREA;
+        float *dst = amr->data + child_block * AMR_BLOCK_AREA;
+        int si = (c & 1) * AMR_BLOCK / 2, sj = (c >> 1) * AMR_BLOCK / 2;
+        for (int j = 0; j < AMR_BLOCK; j++) {
+            for (int i = 0; i < AMR_BLOCK; i++) {
+                dst[(j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO] =
+                    src[(sj + j / 2 + AMR_HALO) * AMR_BLOCK_STRIDE + si + i / 2 + AMR_HALO];
+            }
+        }
+    }
+
+    amr->nodes[node].block = -1;
+    amr->free_blocks[amr->free_block_count++] = block;
+}
+
+// Merge four leaf children back into their parent, each parent cell the mean of its 2x2 cells
+void amr_coarsen(Amr_Grid *amr, int node) {
+    int block = amr_alloc_block(amr);
+    float *dst = amr->data + block * AMR_BLOCK_AREA;
+    float jump = 0.0f, vorticity = 0.0f;
+
+    for (int c = 0; c < 4; c++) {
+        Amr_Node *child = &amr->nodes[amr->nodes[node].children[c]];
+        const float *src = amr->data + child->block * AMR_BLOCK_AREA;
+        int di = (c & 1) * AMR_BLOCK / 2, dj = (c >> 1) * AMR_BLOCK / 2;
+        for (int j = 0; j < AMR_BLOCK / 2; j++) {
+            for (int i = 0; i < AMR_BLOCK / 2; i++) {
+                int idx = (2 * j + AMR_HALO) * AMR_BLOCK_STRIDE + 2 * i + AMR_HALO;
+                dst[(dj + j + AMR_HALO) * AMR_BLOCK_STRIDE + di + i + AMR_HALO] =
+                    0.25f * (src[idx] + src[idx + 1] + src[idx + AMR_BLOCK_STRIDE] + src[idx + AMR_BLOCK_STRIDE + 1]);
+            }
+        }
+        jump = glm_max(jump, child->density_jump);
+        vorticity = glm_max(vorticity, child->vorticity);
+
+        amr->free_blocks[amr->free_block_count++] = child->block;
+        amr->free_nodes[amr->free_node_count++] = amr->nodes[node].children[c];
+        child->level = -1;
+        child->block = -1;
+        amr->nodes[node].children[c] = -1;
+    }
+
+    amr->nodes[node].block = block;
+    amr->nodes[node].density_jump = jump;
+    amr->nodes[node].vorticity = vorticity;
+}
+
+// All four children are quiet leaves, and no leaf around the parent is more than one level finer
+// than the merged parent would allow
+bool amr_can_coarsen(Amr_Grid *amr, int node) {
+    Amr_Node *parent = &amr->nodes[node];
+    for (int c = 0; c < 4; c++) {
+        Amr_Node *child = &amr->nodes[parent->children[c]];
+        if (child->children[0] >= 0) return false;
+        if (child->density_jump >= amr->params.coarsen_density || child->vorticity >= amr->params.coarsen_vorticity) return false;
+    }
+
+    // Leaves two levels finer than the parent each span a quarter of its edge
+    float size = 1.0f / (float)(AMR_ROOTS << parent->level);
+    float ox = parent->x * size, oy = parent->y * size, eps = size / (8.0f * AMR_BLOCK);
+    float points[20][2];
+    int count = 0;
+    for (int k = 0; k < 4; k++) {
+        float t = (k + 0.5f) * 0.25f * size;
+        points[count][0] = ox + t, points[count++][1] = oy - eps;
+        points[count][0] = ox + t, points[count++][1] = oy + size + eps;
+        points[count][0] = ox - eps, points[count++][1] = oy + t;
+        points[count][0] = ox + size + eps, points[count++][1] = oy + t;
+        points[count][0] = k & 1 ? ox + size + eps : ox - eps, points[count++][1] = k & 2 ? oy + size + eps : oy - eps;
+    }
+    for (int k = 0; k < count; k++) {
+        float x = points[k][0], y = points[k][1];
+        if (x < 0.0f || x >= 1.0f || y < 0.0f || y >= 1.0f) continue;
+        if (amr->nodes[amr_find_leaf(amr, x, y)].level > parent->level + 1) return false;
+    }
+    return true;
+}
+
+// 2:1 balance: refine any leaf more than one level coarser than a neighbour, until none is. A
+// coarser neighbour covers the whole shared edge, so edge midpoints and corners find it.
+void amr_balance(Amr_Grid *amr) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        amr_collect_leaves(amr);
+        for (int k = 0; k < amr->leaf_count; k++) {
+            Amr_Node leaf = amr->nodes[amr->leaves[k]];
+            if (leaf.children[0] >= 0) continue;
+
+            float size = 1.0f / (float)(AMR_ROOTS << leaf.level);
+            float ox = leaf.x * size, oy = leaf.y * size, eps = size / (8.0f * AMR_BLOCK);
+            float points[8][2] = {
+                {ox + 0.5f * size, oy - eps}, {ox + 0.5f * size, oy + size + eps},
+                {ox - eps, oy + 0.5f * size}, {ox + size + eps, oy + 0.5f * size},
+                {ox - eps, oy - eps}, {ox + size + eps, oy - eps},
+                {ox - eps, oy + size + eps}, {ox + size + eps, oy + size + eps},
+            };
+            for (int p = 0; p < 8; p++) {
+                float x = points[p][0], y = points[p][1];
+                if (x < 0.0f || x >= 1.0f || y < 0.0f || y >= 1.0f) continue;
+                int neighbour = amr_find_leaf(amr, x, y);
+                if (amr->nodes[neighbour].level < leaf.level - 1) {
+                    amr_refine(amr, neighbour);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+void amr_collect_leaves(Amr_Grid *amr) {
+    amr->leaf_count = 0;
+    amr->finest_level = 0;
+    for (int node = 0; node < amr->node_count; node++) {
+        Amr_Node *n = &amr->nodes[node];
+        if (n->level < 0 || n->children[0] >= 0) continue;
+        amr->leaves[amr->leaf_count++] = node;
+        amr->finest_level = glm_max(amr->finest_level, n->level);
+    }
+}
+
+void amr_regrid(Amr_Grid *amr) {
+    Perf_Scope scope = perf_zone_begin("amr regrid");
+    Kernel_Tuning tuning = g_tuning[TUNE_STENCIL];
+    parallel_for(0, amr->leaf_count, tuning, amr_fill_halo_blocks, amr);
+    parallel_for(0, amr->leaf_count, tuning, amr_indicator_blocks, amr);
+
+    // Coarsen first, on indicators measured by the children; at most one level per regrid
+    int leaf_count = amr->leaf_count;
+    for (int k = 0; k < leaf_count; k++) {
+        int parent = amr->nodes[amr->leaves[k]].parent;
+        if (parent < 0 || amr->nodes[parent].children[0] < 0) continue;
+        if (amr_can_coarsen(amr, parent)) amr_coarsen(amr, parent);
+    }
+
+    // Refine from a fresh snapshot: coarsening freed node slots that the new children reuse, so
+    // the old list could name a child made in this pass and refine it again
+    amr_collect_leaves(amr);
+    leaf_count = amr->leaf_count;
+    for (int k = 0; k < leaf_count; k++) {
+        int node = amr->leaves[k];
+        Amr_Node *leaf = &amr->nodes[node];
+        if (leaf->level >= amr->params.max_level) continue;
+        if (leaf->density_jump > amr->params.refine_density || leaf->vorticity > amr->params.refine_vorticity) {
+            amr_refine(amr, node);
+        }
+    }
+
+    amr_balance(amr);
+    perf_zone_end(&scope, (uint64_t)amr->leaf_count * AMR_BLOCK * AMR_BLOCK);
+}
+
+// One global step sized by the finest leaf (no subcycling); the swirl never exceeds unit speed
+void step_amr(Amr_Grid *amr) {
+    if (amr->step_count % AMR_REGRID_INTERVAL == 0) amr_regrid(amr);
+
+    Perf_Scope scope = perf_zone_begin("amr step");
+    Kernel_Tuning tuning = g_tuning[TUNE_STENCIL];
+    amr->dt = amr->params.cfl / (float)(AMR_ROOTS * AMR_BLOCK << amr->finest_level);
+    parallel_for(0, amr->leaf_count, tuning, amr_fill_halo_blocks, amr);
+    parallel_for(0, amr->leaf_count, tuning, amr_step_blocks, amr);
+
+    float *swap = amr->data;
+    amr->data = amr->next;
+    amr->next = swap;
+    amr->time += amr->dt;
+    amr->step_count++;
+    perf_zone_end(&scope, (uint64_t)amr->leaf_count * AMR_BLOCK * AMR_BLOCK);
+}
+
+double amr_total_mass(Amr_Grid *amr) {
+    double mass = 0.0;
+    for (int k = 0; k < amr->leaf_count; k++) {
+        Amr_Node *leaf = &amr->nodes[amr->leaves[k]];
+        double h = 1.0 / (AMR_ROOTS * AMR_BLOCK << leaf->level);
+        const float *block = amr->data + leaf->block * AMR_BLOCK_AREA;
+        double sum = 0.0;
+        for (int j = 0; j < AMR_BLOCK; j++) {
+            for (int i = 0; i < AMR_BLOCK; i++) sum += block[(j + AMR_HALO) * AMR_BLOCK_STRIDE + i + AMR_HALO];
+        }
+        mass += sum * h * h;
+    }
+    return mass;
+}
+
+typedef struct Amr_Resample_Job {
+    Amr_Grid *amr;
+    int w, h;
+} Amr_Resample_Job;
+
+// Point-sample the tree at each grid cell's centre, either the density or the leaf's level
+void amr_resample_rows(void *ctx, int begin, int end) {
+    Amr_Resample_Job *job = ctx;
+    Amr_Grid *amr = job->amr;
+    float level_scale = 1.0f / glm_max(amr->params.max_level, 1);
+
+    for (int y = begin; y < end; y++) {
+        for (int x = 0; x < job->w; x++) {
+            float fx = (x + 0.5f) / job->w, fy = (y + 0.5f) / job->h;
+            float value = amr->show_levels ? amr->nodes[amr_find_leaf(amr, fx, fy)].level * level_scale : amr_sample(amr, fx, fy);
+            amr->image[(x + 1) + (y + 1) * (job->w + 2)] = value;
+        }
+    }
+}
+
+void fill_cells_from_amr(Cell_Grid *grid, Amr_Grid *amr) {
+    int w = (int)grid->cols, h = (int)grid->rows;
+    size_t bytes = (size_t)(w + 2) * (h + 2) * sizeof(float);
+    if (amr->image_bytes < bytes) {
+        amr->image = xrealloc(amr->image, bytes, "amr");
+        amr->image_bytes = bytes;
+    }
+
+    Amr_Resample_Job resample = {amr, w, h};
+    parallel_for(0, h, g_tuning[TUNE_RENDER_PREP], amr_resample_rows, &resample);
+    Fill_Cells_Job job = {grid, amr->image, NULL, w, h, w + 2, NULL, 0, 1.0f};
+    parallel_for(0, h, g_tuning[TUNE_RENDER_PREP], fill_cells_rows, &job);
+}
+
+void toggle_amr(Amr_Params params) {
+    if (g_amr.nodes) {
+        destroy_amr(&g_amr);
+        trace_log("AMR disabled");
+        return;
+    }
+
+    initialize_amr(&g_amr, params);
+    int uniform = AMR_ROOTS * AMR_BLOCK << params.max_level;
+    trace_log("AMR: %dx%d blocks of %d^2, levels 0-%d (%d^2 at the finest), %d leaves", AMR_ROOTS, AMR_ROOTS,
+              AMR_BLOCK, params.max_level, uniform, g_amr.leaf_count);
+}
+
+// Work against the uniform grid at the finest resolution. Mass drift comes from the
+// coarse-fine faces, where fluxes are not refluxed.
+void run_amr_bench() {
+    trace_log("AMR bench (%d threads, %d^2 blocks, regrid every %d steps):", g_tuning[TUNE_STENCIL].threads,
+              AMR_BLOCK, AMR_REGRID_INTERVAL);
+    trace_log("  %6s %8s %8s %10s %10s %12s %12s %10s %12s", "levels", "uniform", "leaves", "coverage", "steps/s",
+              "Mcells/s", "uniform eq", "regrid %", "mass drift");
+    for (int max_level = 1; max_level <= 4; max_level++) {
+        Amr_Params params = default_amr_params();
+        params.max_level = max_level;
+        Amr_Grid amr;
+        initialize_amr(&amr, params);
+        double mass = amr_total_mass(&amr);
+
+        reset_perf_zones();
+        int steps = 0;
+        double cells = 0.0;
+        uint64_t start = now_ns();
+        while (steps < 8 || now_ns() - start < 1000000000ull) {
+            step_amr(&amr);
+            cells += (double)amr.leaf_count * AMR_BLOCK * AMR_BLOCK;
+            steps++;
+        }
+        uint64_t elapsed = now_ns() - start;
+        double rate = steps / (elapsed / 1.0e9);
+        int uniform = AMR_ROOTS * AMR_BLOCK << max_level;
+        double coverage = cells / steps / ((double)uniform * uniform);
+
+        trace_log("  %6d %6d^2 %8d %9.1f%% %10.1f %12.1f %12.1f %9.1f%% %12.2g", max_level + 1, uniform, amr.leaf_count,
+                  100.0 * coverage, rate, cells / (elapsed / 1.0e3), rate * uniform * uniform / 1.0e6,
+                  100.0 * perf_zone_wall_ns("amr regrid") / elapsed, fabs(amr_total_mass(&amr) - mass) / mass);
+        destroy_amr(&amr);
+    }
+}
+
+Fluid_Params multiphase_fluid_params() {
+    Fluid_Params params = default_fluid_params();
+    params.scenario = SCENARIO_MULTIPHASE;
+    params.gravity = 0.005f;
+    params.viscosity = 0.0f;
+    params.diffusion = 0.0f;
+    params.inflow_speed = 0.0f;
+    return params;
+}
+
+// Dam break: a water column on the left with a block of oil dropping in from the right
+void initialize_multiphase(Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    size_t cells = (size_t)s * (h + 2);
+    size_t bytes = cells * sizeof(float);
+
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        fluid->phase[k] = xcalloc(cells, "multiphase");
+        fluid->phase_prev[k] = xcalloc(cells, "multiphase");
+    }
+    fluid->rho = xcalloc(bytes, "multiphase");
+    fluid->beta_x = xcalloc(bytes, "multiphase");
+    fluid->beta_y = xcalloc(bytes, "multiphase");
+    fluid->pcg_r = xcalloc(bytes, "multiphase");
+    fluid->pcg_d = xcalloc(bytes, "multiphase");
+    fluid->pcg_q = xcalloc(bytes, "multiphase");
+    fluid->pcg_z = xcalloc(bytes, "multiphase");
+    fluid->row_sums = xcalloc(2 * PHASE_COUNT * (h + 2) * sizeof(double), "multiphase");
+
+    for (int j = 0; j <= h + 1; j++) {
+        for (int i = 0; i <= w + 1; i++) {
+            int idx = i + j * s;
+            Fluid_Phase phase = PHASE_AIR;
+            if (i <= w * 0.4f && j >= h * 0.6f) phase = PHASE_WATER;
+            if (i >= w * 0.6f && i <= w * 0.85f && j >= h * 0.3f && j <= h * 0.5f) phase = PHASE_OIL;
+            fluid->phase[phase][idx] = 255;
+        }
+    }
+
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) {
+            for (int k = 0; k < PHASE_COUNT; k++) fluid->phase_volume[k] += fluid->phase[k][i + j * s];
+        }
+    }
+}
+
+typedef struct Multiphase_Job {
+    Fluid *fluid;
+    double alpha, beta, mean;
+    int phase;
+    double volume_error[PHASE_COUNT];
+    double interface_weight[PHASE_COUNT];
+} Multiphase_Job;
+
+void step_multiphase(Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    uint64_t cells = (uint64_t)w * h;
+
+    // Gravity relative to the lightest phase: taking rho_air * g * y out of the pressure leaves
+    // g * (1 - rho_air / rho), so air carries no hydrostatic load against the lid, where the
+    // collocated gradient can't balance it and leaves odd-even velocity modes behind
+    Perf_Scope scope = perf_zone_begin("multiphase forces");
+    float dv = fluid->params.gravity * fluid->params.dt;
+    for (int j = 1; j <= h; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float rho = 0.0f;
+            for (int k = 0; k < PHASE_COUNT; k++) rho += fluid->phase[k][idx] * g_phase_density[k];
+            fluid->v[idx] += dv * (1.0f - g_phase_density[PHASE_AIR] * 255.0f / rho);
+        }
+    }
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("fluid advect");
+    SWAP_FIELDS(fluid->u_prev, fluid->u);
+    SWAP_FIELDS(fluid->v_prev, fluid->v);
+    fluid_advect(fluid, 1, fluid->u, fluid->u_prev, fluid->u_prev, fluid->v_prev);
+    fluid_advect(fluid, 2, fluid->v, fluid->v_prev, fluid->u_prev, fluid->v_prev);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("multiphase project");
+    multiphase_project(fluid);
+    perf_zone_end(&scope, cells);
+
+    scope = perf_zone_begin("multiphase advect");
+    multiphase_advect_phases(fluid);
+    perf_zone_end(&scope, cells);
+
+    fluid->step_count++;
+}
+
+// Cell densities from the fractions, then face coefficients 1 / rho_face (zero on walls, so
+// the operator needs no ghost values)
+void multiphase_coefficients_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float rho = 0.0f;
+            for (int k = 0; k < PHASE_COUNT; k++) rho += fluid->phase[k][idx] * g_phase_density[k];
+            fluid->rho[idx] = rho * (1.0f / 255.0f);
+        }
+    }
+
+    // Faces need the neighbouring row's density; rows are finished before faces are built
+    // by running this in two parallel_for passes with job->beta as the pass selector
+    if (job->beta == 0.0) return;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 0; i <= w; i++) {
+            int idx = i + j * s;
+            fluid->beta_x[idx] = (i == 0 || i == w) ? 0.0f : 2.0f / (fluid->rho[idx] + fluid->rho[idx + 1]);
+            fluid->beta_y[idx] = (j == h) ? 0.0f : 2.0f / (fluid->rho[idx] + fluid->rho[idx + s]);
+        }
+    }
+}
+
+// Variable-density projection: solve div(1/rho grad p) = div u with conjugate gradients
+// preconditioned by one multigrid V-cycle, then u -= grad p / rho. The solve is warm-started
+// from last step's pressure. Dot products reduce per row and are summed in row order so
+// results don't depend on the thread count.
+void multiphase_project(Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h;
+    Multiphase_Job job = {0};
+    job.fluid = fluid;
+    double *sums = fluid->row_sums;
+    double *sums2 = fluid->row_sums + (h + 2);
+
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], multiphase_coefficients_rows, &job);
+    job.beta = 1.0;
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], multiphase_coefficients_rows, &job);
+    for (int i = 0; i <= w; i++) fluid->beta_y[i] = 0.0f;
+    mg_build_levels(fluid);
+
+    // Right-hand side (into pcg_r) with its row sums for the compatibility shift
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], multiphase_divergence_rows, &job);
+    fluid_set_boundary(fluid, 0, fluid->pressure);
+    double total = 0.0;
+    for (int j = 1; j <= h; j++) total += sums[j];
+    job.mean = total / ((double)w * h);
+
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_init_rows, &job);
+    double rhs_norm2 = 0.0, residual2 = 0.0;
+    for (int j = 1; j <= h; j++) {
+        rhs_norm2 += sums[j];
+        residual2 += sums2[j];
+    }
+
+    // Relative tolerance 1e-4 on the residual 2-norm
+    double tolerance2 = rhs_norm2 * 1.0e-8;
+    double delta = 0.0;
+    int iteration = 0;
+    if (residual2 > tolerance2) {
+        mg_v_cycle(fluid->mg_levels, fluid->mg_level_count);
+        job.beta = 0.0;
+        parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_direction_rows, &job);
+        for (int j = 1; j <= h; j++) delta += sums[j];
+    }
+
+    while (iteration < PCG_MAX_ITERATIONS && residual2 > tolerance2 && delta > 0.0) {
+        parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_apply_rows, &job);
+        double dq = 0.0;
+        for (int j = 1; j <= h; j++) dq += sums[j];
+        if (dq <= 0.0) break;
+
+        job.alpha = delta / dq;
+        parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_update_rows, &job);
+        residual2 = 0.0;
+        for (int j = 1; j <= h; j++) residual2 += sums[j];
+        iteration++;
+        if (residual2 <= tolerance2) break;
+
+        mg_v_cycle(fluid->mg_levels, fluid->mg_level_count);
+        parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_dot_rows, &job);
+        double delta_next = 0.0;
+        for (int j = 1; j <= h; j++) delta_next += sums[j];
+
+        job.beta = delta_next / delta;
+        delta = delta_next;
+        parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], pcg_direction_rows, &job);
+    }
+    fluid->pcg_iterations = iteration;
+    fluid->pcg_residual = rhs_norm2 > 0.0 ? (float)sqrt(residual2 / rhs_norm2) : 0.0f;
+
+    fluid_set_boundary(fluid, 0, fluid->pressure);
+    parallel_for(1, h + 1, g_tuning[TUNE_STENCIL], multiphase_subtract_gradient_rows, &job);
+    fluid_set_boundary(fluid, 1, fluid->u);
+    fluid_set_boundary(fluid, 2, fluid->v);
+}
+
+void multiphase_divergence_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+    float n = (float)glm_max(w, fluid->params.h);
+
+    for (int j = begin; j < end; j++) {
+        double sum = 0.0;
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float div = -0.5f * (fluid->u[idx + 1] - fluid->u[idx - 1] + fluid->v[idx + s] - fluid->v[idx - s]) / n;
+            fluid->pcg_r[idx] = div;
+            sum += div;
+        }
+        fluid->row_sums[j] = sum;
+    }
+}
+
+// (A x)[idx] for the face-coefficient operator; wall faces carry zero coefficients
+static inline float mg_apply(float *x, float *bx, float *by, int idx, int s) {
+    return bx[idx - 1] * (x[idx] - x[idx - 1]) + bx[idx] * (x[idx] - x[idx + 1]) +
+           by[idx - s] * (x[idx] - x[idx - s]) + by[idx] * (x[idx] - x[idx + s]);
+}
+
+// r = (b - mean) - A p; returns |b - mean|^2 and |r|^2 per row
+void pcg_init_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float mean = (float)job->mean;
+
+    for (int j = begin; j < end; j++) {
+        double bb = 0.0, rr = 0.0;
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float b = fluid->pcg_r[idx] - mean;
+            float r = b - mg_apply(fluid->pressure, fluid->beta_x, fluid->beta_y, idx, s);
+            fluid->pcg_r[idx] = r;
+            bb += b * b;
+            rr += r * r;
+        }
+        fluid->row_sums[j] = bb;
+        fluid->row_sums[h + 2 + j] = rr;
+    }
+}
+
+// q = A d and d.q
+void pcg_apply_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+
+    for (int j = begin; j < end; j++) {
+        double dq = 0.0;
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float q = mg_apply(fluid->pcg_d, fluid->beta_x, fluid->beta_y, idx, s);
+            fluid->pcg_q[idx] = q;
+            dq += fluid->pcg_d[idx] * q;
+        }
+        fluid->row_sums[j] = dq;
+    }
+}
+
+// p += alpha d, r -= alpha q, and r.r
+void pcg_update_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+    float alpha = (float)job->alpha;
+
+    for (int j = begin; j < end; j++) {
+        double rr = 0.0;
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            fluid->pressure[idx] += alpha * fluid->pcg_d[idx];
+            float r = fluid->pcg_r[idx] - alpha * fluid->pcg_q[idx];
+            fluid->pcg_r[idx] = r;
+            rr += r * r;
+        }
+        fluid->row_sums[j] = rr;
+    }
+}
+
+// r.z with z the preconditioned residual
+void pcg_dot_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+
+    for (int j = begin; j < end; j++) {
+        double rz = 0.0;
+        for (int i = 1; i <= w; i++) rz += fluid->pcg_r[i + j * s] * fluid->pcg_z[i + j * s];
+        fluid->row_sums[j] = rz;
+    }
+}
+
+// d = z + beta d; with beta = 0 this starts the iteration and also returns r.z
+void pcg_direction_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+    float beta = (float)job->beta;
+
+    for (int j = begin; j < end; j++) {
+        double rz = 0.0;
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            fluid->pcg_d[idx] = fluid->pcg_z[idx] + beta * fluid->pcg_d[idx];
+            rz += fluid->pcg_r[idx] * fluid->pcg_z[idx];
+        }
+        if (beta == 0.0f) fluid->row_sums[j] = rz;
+    }
+}
+
+// Level 0 aliases the fluid's coefficients, with the PCG residual as right-hand side and z as
+// the solution. Coarser levels halve both dimensions while they stay even; each coarse face
+// coefficient averages the two fine faces it covers.
+void mg_build_levels(Fluid *fluid) {
+    if (fluid->mg_level_count == 0) {
+        Mg_Level *fine = &fluid->mg_levels[0];
+        fine->w = fluid->params.w;
+        fine->h = fluid->params.h;
+        fine->stride = fluid->stride;
+        fine->beta_x = fluid->beta_x;
+        fine->beta_y = fluid->beta_y;
+        fine->b = fluid->pcg_r;
+        fine->x = fluid->pcg_z;
+        fluid->mg_level_count = 1;
+
+        while (fluid->mg_level_count < MG_MAX_LEVELS) {
+            Mg_Level *prev = &fluid->mg_levels[fluid->mg_level_count - 1];
+            if (prev->w % 2 || prev->h % 2 || prev->w < 8 || prev->h < 8) break;
+
+            Mg_Level *level = &fluid->mg_levels[fluid->mg_level_count++];
+            level->w = prev->w / 2;
+            level->h = prev->h / 2;
+            level->stride = level->w + 2;
+            size_t bytes = (size_t)level->stride * (level->h + 2) * sizeof(float);
+            level->beta_x = xcalloc(bytes, "multiphase");
+            level->beta_y = xcalloc(bytes, "multiphase");
+            level->b = xcalloc(bytes, "multiphase");
+            level->x = xcalloc(bytes, "multiphase");
+        }
+    }
+
+    for (int l = 1; l < fluid->mg_level_count; l++) {
+        Mg_Level *fine = &fluid->mg_levels[l - 1], *coarse = &fluid->mg_levels[l];
+        int fs = fine->stride, cs = coarse->stride;
+
+        for (int J = 0; J <= coarse->h; J++) {
+            for (int I = 0; I <= coarse->w; I++) {
+                int c = I + J * cs;
+                coarse->beta_x[c] = J == 0 ? 0.0f
+                    : 0.5f * (fine->beta_x[2 * I + (2 * J - 1) * fs] + fine->beta_x[2 * I + 2 * J * fs]);
+                coarse->beta_y[c] = I == 0 ? 0.0f
+                    : 0.5f * (fine->beta_y[2 * I - 1 + 2 * J * fs] + fine->beta_y[2 * I + 2 * J * fs]);
+            }
+        }
+    }
+}
+
+typedef struct Mg_Job {
+    Mg_Level *level, *coarse;
+    int color;
+} Mg_Job;
+
+// Red-black Gauss-Seidel: x = (b + sum beta x_nb) / sum beta on one colour
+void mg_smooth_rows(void *ctx, int begin, int end) {
+    Mg_Job *job = ctx;
+    Mg_Level *level = job->level;
+    int w = level->w, s = level->stride;
+    float *x = level->x, *b = level->b, *bx = level->beta_x, *by = level->beta_y;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1 + ((1 + j + job->color) & 1); i <= w; i += 2) {
+            int idx = i + j * s;
+            float diag = bx[idx - 1] + bx[idx] + by[idx - s] + by[idx];
+            x[idx] = (b[idx] + bx[idx - 1] * x[idx - 1] + bx[idx] * x[idx + 1] +
+                      by[idx - s] * x[idx - s] + by[idx] * x[idx + s]) / diag;
+        }
+    }
+}
+
+// Fine residual summed over each 2x2 block straight into the coarse right-hand side
+void mg_restrict_rows(void *ctx, int begin, int end) {
+    Mg_Job *job = ctx;
+    Mg_Level *fine = job->level, *coarse = job->coarse;
+    int fs = fine->stride, cs = coarse->stride;
+
+    for (int J = begin; J < end; J++) {
+        for (int I = 1; I <= coarse->w; I++) {
+            float sum = 0.0f;
+            for (int dj = 0; dj < 2; dj++) {
+                for (int di = 0; di < 2; di++) {
+                    int idx = 2 * I - 1 + di + (2 * J - 1 + dj) * fs;
+                    sum += fine->b[idx] - mg_apply(fine->x, fine->beta_x, fine->beta_y, idx, fs);
+                }
+            }
+            coarse->b[I + J * cs] = sum;
+            coarse->x[I + J * cs] = 0.0f;
+        }
+    }
+}
+
+void mg_prolong_rows(void *ctx, int begin, int end) {
+    Mg_Job *job = ctx;
+    Mg_Level *fine = job->level, *coarse = job->coarse;
+    int fs = fine->stride, cs = coarse->stride;
+
+    for (int j = begin; j < end; j++) {
+        float *xc = coarse->x + ((j + 1) / 2) * cs;
+        for (int i = 1; i <= fine->w; i++) fine->x[i + j * fs] += xc[(i + 1) / 2];
+    }
+}
+
+void mg_smooth(Mg_Level *level, int first_color, int sweeps) {
+    Mg_Job job = {level, NULL, 0};
+    for (int sweep = 0; sweep < sweeps; sweep++) {
+        for (int c = 0; c < 2; c++) {
+            job.color = first_color ^ c;
+            parallel_for(1, level->h + 1, g_tuning[TUNE_STENCIL], mg_smooth_rows, &job);
+        }
+    }
+}
+
+// Symmetric V-cycle (red-black before, black-red after) so CG sees a symmetric preconditioner
+void mg_v_cycle(Mg_Level *levels, int level_count) {
+    Mg_Level *fine = &levels[0];
+    size_t bytes = (size_t)fine->stride * (fine->h + 2) * sizeof(float);
+    memset(fine->x, 0, bytes);
+
+    for (int l = 0; l < level_count - 1; l++) {
+        Mg_Job job = {&levels[l], &levels[l + 1], 0};
+        mg_smooth(&levels[l], 0, 2);
+        parallel_for(1, levels[l + 1].h + 1, g_tuning[TUNE_STENCIL], mg_restrict_rows, &job);
+    }
+
+    Mg_Level *coarsest = &levels[level_count - 1];
+    for (int sweep = 0; sweep < 8; sweep++) {
+        mg_smooth(coarsest, 0, 2);
+        mg_smooth(coarsest, 1, 2);
+    }
+
+    for (int l = level_count - 2; l >= 0; l--) {
+        Mg_Job job = {&levels[l], &levels[l + 1], 0};
+        parallel_for(1, levels[l].h + 1, g_tuning[TUNE_STENCIL], mg_prolong_rows, &job);
+        mg_smooth(&levels[l], 1, 2);
+    }
+}
+
+void multiphase_subtract_gradient_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+    float n = (float)glm_max(w, fluid->params.h);
+    float *p = fluid->pressure;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float scale = 0.5f * n / fluid->rho[idx];
+            fluid->u[idx] -= scale * (p[idx + 1] - p[idx - 1]);
+            fluid->v[idx] -= scale * (p[idx + s] - p[idx - s]);
+        }
+    }
+}
+
+// Fractions advect with MacCormack (forward + backward semi-Lagrangian, corrected and clamped
+// to the forward sample's neighbourhood), which keeps interfaces a couple of cells wide where
+// plain bilinear smears them out within a few hundred steps. Semi-Lagrangian transport isn't
+// conservative, so the drift of each phase's total volume is then put back into its
+// interface cells.
+void multiphase_advect_phases(Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    Multiphase_Job job = {0};
+    job.fluid = fluid;
+
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        uint8_t *tmp = fluid->phase[k];
+        fluid->phase[k] = fluid->phase_prev[k];
+        fluid->phase_prev[k] = tmp;
+    }
+
+    // The last phase is whatever the others leave over
+    for (job.phase = 0; job.phase < PHASE_COUNT - 1; job.phase++) {
+        parallel_for(1, h + 1, g_tuning[TUNE_ADVECT], multiphase_forward_rows, &job);
+        fluid_set_boundary(fluid, 0, fluid->scratch);
+        parallel_for(1, h + 1, g_tuning[TUNE_ADVECT], multiphase_correct_rows, &job);
+    }
+
+    parallel_for(1, h + 1, g_tuning[TUNE_ADVECT], multiphase_normalize_rows, &job);
+    double *volume = fluid->row_sums, *weight = fluid->row_sums + PHASE_COUNT * (h + 2);
+    for (int k = 0; k < PHASE_COUNT - 1; k++) {
+        double total = 0.0, total_weight = 0.0;
+        for (int j = 1; j <= h; j++) {
+            total += volume[k * (h + 2) + j];
+            total_weight += weight[k * (h + 2) + j];
+        }
+        job.volume_error[k] = fluid->phase_volume[k] - total;
+        job.interface_weight[k] = total_weight;
+    }
+    parallel_for(1, h + 1, g_tuning[TUNE_ADVECT], multiphase_conserve_rows, &job);
+
+    // Closed box: ghost cells copy their interior neighbour
+    for (int k = 0; k < PHASE_COUNT; k++) {
+        uint8_t *f = fluid->phase[k];
+        for (int j = 1; j <= h; j++) {
+            f[0 + j * s] = f[1 + j * s];
+            f[w + 1 + j * s] = f[w + j * s];
+        }
+        memcpy(f, f + s, s);
+        memcpy(f + (h + 1) * s, f + h * s, s);
+    }
+}
+
+static inline float sample_phase(uint8_t *f, float x, float y, int s, float *lo, float *hi) {
+    int i0 = (int)x, j0 = (int)y;
+    float s1 = x - i0, s0 = 1.0f - s1;
+    float t1 = y - j0, t0 = 1.0f - t1;
+    int k = i0 + j0 * s;
+    float a = f[k], b = f[k + s], c = f[k + 1], d = f[k + 1 + s];
+    if (lo) {
+        *lo = glm_min(glm_min(a, b), glm_min(c, d));
+        *hi = glm_max(glm_max(a, b), glm_max(c, d));
+    }
+    return s0 * (t0 * a + t1 * b) + s1 * (t0 * c + t1 * d);
+}
+
+// Forward step into scratch (still in 0..255 units)
+void multiphase_forward_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float dt0 = fluid->params.dt * glm_max(w, h);
+    uint8_t *f = fluid->phase_prev[job->phase];
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float x = glm_clamp(i - dt0 * fluid->u[idx], 0.5f, w + 0.5f);
+            float y = glm_clamp(j - dt0 * fluid->v[idx], 0.5f, h + 0.5f);
+            fluid->scratch[idx] = sample_phase(f, x, y, s, NULL, NULL);
+        }
+    }
+}
+
+// Backward step from the forward result, half the round-trip error added back, clamped to the
+// values the forward step interpolated between
+void multiphase_correct_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float dt0 = fluid->params.dt * glm_max(w, h);
+    uint8_t *f = fluid->phase_prev[job->phase];
+    float *forward = fluid->scratch;
+
+    for (int j = begin; j < end; j++) {
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            float lo, hi;
+            float x = glm_clamp(i - dt0 * fluid->u[idx], 0.5f, w + 0.5f);
+            float y = glm_clamp(j - dt0 * fluid->v[idx], 0.5f, h + 0.5f);
+            sample_phase(f, x, y, s, &lo, &hi);
+
+            float bx = glm_clamp(i + dt0 * fluid->u[idx], 0.5f, w + 0.5f);
+            float by = glm_clamp(j + dt0 * fluid->v[idx], 0.5f, h + 0.5f);
+            int i0 = (int)bx, j0 = (int)by;
+            float s1 = bx - i0, s0 = 1.0f - s1;
+            float t1 = by - j0, t0 = 1.0f - t1;
+            int k = i0 + j0 * s;
+            float back = s0 * (t0 * forward[k] + t1 * forward[k + s]) + s1 * (t0 * forward[k + 1] + t1 * forward[k + 1 + s]);
+
+            float value = glm_clamp(forward[idx] + 0.5f * (f[idx] - back), lo, hi);
+            fluid->phase[job->phase][idx] = (uint8_t)(value + 0.5f);
+        }
+    }
+}
+
+// Fill the last phase with what's left (trimming the others if they overshoot 255) and
+// gather per-row volume and interface weight f * (255 - f) for each phase
+void multiphase_normalize_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    double *volume = fluid->row_sums, *weight = fluid->row_sums + PHASE_COUNT * (h + 2);
+
+    for (int j = begin; j < end; j++) {
+        double row_volume[PHASE_COUNT] = {0}, row_weight[PHASE_COUNT] = {0};
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            int remaining = 255;
+            for (int k = 0; k < PHASE_COUNT - 1; k++) {
+                int value = glm_min(fluid->phase[k][idx], remaining);
+                fluid->phase[k][idx] = (uint8_t)value;
+                remaining -= value;
+            }
+            fluid->phase[PHASE_COUNT - 1][idx] = (uint8_t)remaining;
+
+            for (int k = 0; k < PHASE_COUNT; k++) {
+                int f = fluid->phase[k][idx];
+                row_volume[k] += f;
+                row_weight[k] += f * (255 - f);
+            }
+        }
+        for (int k = 0; k < PHASE_COUNT; k++) {
+            volume[k * (h + 2) + j] = row_volume[k];
+            weight[k * (h + 2) + j] = row_weight[k];
+        }
+    }
+}
+
+// Spread each phase's volume error over its interface cells in proportion to f * (255 - f).
+// The rounding remainder carries along the row so small corrections aren't lost to rounding.
+void multiphase_conserve_rows(void *ctx, int begin, int end) {
+    Multiphase_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, s = fluid->stride;
+
+    for (int j = begin; j < end; j++) {
+        float carry[PHASE_COUNT] = {0};
+        for (int i = 1; i <= w; i++) {
+            int idx = i + j * s;
+            int remaining = 255;
+            for (int k = 0; k < PHASE_COUNT - 1; k++) {
+                int f = fluid->phase[k][idx];
+                float delta = job->interface_weight[k] > 0.0
+                    ? (float)(job->volume_error[k] * (f * (255 - f)) / job->interface_weight[k]) : 0.0f;
+                delta += carry[k];
+                int step = (int)floorf(delta + 0.5f);
+                int value = glm_clamp(f + step, 0, remaining);
+                carry[k] = delta - (value - f);
+                fluid->phase[k][idx] = (uint8_t)value;
+                remaining -= value;
+            }
+            fluid->phase[PHASE_COUNT - 1][idx] = (uint8_t)remaining;
+        }
+    }
+}
+
+void run_multiphase_bench() {
+    Fluid_Params cases[2] = {default_fluid_params(), multiphase_fluid_params()};
+
+    trace_log("Multiphase bench (%dx%d, %d steps):", cases[0].w, cases[0].h, BENCH_STEP_COUNT);
+    trace_log("  %-12s %10s %12s %10s %10s", "case", "ms/step", "project ms", "CG iters", "residual");
+    for (int c = 0; c < 2; c++) {
+        Fluid fluid;
+        initialize_fluid(&fluid, cases[c]);
+        reset_perf_zones();
+
+        uint64_t project_ns = 0;
+        double iterations = 0.0, residual = 0.0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < BENCH_STEP_COUNT; i++) {
+            step_fluid(&fluid);
+            iterations += fluid.pcg_iterations;
+            residual = glm_max(residual, fluid.pcg_residual);
+        }
+        double elapsed_ms = (now_ns() - start) / 1.0e6;
+
+        project_ns = perf_zone_wall_ns("fluid project") + perf_zone_wall_ns("multiphase project");
+
+        bool multiphase = cases[c].scenario == SCENARIO_MULTIPHASE;
+        trace_log("  %-12s %10.3f %12.3f %10.1f %10.1e", multiphase ? "multiphase" : "single",
+                  elapsed_ms / BENCH_STEP_COUNT, project_ns / 1.0e6 / BENCH_STEP_COUNT,
+                  multiphase ? iterations / BENCH_STEP_COUNT : (double)cases[c].iterations, multiphase ? residual : 0.0);
+
+        if (multiphase) {
+            int w = fluid.params.w, h = fluid.params.h;
+            size_t cells = (size_t)fluid.stride * (h + 2);
+            trace_log("  fractions    %zu KB as 8-bit (%d phases, double-buffered) vs %zu KB as float",
+                      2 * PHASE_COUNT * cells / 1024, PHASE_COUNT, 2 * PHASE_COUNT * cells * sizeof(float) / 1024);
+            for (int k = 0; k < PHASE_COUNT; k++) {
+                long long volume = 0;
+                for (int j = 1; j <= h; j++) {
+                    for (int i = 1; i <= w; i++) volume += fluid.phase[k][i + j * fluid.stride];
+                }
+                trace_log("  %-12s volume %.1f cells", g_phase_names[k], volume / 255.0);
+            }
+        }
+        destroy_fluid(&fluid);
+    }
+}
+
+// xorshift32; deterministic so scenes and benchmarks repeat exactly
+float random_float(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+void initialize_body_world(Body_World *world, Fluid *fluid, int count) {
+    *world = (Body_World){0};
+    world->rng = 0x9e3779b9u;
+    world->bodies = xcalloc(count * sizeof(Rigid_Body), "bodies");
+    world->order = xmalloc(count * sizeof(int), "bodies");
+
+    int w = fluid->params.w, h = fluid->params.h;
+    for (int n = 0; n < count; n++) {
+        Rigid_Body *body = &world->bodies[n];
+        body->shape = (Body_Shape)(n % BODY_SHAPE_COUNT);
+        body->radius = 1.2f + 1.3f * random_float(&world->rng);
+        body->angle = 6.2831853f * random_float(&world->rng);
+
+        float area = 0.0f;
+        if (body->shape == BODY_CIRCLE) {
+            area = GLM_PIf * body->radius * body->radius;
+        } else {
+            if (body->shape == BODY_BOX) {
+                float hw = body->radius * 0.8f, hh = body->radius * (0.35f + 0.4f * random_float(&world->rng));
+                body->vertex_count = 4;
+                glm_vec2_copy((vec2){-hw, -hh}, body->local[0]);
+                glm_vec2_copy((vec2){hw, -hh}, body->local[1]);
+                glm_vec2_copy((vec2){hw, hh}, body->local[2]);
+                glm_vec2_copy((vec2){-hw, hh}, body->local[3]);
+            } else {
+                body->vertex_count = 5 + (int)(3.0f * random_float(&world->rng));
+                for (int v = 0; v < body->vertex_count; v++) {
+                    float a = 6.2831853f * (v + 0.3f * random_float(&world->rng)) / body->vertex_count;
+                    float r = body->radius * (0.75f + 0.25f * random_float(&world->rng));
+                    glm_vec2_copy((vec2){r * cosf(a), r * sinf(a)}, body->local[v]);
+                }
+            }
+            for (int v = 0; v < body->vertex_count; v++) {
+                float *p0 = body->local[v], *p1 = body->local[(v + 1) % body->vertex_count];
+                area += 0.5f * (p0[0] * p1[1] - p1[0] * p0[1]);
+            }
+        }
+        body->inv_mass = 1.0f / area;
+        // Disc approximation of the moment of inertia is plenty for stirred debris
+        body->inv_inertia = 2.0f / (area * body->radius * body->radius);
+
+        // Rejection-sample a free spot; dense scenes fall back to overlap and let contacts sort it out
+        for (int attempt = 0; attempt < 64; attempt++) {
+            body->pos[0] = 4.0f + (w - 8.0f) * random_float(&world->rng);
+            body->pos[1] = 4.0f + (h - 8.0f) * random_float(&world->rng);
+            bool free = true;
+            for (int other = 0; other < n && free; other++) {
+                float dx = world->bodies[other].pos[0] - body->pos[0], dy = world->bodies[other].pos[1] - body->pos[1];
+                float r = world->bodies[other].radius + body->radius;
+                free = dx * dx + dy * dy > r * r;
+            }
+            if (free) break;
+        }
+
+        update_body_geometry(body);
+        world->order[n] = n;
+    }
+    world->count = count;
+
+    rasterize_bodies(world, fluid);
+    trace_log("Bodies: %d (circles, boxes, polygons)", count);
+}
+
+void destroy_body_world(Body_World *world) {
+    xfree(world->bodies);
+    xfree(world->order);
+    *world = (Body_World){0};
+}
+
+void update_body_geometry(Rigid_Body *body) {
+    if (body->shape == BODY_CIRCLE) {
+        body->min_x = body->pos[0] - body->radius;
+        body->max_x = body->pos[0] + body->radius;
+        body->min_y = body->pos[1] - body->radius;
+        body->max_y = body->pos[1] + body->radius;
+        return;
+    }
+
+    float c = cosf(body->angle), s = sinf(body->angle);
+    body->min_x = body->min_y = 1e30f;
+    body->max_x = body->max_y = -1e30f;
+    for (int v = 0; v < body->vertex_count; v++) {
+        float *l = body->local[v], *p = body->world[v];
+        p[0] = body->pos[0] + c * l[0] - s * l[1];
+        p[1] = body->pos[1] + s * l[0] + c * l[1];
+        body->min_x = glm_min(body->min_x, p[0]);
+        body->max_x = glm_max(body->max_x, p[0]);
+        body->min_y = glm_min(body->min_y, p[1]);
+        body->max_y = glm_max(body->max_y, p[1]);
+    }
+}
+
+bool body_contains(Rigid_Body *body, float x, float y) {
+    if (body->shape == BODY_CIRCLE) {
+        float dx = x - body->pos[0], dy = y - body->pos[1];
+        return dx * dx + dy * dy <= body->radius * body->radius;
+    }
+    for (int v = 0; v < body->vertex_count; v++) {
+        float *p0 = body->world[v], *p1 = body->world[(v + 1) % body->vertex_count];
+        if ((p1[0] - p0[0]) * (y - p0[1]) - (p1[1] - p0[1]) * (x - p0[0]) < 0.0f) return false;
+    }
+    return true;
+}
+
+typedef struct Body_Force_Job {
+    Body_World *world;
+    Fluid *fluid;
+} Body_Force_Job;
+
+// Impulse from the fluid over each body's boundary faces: pressure from the last projection
+// plus a drag toward the neighbouring fluid velocity. Each body only reads the fluid, so
+// bodies run in parallel.
+void body_fluid_forces_rows(void *ctx, int begin, int end) {
+    static const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+    Body_Force_Job *job = ctx;
+    Fluid *fluid = job->fluid;
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float n = (float)glm_max(w, h);
+    float dt0 = fluid->params.dt * n;
+    float pressure_scale = 0.5f * n * dt0;
+    float drag = 0.1f;
+
+    for (int b = begin; b < end; b++) {
+        Rigid_Body *body = &job->world->bodies[b];
+        float fx = 0.0f, fy = 0.0f, torque = 0.0f;
+
+        int i0 = glm_max(1, (int)floorf(body->min_x)), i1 = glm_min(w, (int)ceilf(body->max_x));
+        int j0 = glm_max(1, (int)floorf(body->min_y)), j1 = glm_min(h, (int)ceilf(body->max_y));
+        for (int j = j0; j <= j1; j++) {
+            for (int i = i0; i <= i1; i++) {
+                if (!body_contains(body, (float)i, (float)j)) continue;
+
+                for (int d = 0; d < 4; d++) {
+                    int ni = i + offsets[d][0], nj = j + offsets[d][1];
+                    if (ni < 1 || ni > w || nj < 1 || nj > h) continue;
+                    int nidx = ni + nj * s;
+                    if (fluid->solid[nidx]) continue;
+
+                    float rx = i + 0.5f * offsets[d][0] - body->pos[0];
+                    float ry = j + 0.5f * offsets[d][1] - body->pos[1];
+                    float surface_u = body->vel[0] - body->spin * ry;
+                    float surface_v = body->vel[1] + body->spin * rx;
+
+                    float face_x = -pressure_scale * fluid->pressure[nidx] * offsets[d][0] +
+                                   drag * (fluid->u[nidx] * dt0 - surface_u);
+                    float face_y = -pressure_scale * fluid->pressure[nidx] * offsets[d][1] +
+                                   drag * (fluid->v[nidx] * dt0 - surface_v);
+                    fx += face_x;
+                    fy += face_y;
+                    torque += rx * face_y - ry * face_x;
+                }
+            }
+        }
+
+        body->impulse[0] = fx;
+        body->impulse[1] = fy;
+        body->angular_impulse = torque;
+    }
+}
+
+bool collide_bodies(Rigid_Body *a, Rigid_Body *b, Body_Contact *contact) {
+    if (a->shape == BODY_CIRCLE && b->shape == BODY_CIRCLE) {
+        float dx = b->pos[0] - a->pos[0], dy = b->pos[1] - a->pos[1];
+        float r = a->radius + b->radius;
+        float dist2 = dx * dx + dy * dy;
+        if (dist2 >= r * r) return false;
+
+        float dist = sqrtf(dist2);
+        contact->normal[0] = dist > 1e-6f ? dx / dist : 1.0f;
+        contact->normal[1] = dist > 1e-6f ? dy / dist : 0.0f;
+        contact->depth = r - dist;
+        contact->point[0] = a->pos[0] + contact->normal[0] * a->radius;
+        contact->point[1] = a->pos[1] + contact->normal[1] * a->radius;
+        return true;
+    }
+
+    if (a->shape == BODY_CIRCLE || b->shape == BODY_CIRCLE) {
+        bool flip = a->shape == BODY_CIRCLE;
+        Rigid_Body *poly = flip ? b : a, *circle = flip ? a : b;
+
+        // Face of least penetration; vertex regions are treated as their adjacent face
+        float best = -1e30f;
+        vec2 normal = {0};
+        for (int v = 0; v < poly->vertex_count; v++) {
+            float *p0 = poly->world[v], *p1 = poly->world[(v + 1) % poly->vertex_count];
+            float ex = p1[0] - p0[0], ey = p1[1] - p0[1];
+            float len = sqrtf(ex * ex + ey * ey);
+            float nx = ey / len, ny = -ex / len;
+            float separation = nx * (circle->pos[0] - p0[0]) + ny * (circle->pos[1] - p0[1]) - circle->radius;
+            if (separation > 0.0f) return false;
+            if (separation > best) {
+                best = separation;
+                normal[0] = nx;
+                normal[1] = ny;
+            }
+        }
+
+        contact->depth = -best;
+        contact->point[0] = circle->pos[0] - normal[0] * circle->radius;
+        contact->point[1] = circle->pos[1] - normal[1] * circle->radius;
+        contact->normal[0] = flip ? -normal[0] : normal[0];
+        contact->normal[1] = flip ? -normal[1] : normal[1];
+        return true;
+    }
+
+    // Separating axis test over both polygons' face normals; the contact point is the deepest
+    // vertex of the incident polygon
+    float best = -1e30f;
+    vec2 normal = {0}, point = {0};
+    bool from_a = true;
+    for (int pass = 0; pass < 2; pass++) {
+        Rigid_Body *ref = pass == 0 ? a : b, *inc = pass == 0 ? b : a;
+        for (int v = 0; v < ref->vertex_count; v++) {
+            float *p0 = ref->world[v], *p1 = ref->world[(v + 1) % ref->vertex_count];
+            float ex = p1[0] - p0[0], ey = p1[1] - p0[1];
+            float len = sqrtf(ex * ex + ey * ey);
+            float nx = ey / len, ny = -ex / len;
+
+            float deepest = 1e30f;
+            int deepest_vertex = 0;
+            for (int k = 0; k < inc->vertex_count; k++) {
+                float d = nx * (inc->world[k][0] - p0[0]) + ny * (inc->world[k][1] - p0[1]);
+                if (d < deepest) {
+                    deepest = d;
+                    deepest_vertex = k;
+                }
+            }
+            if (deepest > 0.0f) return false;
+            if (deepest > best) {
+                best = deepest;
+                normal[0] = nx;
+                normal[1] = ny;
+                glm_vec2_copy(inc->world[deepest_vertex], point);
+                from_a = pass == 0;
+            }
+        }
+    }
+
+    contact->depth = -best;
+    contact->normal[0] = from_a ? normal[0] : -normal[0];
+    contact->normal[1] = from_a ? normal[1] : -normal[1];
+    glm_vec2_copy(point, contact->point);
+    return true;
+}
+
+// Normal impulse with restitution plus a split positional correction; a NULL b is a wall
+void resolve_contact(Rigid_Body *a, Rigid_Body *b, Body_Contact *contact) {
+    const float restitution = 0.3f, slop = 0.02f, correction = 0.6f;
+    float *n = contact->normal;
+
+    float rax = contact->point[0] - a->pos[0], ray = contact->point[1] - a->pos[1];
+    float rbx = b ? contact->point[0] - b->pos[0] : 0.0f, rby = b ? contact->point[1] - b->pos[1] : 0.0f;
+    float inv_mass_b = b ? b->inv_mass : 0.0f, inv_inertia_b = b ? b->inv_inertia : 0.0f;
+
+    float vax = a->vel[0] - a->spin * ray, vay = a->vel[1] + a->spin * rax;
+    float vbx = b ? b->vel[0] - b->spin * rby : 0.0f, vby = b ? b->vel[1] + b->spin * rbx : 0.0f;
+    float vn = (vbx - vax) * n[0] + (vby - vay) * n[1];
+
+    float ra_n = rax * n[1] - ray * n[0], rb_n = rbx * n[1] - rby * n[0];
+    float k = a->inv_mass + inv_mass_b + ra_n * ra_n * a->inv_inertia + rb_n * rb_n * inv_inertia_b;
+
+    if (vn < 0.0f) {
+        float j = -(1.0f + restitution) * vn / k;
+        a->vel[0] -= j * n[0] * a->inv_mass;
+        a->vel[1] -= j * n[1] * a->inv_mass;
+        a->spin -= j * ra_n * a->inv_inertia;
+        if (b) {
+            b->vel[0] += j * n[0] * b->inv_mass;
+            b->vel[1] += j * n[1] * b->inv_mass;
+            b->spin += j * rb_n * b->inv_inertia;
+        }
+    }
+
+    float push = glm_max(contact->depth - slop, 0.0f) * correction / (a->inv_mass + inv_mass_b);
+    a->pos[0] -= push * n[0] * a->inv_mass;
+    a->pos[1] -= push * n[1] * a->inv_mass;
+    update_body_geometry(a);
+    if (b) {
+        b->pos[0] += push * n[0] * b->inv_mass;
+        b->pos[1] += push * n[1] * b->inv_mass;
+        update_body_geometry(b);
+    }
+}
+
+// Walls sit half a cell outside the first and last fluid cells; the deepest point against
+// each wall gets a contact
+void collide_walls(Rigid_Body *body, Fluid *fluid) {
+    float lo_x = 0.5f, hi_x = fluid->params.w + 0.5f;
+    float lo_y = 0.5f, hi_y = fluid->params.h + 0.5f;
+    static const float normals[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+    for (int wall = 0; wall < 4; wall++) {
+        float depth = 0.0f;
+        vec2 point = {0};
+        if (body->shape == BODY_CIRCLE) {
+            point[0] = body->pos[0] + normals[wall][0] * body->radius;
+            point[1] = body->pos[1] + normals[wall][1] * body->radius;
+        } else {
+            float extreme = -1e30f;
+            for (int v = 0; v < body->vertex_count; v++) {
+                float d = normals[wall][0] * body->world[v][0] + normals[wall][1] * body->world[v][1];
+                if (d > extreme) {
+                    extreme = d;
+                    glm_vec2_copy(body->world[v], point);
+                }
+            }
+        }
+
+        if (wall == 0) depth = lo_x - point[0];
+        if (wall == 1) depth = point[0] - hi_x;
+        if (wall == 2) depth = lo_y - point[1];
+        if (wall == 3) depth = point[1] - hi_y;
+        if (depth <= 0.0f) continue;
+
+        Body_Contact contact = {{normals[wall][0], normals[wall][1]}, {point[0], point[1]}, depth};
+        resolve_contact(body, NULL, &contact);
+    }
+}
+
+void sweep_and_prune(Body_World *world) {
+    Rigid_Body *bodies = world->bodies;
+    int *order = world->order;
+
+    for (int i = 1; i < world->count; i++) {
+        int index = order[i];
+        float key = bodies[index].min_x;
+        int j = i - 1;
+        while (j >= 0 && bodies[order[j]].min_x > key) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = index;
+    }
+
+    for (int i = 0; i < world->count; i++) {
+        Rigid_Body *a = &bodies[order[i]];
+        for (int j = i + 1; j < world->count; j++) {
+            Rigid_Body *b = &bodies[order[j]];
+            if (b->min_x > a->max_x) break;
+            if (b->min_y > a->max_y || b->max_y < a->min_y) continue;
+
+            world->pair_tests++;
+            Body_Contact contact;
+            if (collide_bodies(a, b, &contact)) {
+                resolve_contact(a, b, &contact);
+                world->contacts++;
+            }
+        }
+    }
+}
+
+// Clears last step's solid cells through the cell list, then fills each body's bounding box
+// only, recording the rigid-body velocity of every covered cell for the fluid boundary
+void rasterize_bodies(Body_World *world, Fluid *fluid) {
+    int w = fluid->params.w, h = fluid->params.h, s = fluid->stride;
+    float to_fluid = 1.0f / (fluid->params.dt * glm_max(w, h));
+
+    for (int k = 0; k < fluid->solid_cell_count; k++) fluid->solid[fluid->solid_cells[k]] = 0;
+    fluid->solid_cell_count = 0;
+
+    for (int b = 0; b < world->count; b++) {
+        Rigid_Body *body = &world->bodies[b];
+        int i0 = glm_max(1, (int)ceilf(body->min_x)), i1 = glm_min(w, (int)floorf(body->max_x));
+        int j0 = glm_max(1, (int)ceilf(body->min_y)), j1 = glm_min(h, (int)floorf(body->max_y));
+
+        for (int j = j0; j <= j1; j++) {
+            for (int i = i0; i <= i1; i++) {
+                int idx = i + j * s;
+                if (fluid->solid[idx] || !body_contains(body, (float)i, (float)j)) continue;
+
+                int k = fluid->solid_cell_count++;
+                fluid->solid[idx] = 1;
+                fluid->solid_cells[k] = idx;
+                fluid->solid_cell_u[k] = (body->vel[0] - body->spin * (j - body->pos[1])) * to_fluid;
+                fluid->solid_cell_v[k] = (body->vel[1] + body->spin * (i - body->pos[0])) * to_fluid;
+            }
+        }
+    }
+}
+
+void step_bodies(Body_World *world, Fluid *fluid) {
+    Perf_Scope scope = perf_zone_begin("bodies forces");
+    Body_Force_Job job = {world, fluid};
+    Kernel_Tuning tuning = g_tuning[TUNE_ADVECT];
+    tuning.grain = 16;
+    parallel_for(0, world->count, tuning, body_fluid_forces_rows, &job);
+
+    for (int b = 0; b < world->count; b++) {
+        Rigid_Body *body = &world->bodies[b];
+        body->vel[0] += body->impulse[0] * body->inv_mass;
+        body->vel[1] += body->impulse[1] * body->inv_mass;
+        body->spin += body->angular_impulse * body->inv_inertia;
+
+        // Keep the explicit coupling stable: at most half a cell and a few degrees per step
+        float speed = sqrtf(body->vel[0] * body->vel[0] + body->vel[1] * body->vel[1]);
+        if (speed > 0.5f) glm_vec2_scale(body->vel, 0.5f / speed, body->vel);
+        body->spin = glm_clamp(body->spin, -0.1f, 0.1f);
+
+        body->pos[0] += body->vel[0];
+        body->pos[1] += body->vel[1];
+        body->angle += body->spin;
+        update_body_geometry(body);
+    }
+    perf_zone_end(&scope, world->count);
+
+    scope = perf_zone_begin("bodies collide");
+    sweep_and_prune(world);
+    for (int b = 0; b < world->count; b++) collide_walls(&world->bodies[b], fluid);
+    perf_zone_end(&scope, world->count);
+
+    scope = perf_zone_begin("bodies raster");
+    rasterize_bodies(world, fluid);
+    perf_zone_end(&scope, fluid->solid_cell_count);
+}
+
+static void plot_outline_cell(Cell_Grid *grid, Fluid *fluid, float fx, float fy, uint8_t glyph) {
+    int x = (int)((fx - 0.5f) * grid->cols / fluid->params.w);
+    int y = (int)((fy - 0.5f) * grid->rows / fluid->params.h);
+    if (x < 0 || y < 0 || x >= (int)grid->cols || y >= (int)grid->rows) return;
+
+    Cell *cell = &grid->cells[x + y * grid->cols];
+    cell->glyph = glyph;
+    cell->color = PALETTE_OUTLINE;
+}
+
+// Outlines are traced in fluid space and stepped finely enough to touch every grid cell they cross
+void draw_body_outlines(Body_World *world, Fluid *fluid, Cell_Grid *grid) {
+    float step = 0.5f * glm_min((float)fluid->params.w / grid->cols, (float)fluid->params.h / grid->rows);
+
+    for (int b = 0; b < world->count; b++) {
+        Rigid_Body *body = &world->bodies[b];
+        if (body->shape == BODY_CIRCLE) {
+            int samples = glm_max(8, (int)(6.2831853f * body->radius / step));
+            for (int k = 0; k < samples; k++) {
+                float a = 6.2831853f * k / samples;
+                plot_outline_cell(grid, fluid, body->pos[0] + body->radius * cosf(a), body->pos[1] + body->radius * sinf(a), 'o');
+            }
+            continue;
+        }
+
+        for (int v = 0; v < body->vertex_count; v++) {
+            float *p0 = body->world[v], *p1 = body->world[(v + 1) % body->vertex_count];
+            float dx = p1[0] - p0[0], dy = p1[1] - p0[1];
+            // Grid y points down, so a positive slope reads as a backslash
+            uint8_t glyph = fabsf(dx) > 2.0f * fabsf(dy) ? '-' : fabsf(dy) > 2.0f * fabsf(dx) ? '|' : dx * dy > 0.0f ? '\\' : '/';
+            int samples = glm_max(1, (int)(sqrtf(dx * dx + dy * dy) / step));
+            for (int k = 0; k <= samples; k++) {
+                float t = (float)k / samples;
+                plot_outline_cell(grid, fluid, p0[0] + t * dx, p0[1] + t * dy, glyph);
+            }
+        }
+    }
+}
+
+void run_bodies_bench() {
+    static const int counts[] = {100, 200, 400, 800};
+
+    trace_log("Rigid body bench (%dx%d fluid, %d steps):", FLUID_WIDTH, FLUID_HEIGHT, BENCH_STEP_COUNT);
+    trace_log("  %6s %10s %10s %10s %10s %12s %10s", "bodies", "forces ms", "collide ms", "raster ms", "fluid ms", "pairs/step", "n^2/2");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        Fluid_Params params = default_fluid_params();
+        params.scenario = SCENARIO_BODIES;
+        Fluid fluid;
+        Body_World world;
+        initialize_fluid(&fluid, params);
+        initialize_body_world(&world, &fluid, counts[c]);
+
+        reset_perf_zones();
+        uint64_t fluid_ns = 0;
+        for (int i = 0; i < BENCH_STEP_COUNT; i++) {
+            step_bodies(&world, &fluid);
+            uint64_t start = now_ns();
+            step_fluid(&fluid);
+            fluid_ns += now_ns() - start;
+        }
+
+        double per_step = 1.0e6 * BENCH_STEP_COUNT;
+        trace_log("  %6d %10.3f %10.3f %10.3f %10.3f %12.0f %10d", counts[c],
+                  perf_zone_wall_ns("bodies forces") / per_step, perf_zone_wall_ns("bodies collide") / per_step,
+                  perf_zone_wall_ns("bodies raster") / per_step, fluid_ns / per_step,
+                  (double)world.pair_tests / BENCH_STEP_COUNT, counts[c] * (counts[c] - 1) / 2);
+
+        destroy_body_world(&world);
+        destroy_fluid(&fluid);
+    }
 }